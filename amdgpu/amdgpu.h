@@ -143,6 +143,11 @@ typedef struct amdgpu_va *amdgpu_va_handle;
  */
 typedef struct amdgpu_semaphore *amdgpu_semaphore_handle;
 
+/**
+ * Define handle for a prepared command submission
+ */
+typedef struct amdgpu_cs_submission *amdgpu_cs_submission_handle;
+
 /*--------------------------------------------------------------------------*/
 /* -------------------------- Structures ---------------------------------- */
 /*--------------------------------------------------------------------------*/
@@ -243,6 +248,32 @@ struct amdgpu_bo_import_result {
 	uint64_t alloc_size;
 };
 
+/**
+ * Statistics of the BO reuse cache
+ *
+ * \sa amdgpu_bo_cache_query_stats()
+ *
+*/
+struct amdgpu_bo_cache_stats {
+	/** Allocations served from the cache */
+	uint64_t hits;
+
+	/** Allocations which had to go to the kernel */
+	uint64_t misses;
+
+	/** Misses where a matching buffer was cached but still busy */
+	uint64_t busy;
+
+	/** Cached buffers released because of age, budget or trimming */
+	uint64_t evictions;
+
+	/** Number of buffers currently cached */
+	uint32_t cached_count;
+
+	/** Total size of the buffers currently cached */
+	uint64_t cached_bytes;
+};
+
 /**
  *
  * Structure to describe GDS partitioning information.
@@ -775,6 +806,66 @@ int amdgpu_bo_wait_for_idle(amdgpu_bo_handle buf_handle,
 			    uint64_t timeout_ns,
 			    bool *buffer_busy);
 
+/**
+ * Enable, reconfigure or disable the BO reuse cache of a device
+ *
+ * When enabled, amdgpu_bo_free() keeps VRAM and GTT buffers created by
+ * amdgpu_bo_alloc() instead of closing them, and amdgpu_bo_alloc() hands
+ * out an idle cached buffer with the same heap, flags and size bucket. The
+ * sizes of those allocations are rounded up to the bucket size. Buffers in
+ * other heaps, which were exported, had metadata set or were allocated
+ * with AMDGPU_GEM_CREATE_VRAM_CLEARED are never cached.
+ *
+ * \param   dev        - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   max_age_ms - \c [in] Time after which cached buffers are released,
+ *                               0 disables the cache and releases all of them
+ * \param   max_bytes  - \c [in] Upper bound on the size of all cached
+ *                               buffers, the oldest are released first
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note The device handle is shared by everyone using the same device, so
+ *	 the setting applies to all of them.
+ * \note GPU VA mappings must be removed with amdgpu_bo_va_op() before a
+ *	 buffer is freed, otherwise they are inherited by the next user.
+ *
+ * \sa amdgpu_bo_cache_trim(), amdgpu_bo_cache_query_stats()
+ *
+*/
+int amdgpu_bo_cache_enable(amdgpu_device_handle dev, uint32_t max_age_ms,
+			   uint64_t max_bytes);
+
+/**
+ * Release cached buffers which have been unused for some time
+ *
+ * \param   dev        - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   max_age_ms - \c [in] Release buffers freed longer ago than this,
+ *                               0 releases all of them
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_cache_enable()
+ *
+*/
+int amdgpu_bo_cache_trim(amdgpu_device_handle dev, uint32_t max_age_ms);
+
+/**
+ * Query the statistics of the BO reuse cache
+ *
+ * \param   dev   - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   stats - \c [out] Counters since the device was initialized
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_cache_enable()
+ *
+*/
+int amdgpu_bo_cache_query_stats(amdgpu_device_handle dev,
+				struct amdgpu_bo_cache_stats *stats);
+
 /**
  * Creates a BO list handle for command submission.
  *
@@ -1003,6 +1094,70 @@ int amdgpu_cs_submit(amdgpu_context_handle context,
 		     struct amdgpu_cs_request *ibs_request,
 		     uint32_t number_of_requests);
 
+/**
+ * Create a prepared submission for one ring of a context
+ *
+ * A prepared submission keeps the chunk and dependency buffers built for
+ * each request, so submitting through it does not allocate once the
+ * buffers are large enough. Submissions to different rings of the same
+ * context do not serialize with each other.
+ *
+ * \param   context          - \c [in]  GPU Context
+ * \param   ip_type          - \c [in]  Hardware IP block type = AMDGPU_HW_IP_*
+ * \param   ip_instance      - \c [in]  Index of the IP block of the same type
+ * \param   ring             - \c [in]  Specify ring index of the IP
+ * \param   max_ibs          - \c [in]  Number of IBs to size the buffers for
+ * \param   max_dependencies - \c [in]  Number of dependencies to size the
+ *				       buffers for
+ * \param   submission       - \c [out] Prepared submission handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note Larger requests are still accepted, the buffers grow as needed.
+ * \note The prepared submission must be destroyed before the context.
+ *
+ * \sa amdgpu_cs_submission_submit(), amdgpu_cs_submission_destroy()
+ *
+*/
+int amdgpu_cs_submission_create(amdgpu_context_handle context,
+				uint32_t ip_type,
+				uint32_t ip_instance,
+				uint32_t ring,
+				uint32_t max_ibs,
+				uint32_t max_dependencies,
+				amdgpu_cs_submission_handle *submission);
+
+/**
+ * Send a request to the kernel through a prepared submission
+ *
+ * \param   submission  - \c [in]  Prepared submission handle
+ * \param   ibs_request - \c [in/out] Submission request, its ip_type,
+ *				    ip_instance and ring must match the
+ *				    prepared submission
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_submit(), amdgpu_cs_submission_create()
+ *
+*/
+int amdgpu_cs_submission_submit(amdgpu_cs_submission_handle submission,
+				struct amdgpu_cs_request *ibs_request);
+
+/**
+ * Destroy a prepared submission
+ *
+ * \param   submission - \c [in] Prepared submission handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_submission_create()
+ *
+*/
+int amdgpu_cs_submission_destroy(amdgpu_cs_submission_handle submission);
+
 /**
  *  Query status of Command Buffer Submission
  *
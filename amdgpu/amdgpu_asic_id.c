@@ -29,11 +29,130 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "xf86drm.h"
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
 
+/*
+ * Binary form of amdgpu.ids, written by gen_amdgpu_ids.py at build time and
+ * installed next to the text file. All fields are little endian:
+ *
+ *   header   see below
+ *   entries  count x { uint32_t device_id << 8 | revision_id,
+ *                      uint32_t offset of the name in the strings }
+ *            sorted by the first field
+ *   strings  NUL terminated, the version of the text file first
+ *
+ * The text file size is recorded so that an edited amdgpu.ids, which also
+ * is newer than the binary, is used instead of the stale table.
+ */
+#define ASIC_ID_BIN_MAGIC	"AMDGPUID"
+#define ASIC_ID_BIN_FORMAT	1
+#define ASIC_ID_BIN_HEADER_SIZE	40
+#define ASIC_ID_BIN_ENTRY_SIZE	8
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+/*
+ * Look the device up in the binary table. Returns -EAGAIN if the table is
+ * missing, stale or malformed, -ENOENT if it has no entry for the device.
+ */
+drm_private int amdgpu_find_asic_id_bin(struct amdgpu_device *dev,
+					const char *text_path,
+					const char *bin_path)
+{
+	struct stat text_st, bin_st;
+	const uint8_t *map, *entries;
+	const char *strings;
+	uint32_t count, version_offset, strings_offset, strings_size;
+	uint32_t key, lo, hi;
+	int fd, r = -EAGAIN;
+
+	if (dev->info.asic_id > 0xffff || dev->info.pci_rev_id > 0xff)
+		return -ENOENT;
+
+	fd = open(bin_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -EAGAIN;
+
+	if (fstat(fd, &bin_st) || bin_st.st_size < ASIC_ID_BIN_HEADER_SIZE) {
+		close(fd);
+		return -EAGAIN;
+	}
+
+	map = mmap(NULL, bin_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -EAGAIN;
+
+	if (memcmp(map, ASIC_ID_BIN_MAGIC, 8) ||
+	    get_le32(map + 8) != ASIC_ID_BIN_FORMAT)
+		goto out;
+
+	if (stat(text_path, &text_st) == 0 &&
+	    ((uint64_t)text_st.st_size != get_le64(map + 16) ||
+	     text_st.st_mtime > bin_st.st_mtime))
+		goto out;
+
+	count = get_le32(map + 12);
+	version_offset = get_le32(map + 24);
+	strings_offset = get_le32(map + 28);
+	strings_size = get_le32(map + 32);
+	if (strings_offset != ASIC_ID_BIN_HEADER_SIZE +
+	    (uint64_t)count * ASIC_ID_BIN_ENTRY_SIZE ||
+	    (uint64_t)strings_offset + strings_size > (uint64_t)bin_st.st_size ||
+	    !strings_size || map[strings_offset + strings_size - 1] != '\0' ||
+	    version_offset >= strings_size)
+		goto out;
+
+	entries = map + ASIC_ID_BIN_HEADER_SIZE;
+	strings = (const char *)map + strings_offset;
+	drmMsg("%s version: %s\n", text_path, strings + version_offset);
+
+	key = dev->info.asic_id << 8 | dev->info.pci_rev_id;
+	lo = 0;
+	hi = count;
+	r = -ENOENT;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const uint8_t *entry = entries + mid * ASIC_ID_BIN_ENTRY_SIZE;
+		uint32_t mid_key = get_le32(entry);
+
+		if (mid_key < key) {
+			lo = mid + 1;
+		} else if (mid_key > key) {
+			hi = mid;
+		} else {
+			uint32_t name = get_le32(entry + 4);
+
+			if (name >= strings_size) {
+				r = -EAGAIN;
+				break;
+			}
+
+			dev->marketing_name = strdup(strings + name);
+			r = dev->marketing_name ? 0 : -ENOMEM;
+			break;
+		}
+	}
+
+out:
+	munmap((void *)map, bin_st.st_size);
+	return r;
+}
+
 static int parse_one_line(struct amdgpu_device *dev, const char *line)
 {
 	char *buf, *saveptr;
@@ -104,7 +223,8 @@ out:
 	return r;
 }
 
-void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
+drm_private void amdgpu_parse_asic_ids_text(struct amdgpu_device *dev,
+					    const char *path)
 {
 	FILE *fp;
 	char *line = NULL;
@@ -113,10 +233,9 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 	int line_num = 1;
 	int r = 0;
 
-	fp = fopen(AMDGPU_ASIC_ID_TABLE, "r");
+	fp = fopen(path, "r");
 	if (!fp) {
-		fprintf(stderr, "%s: %s\n", AMDGPU_ASIC_ID_TABLE,
-			strerror(errno));
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
 		return;
 	}
 
@@ -132,7 +251,7 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 			continue;
 		}
 
-		drmMsg("%s version: %s\n", AMDGPU_ASIC_ID_TABLE, line);
+		drmMsg("%s version: %s\n", path, line);
 		break;
 	}
 
@@ -150,7 +269,7 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 
 	if (r == -EINVAL) {
 		fprintf(stderr, "Invalid format: %s: line %d: %s\n",
-			AMDGPU_ASIC_ID_TABLE, line_num, line);
+			path, line_num, line);
 	} else if (r && r != -EAGAIN) {
 		fprintf(stderr, "%s: Cannot parse ASIC IDs: %s\n",
 			__func__, strerror(-r));
@@ -159,3 +278,16 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 	free(line);
 	fclose(fp);
 }
+
+void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
+{
+	int r;
+
+	r = amdgpu_find_asic_id_bin(dev, AMDGPU_ASIC_ID_TABLE,
+				    AMDGPU_ASIC_ID_TABLE ".bin");
+	if (r == -EAGAIN)
+		amdgpu_parse_asic_ids_text(dev, AMDGPU_ASIC_ID_TABLE);
+	else if (r && r != -ENOENT)
+		fprintf(stderr, "%s: Cannot parse ASIC IDs: %s\n",
+			__func__, strerror(-r));
+}
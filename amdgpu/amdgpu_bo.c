@@ -32,6 +32,7 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "libdrm_macros.h"
 #include "xf86drm.h"
@@ -59,31 +60,404 @@ static int amdgpu_bo_create(amdgpu_device_handle dev,
 	if (!bo)
 		return -ENOMEM;
 
-	r = handle_table_insert(&dev->bo_handles, handle, bo);
-	if (r) {
-		free(bo);
-		return r;
-	}
-
+	/* Lookups don't take bo_table_mutex, so the BO must be fully set up
+	 * before it is published in the table. */
 	atomic_set(&bo->refcount, 1);
 	bo->dev = dev;
 	bo->alloc_size = size;
 	bo->handle = handle;
 	pthread_mutex_init(&bo->cpu_access_mutex, NULL);
 
+	r = handle_table_insert(&dev->bo_handles, handle, bo);
+	if (r) {
+		pthread_mutex_destroy(&bo->cpu_access_mutex);
+		free(bo);
+		return r;
+	}
+
 	*buf_handle = bo;
 	return 0;
 }
 
+/*
+ * Look up a BO and take a reference on it without bo_table_mutex. A BO
+ * whose refcount already dropped to zero is being freed and is treated as
+ * not found; the caller then falls back to the locked path, which
+ * serializes against amdgpu_bo_free.
+ */
+static struct amdgpu_bo *amdgpu_bo_lookup_ref(struct handle_table *table,
+					      uint32_t key)
+{
+	struct amdgpu_bo *bo;
+	int idx;
+
+	idx = handle_table_read_lock(table);
+	bo = handle_table_lookup(table, key);
+	if (bo && atomic_add_unless(&bo->refcount, 1, 0))
+		bo = NULL;
+	handle_table_read_unlock(table, idx);
+
+	return bo;
+}
+
+static uint64_t amdgpu_bo_cache_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Buffers freed before the returned time are too old to be kept. */
+static uint64_t amdgpu_bo_cache_cutoff(uint32_t max_age_ms)
+{
+	uint64_t now = amdgpu_bo_cache_time_ms();
+
+	if (!max_age_ms)
+		return UINT64_MAX;
+	return now > max_age_ms ? now - max_age_ms : 0;
+}
+
+static void amdgpu_bo_cache_add_bucket(struct amdgpu_bo_cache *cache,
+				       uint64_t size)
+{
+	unsigned i = cache->num_buckets;
+
+	assert(i < AMDGPU_BO_CACHE_MAX_BUCKETS);
+
+	list_inithead(&cache->buckets[i].list);
+	cache->buckets[i].size = size;
+	cache->num_buckets++;
+}
+
+drm_private void amdgpu_bo_cache_init(struct amdgpu_device *dev)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	uint64_t size, cache_max_size = 64 * 1024 * 1024;
+
+	pthread_mutex_init(&cache->mutex, NULL);
+	list_inithead(&cache->lru);
+
+	/* The same buckets as the freedreno and etnaviv caches: 4K, 8K and
+	 * 12K, then four steps per power of two. */
+	amdgpu_bo_cache_add_bucket(cache, 4096);
+	amdgpu_bo_cache_add_bucket(cache, 4096 * 2);
+	amdgpu_bo_cache_add_bucket(cache, 4096 * 3);
+
+	for (size = 4 * 4096; size <= cache_max_size; size *= 2) {
+		amdgpu_bo_cache_add_bucket(cache, size);
+		amdgpu_bo_cache_add_bucket(cache, size + size * 1 / 4);
+		amdgpu_bo_cache_add_bucket(cache, size + size * 2 / 4);
+		amdgpu_bo_cache_add_bucket(cache, size + size * 3 / 4);
+	}
+}
+
+static struct amdgpu_bo_cache_bucket *
+amdgpu_bo_cache_get_bucket(struct amdgpu_bo_cache *cache, uint64_t size)
+{
+	unsigned i;
+
+	for (i = 0; i < cache->num_buckets; i++) {
+		if (cache->buckets[i].size >= size)
+			return &cache->buckets[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Move buffers freed before @cutoff_ms to @evicted, then the oldest ones
+ * until the cache fits in @max_bytes. Called with the cache mutex held.
+ */
+static void amdgpu_bo_cache_evict(struct amdgpu_bo_cache *cache,
+				  uint64_t cutoff_ms, uint64_t max_bytes,
+				  struct list_head *evicted)
+{
+	while (!LIST_IS_EMPTY(&cache->lru)) {
+		struct amdgpu_bo *bo = LIST_FIRST_ENTRY(&cache->lru,
+							struct amdgpu_bo,
+							cache_lru);
+
+		if (bo->free_time_ms >= cutoff_ms &&
+		    cache->stats.cached_bytes <= max_bytes)
+			break;
+
+		list_del(&bo->cache_bucket);
+		list_del(&bo->cache_lru);
+		list_addtail(&bo->cache_lru, evicted);
+		cache->stats.cached_count--;
+		cache->stats.cached_bytes -= bo->alloc_size;
+		cache->stats.evictions++;
+	}
+}
+
+/*
+ * Close evicted buffers. Called with bo_table_mutex held; the buffers have
+ * already left bo_handles, but lockless lookups may still see them.
+ */
+static void amdgpu_bo_cache_release(struct amdgpu_device *dev,
+				    struct list_head *evicted)
+{
+	struct amdgpu_bo *bo, *tmp;
+
+	if (LIST_IS_EMPTY(evicted))
+		return;
+
+	handle_table_synchronize(&dev->bo_handles);
+
+	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, evicted, cache_lru) {
+		amdgpu_close_kms_handle(dev->fd, bo->handle);
+		pthread_mutex_destroy(&bo->cpu_access_mutex);
+		free(bo);
+	}
+}
+
+drm_private void amdgpu_bo_cache_fini(struct amdgpu_device *dev)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	struct list_head evicted;
+
+	list_inithead(&evicted);
+
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	pthread_mutex_lock(&cache->mutex);
+	amdgpu_bo_cache_evict(cache, UINT64_MAX, 0, &evicted);
+	pthread_mutex_unlock(&cache->mutex);
+	amdgpu_bo_cache_release(dev, &evicted);
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+
+	pthread_mutex_destroy(&cache->mutex);
+}
+
+/* Only sizes in bytes can be rounded up to a bucket. */
+static bool amdgpu_bo_cache_heap(uint32_t heap)
+{
+	return heap && !(heap & ~(AMDGPU_GEM_DOMAIN_VRAM |
+				  AMDGPU_GEM_DOMAIN_GTT));
+}
+
+/*
+ * Put back a buffer taken out by amdgpu_bo_cache_take(), keeping the LRU
+ * list in free time order. Called with the cache mutex held.
+ */
+static void amdgpu_bo_cache_return(struct amdgpu_bo_cache *cache,
+				   struct amdgpu_bo_cache_bucket *bucket,
+				   struct amdgpu_bo *bo)
+{
+	struct amdgpu_bo *next;
+
+	list_add(&bo->cache_bucket, &bucket->list);
+	LIST_FOR_EACH_ENTRY(next, &cache->lru, cache_lru) {
+		if (next->free_time_ms > bo->free_time_ms)
+			break;
+	}
+	list_addtail(&bo->cache_lru, &next->cache_lru);
+	cache->stats.cached_count++;
+	cache->stats.cached_bytes += bo->alloc_size;
+}
+
+/*
+ * Take an idle cached buffer matching @request out of the cache. If the
+ * cache is enabled and has a bucket for the request, *size is rounded up to
+ * the bucket size whether or not a buffer is found.
+ */
+static struct amdgpu_bo *
+amdgpu_bo_cache_take(struct amdgpu_device *dev,
+		     struct amdgpu_bo_alloc_request *request, uint64_t *size)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	struct amdgpu_bo_cache_bucket *bucket;
+	struct amdgpu_bo *bo, *found = NULL;
+	bool busy;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	if (!cache->max_age_ms)
+		goto out;
+
+	bucket = amdgpu_bo_cache_get_bucket(cache, request->alloc_size);
+	if (!bucket)
+		goto out;
+
+	*size = bucket->size;
+
+	LIST_FOR_EACH_ENTRY(bo, &bucket->list, cache_bucket) {
+		if (bo->heap != request->preferred_heap ||
+		    bo->flags != request->flags)
+			continue;
+
+		if (request->phys_alignment &&
+		    (!bo->phys_alignment ||
+		     bo->phys_alignment % request->phys_alignment))
+			continue;
+
+		found = bo;
+		break;
+	}
+
+	if (found) {
+		list_del(&found->cache_bucket);
+		list_del(&found->cache_lru);
+		cache->stats.cached_count--;
+		cache->stats.cached_bytes -= found->alloc_size;
+	}
+
+out:
+	if (!found)
+		cache->stats.misses++;
+	pthread_mutex_unlock(&cache->mutex);
+	if (!found)
+		return NULL;
+
+	/* Ask the kernel without blocking other allocations and frees. */
+	if (amdgpu_bo_wait_for_idle(found, 0, &busy))
+		busy = true;
+
+	pthread_mutex_lock(&cache->mutex);
+	if (busy) {
+		/* Buffers are kept oldest first, so if this one is still in
+		 * use the newer ones most likely are too. */
+		amdgpu_bo_cache_return(cache, bucket, found);
+		cache->stats.busy++;
+		cache->stats.misses++;
+		found = NULL;
+	} else {
+		cache->stats.hits++;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return found;
+}
+
+/*
+ * Keep a buffer whose last reference was dropped for reuse. Called with
+ * bo_table_mutex held, after the buffer left bo_handles and lost its CPU
+ * mapping. Returns false if the buffer must be destroyed instead.
+ */
+static bool amdgpu_bo_cache_put(struct amdgpu_device *dev,
+				struct amdgpu_bo *bo)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	struct amdgpu_bo_cache_bucket *bucket;
+	struct list_head evicted;
+
+	if (!bo->reusable)
+		return false;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	bucket = cache->max_age_ms ?
+		amdgpu_bo_cache_get_bucket(cache, bo->alloc_size) : NULL;
+	if (!bucket || bucket->size != bo->alloc_size ||
+	    bo->alloc_size > cache->max_bytes) {
+		pthread_mutex_unlock(&cache->mutex);
+		return false;
+	}
+
+	bo->free_time_ms = amdgpu_bo_cache_time_ms();
+	list_addtail(&bo->cache_bucket, &bucket->list);
+	list_addtail(&bo->cache_lru, &cache->lru);
+	cache->stats.cached_count++;
+	cache->stats.cached_bytes += bo->alloc_size;
+
+	list_inithead(&evicted);
+	amdgpu_bo_cache_evict(cache, bo->free_time_ms > cache->max_age_ms ?
+			      bo->free_time_ms - cache->max_age_ms : 0,
+			      cache->max_bytes, &evicted);
+	pthread_mutex_unlock(&cache->mutex);
+
+	amdgpu_bo_cache_release(dev, &evicted);
+	return true;
+}
+
+drm_public int amdgpu_bo_cache_enable(amdgpu_device_handle dev,
+				      uint32_t max_age_ms, uint64_t max_bytes)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	struct list_head evicted;
+
+	list_inithead(&evicted);
+
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	pthread_mutex_lock(&cache->mutex);
+	cache->max_age_ms = max_age_ms;
+	cache->max_bytes = max_bytes;
+	amdgpu_bo_cache_evict(cache, amdgpu_bo_cache_cutoff(max_age_ms),
+			      max_bytes, &evicted);
+	pthread_mutex_unlock(&cache->mutex);
+	amdgpu_bo_cache_release(dev, &evicted);
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+
+	return 0;
+}
+
+drm_public int amdgpu_bo_cache_trim(amdgpu_device_handle dev,
+				    uint32_t max_age_ms)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	struct list_head evicted;
+
+	list_inithead(&evicted);
+
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	pthread_mutex_lock(&cache->mutex);
+	amdgpu_bo_cache_evict(cache, amdgpu_bo_cache_cutoff(max_age_ms),
+			      cache->max_bytes, &evicted);
+	pthread_mutex_unlock(&cache->mutex);
+	amdgpu_bo_cache_release(dev, &evicted);
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+
+	return 0;
+}
+
+drm_public int amdgpu_bo_cache_query_stats(amdgpu_device_handle dev,
+					   struct amdgpu_bo_cache_stats *stats)
+{
+	pthread_mutex_lock(&dev->bo_cache.mutex);
+	*stats = dev->bo_cache.stats;
+	pthread_mutex_unlock(&dev->bo_cache.mutex);
+
+	return 0;
+}
+
 drm_public int amdgpu_bo_alloc(amdgpu_device_handle dev,
 			       struct amdgpu_bo_alloc_request *alloc_buffer,
 			       amdgpu_bo_handle *buf_handle)
 {
 	union drm_amdgpu_gem_create args;
+	uint64_t size = alloc_buffer->alloc_size;
+	bool reusable;
+	struct amdgpu_bo *bo;
 	int r;
 
+	/* Cleared VRAM is only guaranteed for a fresh allocation. */
+	reusable = amdgpu_bo_cache_heap(alloc_buffer->preferred_heap) &&
+		   !(alloc_buffer->flags & AMDGPU_GEM_CREATE_VRAM_CLEARED);
+	if (reusable) {
+		bo = amdgpu_bo_cache_take(dev, alloc_buffer, &size);
+		if (bo) {
+			pthread_mutex_lock(&dev->bo_table_mutex);
+			atomic_set(&bo->refcount, 1);
+			r = handle_table_insert(&dev->bo_handles, bo->handle,
+						bo);
+			if (r) {
+				struct list_head evicted;
+
+				list_inithead(&evicted);
+				list_addtail(&bo->cache_lru, &evicted);
+				amdgpu_bo_cache_release(dev, &evicted);
+			}
+			pthread_mutex_unlock(&dev->bo_table_mutex);
+			if (r)
+				return r;
+
+			*buf_handle = bo;
+			return 0;
+		}
+	}
+
 	memset(&args, 0, sizeof(args));
-	args.in.bo_size = alloc_buffer->alloc_size;
+	args.in.bo_size = size;
 	args.in.alignment = alloc_buffer->phys_alignment;
 
 	/* Set the placement. */
@@ -97,8 +471,14 @@ drm_public int amdgpu_bo_alloc(amdgpu_device_handle dev,
 		goto out;
 
 	pthread_mutex_lock(&dev->bo_table_mutex);
-	r = amdgpu_bo_create(dev, alloc_buffer->alloc_size, args.out.handle,
-			     buf_handle);
+	r = amdgpu_bo_create(dev, size, args.out.handle, buf_handle);
+	if (!r) {
+		bo = *buf_handle;
+		bo->heap = alloc_buffer->preferred_heap;
+		bo->flags = alloc_buffer->flags;
+		bo->phys_alignment = alloc_buffer->phys_alignment;
+		bo->reusable = reusable;
+	}
 	pthread_mutex_unlock(&dev->bo_table_mutex);
 	if (r) {
 		amdgpu_close_kms_handle(dev->fd, args.out.handle);
@@ -113,6 +493,9 @@ drm_public int amdgpu_bo_set_metadata(amdgpu_bo_handle bo,
 {
 	struct drm_amdgpu_gem_metadata args = {};
 
+	/* The next user of a cached buffer would inherit the metadata. */
+	bo->reusable = false;
+
 	args.handle = bo->handle;
 	args.op = AMDGPU_GEM_METADATA_OP_SET_METADATA;
 	args.data.flags = info->flags;
@@ -231,6 +614,9 @@ drm_public int amdgpu_bo_export(amdgpu_bo_handle bo,
 {
 	int r;
 
+	/* Other users may hold on to a shared buffer after it is freed. */
+	bo->reusable = false;
+
 	switch (type) {
 	case amdgpu_bo_handle_type_gem_flink_name:
 		r = amdgpu_bo_export_flink(bo);
@@ -266,6 +652,23 @@ drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 	int dma_fd;
 	uint64_t dma_buf_size = 0;
 
+	/* Fast path: the buffer was already imported, so just take another
+	 * reference without serializing on bo_table_mutex. */
+	if (type == amdgpu_bo_handle_type_gem_flink_name) {
+		bo = amdgpu_bo_lookup_ref(&dev->bo_flink_names, shared_handle);
+	} else if (type == amdgpu_bo_handle_type_dma_buf_fd) {
+		/* Repeating this under the lock below is harmless, the
+		 * kernel returns the same handle for the same buffer. */
+		if (drmPrimeFDToHandle(dev->fd, shared_handle, &handle) == 0)
+			bo = amdgpu_bo_lookup_ref(&dev->bo_handles, handle);
+	}
+
+	if (bo) {
+		output->buf_handle = bo;
+		output->alloc_size = bo->alloc_size;
+		return 0;
+	}
+
 	/* We must maintain a list of pairs <handle, bo>, so that we always
 	 * return the same amdgpu_bo instance for the same handle. */
 	pthread_mutex_lock(&dev->bo_table_mutex);
@@ -399,27 +802,42 @@ drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 
 	assert(bo != NULL);
 	dev = bo->dev;
+
+	/* Dropping a reference other than the last one needs no lock. */
+	if (!atomic_add_unless(&bo->refcount, -1, 1))
+		return 0;
+
 	pthread_mutex_lock(&dev->bo_table_mutex);
 
 	if (update_references(&bo->refcount, NULL)) {
-		/* Remove the buffer from the hash tables. */
 		handle_table_remove(&dev->bo_handles, bo->handle);
 
-		if (bo->flink_name)
-			handle_table_remove(&dev->bo_flink_names,
-					    bo->flink_name);
-
 		/* Release CPU access. */
 		if (bo->cpu_map_count > 0) {
 			bo->cpu_map_count = 1;
 			amdgpu_bo_cpu_unmap(bo);
 		}
 
+		/* A cached buffer keeps its handle. Lockless lookups which
+		 * still see it fail because its refcount is zero. */
+		if (amdgpu_bo_cache_put(dev, bo))
+			goto unlock;
+
+		/* Wait for lockless lookups which may still see the buffer. */
+		handle_table_synchronize(&dev->bo_handles);
+
+		if (bo->flink_name) {
+			handle_table_remove(&dev->bo_flink_names,
+					    bo->flink_name);
+			handle_table_synchronize(&dev->bo_flink_names);
+		}
+
 		amdgpu_close_kms_handle(dev->fd, bo->handle);
 		pthread_mutex_destroy(&bo->cpu_access_mutex);
 		free(bo);
 	}
 
+unlock:
 	pthread_mutex_unlock(&dev->bo_table_mutex);
 
 	return 0;
@@ -470,6 +888,15 @@ drm_public int amdgpu_bo_cpu_map(amdgpu_bo_handle bo, void **cpu)
 		return -errno;
 	}
 
+	pthread_mutex_lock(&bo->dev->cpu_map_mutex);
+	r = drmSLInsert(bo->dev->cpu_map_index, (unsigned long)ptr, bo);
+	pthread_mutex_unlock(&bo->dev->cpu_map_mutex);
+	if (r < 0) {
+		drm_munmap(ptr, bo->alloc_size);
+		pthread_mutex_unlock(&bo->cpu_access_mutex);
+		return -ENOMEM;
+	}
+
 	bo->cpu_ptr = ptr;
 	bo->cpu_map_count = 1;
 	pthread_mutex_unlock(&bo->cpu_access_mutex);
@@ -498,6 +925,10 @@ drm_public int amdgpu_bo_cpu_unmap(amdgpu_bo_handle bo)
 		return 0;
 	}
 
+	pthread_mutex_lock(&bo->dev->cpu_map_mutex);
+	drmSLDelete(bo->dev->cpu_map_index, (unsigned long)bo->cpu_ptr);
+	pthread_mutex_unlock(&bo->dev->cpu_map_mutex);
+
 	r = drm_munmap(bo->cpu_ptr, bo->alloc_size) == 0 ? 0 : -errno;
 	bo->cpu_ptr = NULL;
 	pthread_mutex_unlock(&bo->cpu_access_mutex);
@@ -542,7 +973,8 @@ drm_public int amdgpu_find_bo_by_cpu_mapping(amdgpu_device_handle dev,
 					     uint64_t *offset_in_bo)
 {
 	struct amdgpu_bo *bo;
-	uint32_t i;
+	unsigned long start, next_start;
+	void *value, *next_value;
 	int r = 0;
 
 	if (cpu == NULL || size == 0)
@@ -552,27 +984,25 @@ drm_public int amdgpu_find_bo_by_cpu_mapping(amdgpu_device_handle dev,
 	 * Workaround for a buggy application which tries to import previously
 	 * exposed CPU pointers. If we find a real world use case we should
 	 * improve that by asking the kernel for the right handle.
+	 *
+	 * CPU mappings never overlap, so the only candidate is the mapping
+	 * with the highest start address not above cpu.
 	 */
-	pthread_mutex_lock(&dev->bo_table_mutex);
-	for (i = 0; i < dev->bo_handles.max_key; i++) {
-		bo = handle_table_lookup(&dev->bo_handles, i);
-		if (!bo || !bo->cpu_ptr || size > bo->alloc_size)
-			continue;
-		if (cpu >= bo->cpu_ptr &&
-		    cpu < (void*)((uintptr_t)bo->cpu_ptr + bo->alloc_size))
-			break;
-	}
-
-	if (i < dev->bo_handles.max_key) {
-		atomic_inc(&bo->refcount);
+	pthread_mutex_lock(&dev->cpu_map_mutex);
+	drmSLLookupNeighbors(dev->cpu_map_index, (unsigned long)cpu + 1,
+			     &start, &value, &next_start, &next_value);
+	bo = value;
+	if (bo && size <= bo->alloc_size &&
+	    cpu < (void*)(start + bo->alloc_size) &&
+	    !atomic_add_unless(&bo->refcount, 1, 0)) {
 		*buf_handle = bo;
-		*offset_in_bo = (uintptr_t)cpu - (uintptr_t)bo->cpu_ptr;
+		*offset_in_bo = (uintptr_t)cpu - start;
 	} else {
 		*buf_handle = NULL;
 		*offset_in_bo = 0;
 		r = -ENXIO;
 	}
-	pthread_mutex_unlock(&dev->bo_table_mutex);
+	pthread_mutex_unlock(&dev->cpu_map_mutex);
 
 	return r;
 }
@@ -35,9 +35,11 @@
 #include "xf86drm.h"
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
+#include "util_math.h"
 
 static int amdgpu_cs_unreference_sem(amdgpu_semaphore_handle sem);
 static int amdgpu_cs_reset_sem(amdgpu_semaphore_handle sem);
+static void amdgpu_cs_submission_free(struct amdgpu_cs_submission *submission);
 
 /**
  * Create command submission context
@@ -129,6 +131,8 @@ drm_public int amdgpu_cs_ctx_free(amdgpu_context_handle context)
 		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++) {
 			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++) {
 				amdgpu_semaphore_handle sem;
+				if (context->submissions[i][j][k])
+					amdgpu_cs_submission_free(context->submissions[i][j][k]);
 				LIST_FOR_EACH_ENTRY(sem, &context->sem_list[i][j][k], list) {
 					list_del(&sem->list);
 					amdgpu_cs_reset_sem(sem);
@@ -207,48 +211,146 @@ drm_public int amdgpu_cs_query_reset_state2(amdgpu_context_handle context,
 	return r;
 }
 
+static struct amdgpu_cs_submission *
+amdgpu_cs_submission_alloc(amdgpu_context_handle context, uint32_t ip_type,
+			   uint32_t ip_instance, uint32_t ring)
+{
+	struct amdgpu_cs_submission *submission;
+
+	submission = calloc(1, sizeof(struct amdgpu_cs_submission));
+	if (!submission)
+		return NULL;
+
+	submission->context = context;
+	submission->ip_type = ip_type;
+	submission->ip_instance = ip_instance;
+	submission->ring = ring;
+	pthread_mutex_init(&submission->mutex, NULL);
+
+	return submission;
+}
+
+static void amdgpu_cs_submission_free(struct amdgpu_cs_submission *submission)
+{
+	pthread_mutex_destroy(&submission->mutex);
+	free(submission->chunks);
+	free(submission->chunk_data);
+	free(submission->deps);
+	free(submission);
+}
+
+/**
+ * Grow the buffers of a prepared submission to fit \c num_ibs IBs and
+ * \c num_deps dependencies. They never shrink, so once a submission has
+ * seen its largest request it does not allocate any more.
+ */
+static int amdgpu_cs_submission_reserve(struct amdgpu_cs_submission *submission,
+					uint32_t num_ibs, uint32_t num_deps)
+{
+	if (num_ibs > submission->max_ibs) {
+		uint32_t max_ibs = MAX2(num_ibs, submission->max_ibs * 2);
+		struct drm_amdgpu_cs_chunk *chunks;
+		struct drm_amdgpu_cs_chunk_data *chunk_data;
+
+		/* One chunk per IB plus the fence and dependencies chunks,
+		 * chunk data for the IBs and the fence. */
+		chunks = realloc(submission->chunks,
+				 sizeof(struct drm_amdgpu_cs_chunk) * (max_ibs + 2));
+		if (!chunks)
+			return -ENOMEM;
+		submission->chunks = chunks;
+
+		chunk_data = realloc(submission->chunk_data,
+				     sizeof(struct drm_amdgpu_cs_chunk_data) * (max_ibs + 1));
+		if (!chunk_data)
+			return -ENOMEM;
+		submission->chunk_data = chunk_data;
+		submission->max_ibs = max_ibs;
+	}
+
+	if (num_deps > submission->max_deps) {
+		uint32_t max_deps = MAX2(num_deps, submission->max_deps * 2);
+		struct drm_amdgpu_cs_chunk_dep *deps;
+
+		deps = realloc(submission->deps,
+			       sizeof(struct drm_amdgpu_cs_chunk_dep) * max_deps);
+		if (!deps)
+			return -ENOMEM;
+		submission->deps = deps;
+		submission->max_deps = max_deps;
+	}
+
+	return 0;
+}
+
 /**
  * Submit command to kernel DRM
- * \param   dev - \c [in]  Device handle
- * \param   context - \c [in]  GPU Context
+ * \param   submission - \c [in]  Prepared submission for the request's ring,
+ *				  locked by the caller
  * \param   ibs_request - \c [in]  Pointer to submission requests
- * \param   fence - \c [out] return fence for this submission
  *
  * \return  0 on success otherwise POSIX Error code
  * \sa amdgpu_cs_submit()
 */
-static int amdgpu_cs_submit_one(amdgpu_context_handle context,
-				struct amdgpu_cs_request *ibs_request)
+static int amdgpu_cs_submission_submit_locked(struct amdgpu_cs_submission *submission,
+					      struct amdgpu_cs_request *ibs_request)
 {
+	amdgpu_context_handle context = submission->context;
 	struct drm_amdgpu_cs_chunk *chunks;
 	struct drm_amdgpu_cs_chunk_data *chunk_data;
-	struct drm_amdgpu_cs_chunk_dep *dependencies = NULL;
-	struct drm_amdgpu_cs_chunk_dep *sem_dependencies = NULL;
-	amdgpu_device_handle dev = context->dev;
-	struct list_head *sem_list;
+	struct list_head *sem_list, sems;
 	amdgpu_semaphore_handle sem, tmp;
-	uint32_t i, size, num_chunks, bo_list_handle = 0, sem_count = 0;
-	uint64_t seq_no;
+	uint32_t i, num_chunks, num_deps, bo_list_handle = 0;
+	uint64_t seq_no, *last_seq;
 	bool user_fence;
-	int r = 0;
+	int r;
 
-	if (ibs_request->ip_type >= AMDGPU_HW_IP_NUM)
-		return -EINVAL;
-	if (ibs_request->ring >= AMDGPU_CS_MAX_RINGS)
-		return -EINVAL;
 	if (ibs_request->number_of_ibs == 0) {
 		ibs_request->seq_no = AMDGPU_NULL_SUBMIT_SEQ;
 		return 0;
 	}
 	user_fence = (ibs_request->fence_info.handle != NULL);
 
-	size = ibs_request->number_of_ibs + (user_fence ? 2 : 1) + 1;
+	r = amdgpu_cs_submission_reserve(submission, ibs_request->number_of_ibs,
+					 ibs_request->number_of_dependencies);
+	if (r)
+		return r;
 
-	chunks = alloca(sizeof(struct drm_amdgpu_cs_chunk) * size);
+	/* Take the semaphores this ring has to wait for. Only taking them is
+	 * serialized with amdgpu_cs_wait_semaphore(). */
+	sem_list = &context->sem_list[submission->ip_type][submission->ip_instance][submission->ring];
+	list_inithead(&sems);
+	pthread_mutex_lock(&context->sequence_mutex);
+	if (!LIST_IS_EMPTY(sem_list)) {
+		list_replace(sem_list, &sems);
+		list_inithead(sem_list);
+	}
+	pthread_mutex_unlock(&context->sequence_mutex);
 
-	size = ibs_request->number_of_ibs + (user_fence ? 1 : 0);
+	/* Explicit and semaphore dependencies share one chunk. */
+	num_deps = ibs_request->number_of_dependencies;
+	for (i = 0; i < num_deps; i++)
+		amdgpu_cs_chunk_fence_to_dep(&ibs_request->dependencies[i],
+					     &submission->deps[i]);
+
+	LIST_FOR_EACH_ENTRY_SAFE(sem, tmp, &sems, list) {
+		if (!r)
+			r = amdgpu_cs_submission_reserve(submission,
+							 ibs_request->number_of_ibs,
+							 num_deps + 1);
+		if (!r)
+			amdgpu_cs_chunk_fence_to_dep(&sem->signal_fence,
+						     &submission->deps[num_deps++]);
+
+		list_del(&sem->list);
+		amdgpu_cs_reset_sem(sem);
+		amdgpu_cs_unreference_sem(sem);
+	}
+	if (r)
+		return r;
 
-	chunk_data = alloca(sizeof(struct drm_amdgpu_cs_chunk_data) * size);
+	chunks = submission->chunks;
+	chunk_data = submission->chunk_data;
 
 	if (ibs_request->resources)
 		bo_list_handle = ibs_request->resources->handle;
@@ -271,8 +373,6 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 		chunk_data[i].ib_data.flags = ib->flags;
 	}
 
-	pthread_mutex_lock(&context->sequence_mutex);
-
 	if (user_fence) {
 		i = num_chunks++;
 
@@ -284,80 +384,139 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 		/* fence bo handle */
 		chunk_data[i].fence_data.handle = ibs_request->fence_info.handle->handle;
 		/* offset */
-		chunk_data[i].fence_data.offset = 
+		chunk_data[i].fence_data.offset =
 			ibs_request->fence_info.offset * sizeof(uint64_t);
 	}
 
-	if (ibs_request->number_of_dependencies) {
-		dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) *
-			ibs_request->number_of_dependencies);
-		if (!dependencies) {
-			r = -ENOMEM;
-			goto error_unlock;
-		}
-
-		for (i = 0; i < ibs_request->number_of_dependencies; ++i) {
-			struct amdgpu_cs_fence *info = &ibs_request->dependencies[i];
-			struct drm_amdgpu_cs_chunk_dep *dep = &dependencies[i];
-			dep->ip_type = info->ip_type;
-			dep->ip_instance = info->ip_instance;
-			dep->ring = info->ring;
-			dep->ctx_id = info->context->id;
-			dep->handle = info->fence;
-		}
-
-		i = num_chunks++;
-
-		/* dependencies chunk */
-		chunks[i].chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
-		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4
-			* ibs_request->number_of_dependencies;
-		chunks[i].chunk_data = (uint64_t)(uintptr_t)dependencies;
-	}
-
-	sem_list = &context->sem_list[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring];
-	LIST_FOR_EACH_ENTRY(sem, sem_list, list)
-		sem_count++;
-	if (sem_count) {
-		sem_dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) * sem_count);
-		if (!sem_dependencies) {
-			r = -ENOMEM;
-			goto error_unlock;
-		}
-		sem_count = 0;
-		LIST_FOR_EACH_ENTRY_SAFE(sem, tmp, sem_list, list) {
-			struct amdgpu_cs_fence *info = &sem->signal_fence;
-			struct drm_amdgpu_cs_chunk_dep *dep = &sem_dependencies[sem_count++];
-			dep->ip_type = info->ip_type;
-			dep->ip_instance = info->ip_instance;
-			dep->ring = info->ring;
-			dep->ctx_id = info->context->id;
-			dep->handle = info->fence;
-
-			list_del(&sem->list);
-			amdgpu_cs_reset_sem(sem);
-			amdgpu_cs_unreference_sem(sem);
-		}
+	if (num_deps) {
 		i = num_chunks++;
 
 		/* dependencies chunk */
 		chunks[i].chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
-		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 * sem_count;
-		chunks[i].chunk_data = (uint64_t)(uintptr_t)sem_dependencies;
+		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 * num_deps;
+		chunks[i].chunk_data = (uint64_t)(uintptr_t)submission->deps;
 	}
 
-	r = amdgpu_cs_submit_raw2(dev, context, bo_list_handle, num_chunks,
-				  chunks, &seq_no);
+	r = amdgpu_cs_submit_raw2(context->dev, context, bo_list_handle,
+				  num_chunks, chunks, &seq_no);
 	if (r)
-		goto error_unlock;
+		return r;
 
 	ibs_request->seq_no = seq_no;
-	context->last_seq[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring] = ibs_request->seq_no;
-error_unlock:
+
+	/* Submissions to the same ring may return out of order, keep the
+	 * newest sequence number for amdgpu_cs_signal_semaphore(). */
+	last_seq = &context->last_seq[submission->ip_type][submission->ip_instance][submission->ring];
+	pthread_mutex_lock(&context->sequence_mutex);
+	if (seq_no > *last_seq)
+		*last_seq = seq_no;
 	pthread_mutex_unlock(&context->sequence_mutex);
+
+	return 0;
+}
+
+static int amdgpu_cs_submit_one(amdgpu_context_handle context,
+				struct amdgpu_cs_request *ibs_request)
+{
+	struct amdgpu_cs_submission **slot, *submission;
+	int r;
+
+	if (ibs_request->ip_type >= AMDGPU_HW_IP_NUM)
+		return -EINVAL;
+	if (ibs_request->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return -EINVAL;
+	if (ibs_request->ring >= AMDGPU_CS_MAX_RINGS)
+		return -EINVAL;
+	if (ibs_request->number_of_ibs == 0) {
+		ibs_request->seq_no = AMDGPU_NULL_SUBMIT_SEQ;
+		return 0;
+	}
+
+	/* Each ring of the context keeps a prepared submission around, so
+	 * submitting reuses its buffers and only serializes with other
+	 * submissions to the same ring. */
+	slot = &context->submissions[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring];
+	pthread_mutex_lock(&context->sequence_mutex);
+	if (!*slot)
+		*slot = amdgpu_cs_submission_alloc(context, ibs_request->ip_type,
+						   ibs_request->ip_instance,
+						   ibs_request->ring);
+	submission = *slot;
+	pthread_mutex_unlock(&context->sequence_mutex);
+	if (!submission)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&submission->mutex);
+	r = amdgpu_cs_submission_submit_locked(submission, ibs_request);
+	pthread_mutex_unlock(&submission->mutex);
+
 	return r;
 }
 
+drm_public int amdgpu_cs_submission_create(amdgpu_context_handle context,
+					   uint32_t ip_type,
+					   uint32_t ip_instance,
+					   uint32_t ring,
+					   uint32_t max_ibs,
+					   uint32_t max_dependencies,
+					   amdgpu_cs_submission_handle *submission)
+{
+	struct amdgpu_cs_submission *gpu_submission;
+	int r;
+
+	if (!context || !submission)
+		return -EINVAL;
+	if (ip_type >= AMDGPU_HW_IP_NUM)
+		return -EINVAL;
+	if (ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return -EINVAL;
+	if (ring >= AMDGPU_CS_MAX_RINGS)
+		return -EINVAL;
+
+	gpu_submission = amdgpu_cs_submission_alloc(context, ip_type,
+						    ip_instance, ring);
+	if (!gpu_submission)
+		return -ENOMEM;
+
+	r = amdgpu_cs_submission_reserve(gpu_submission, max_ibs,
+					 max_dependencies);
+	if (r) {
+		amdgpu_cs_submission_free(gpu_submission);
+		return r;
+	}
+
+	*submission = gpu_submission;
+	return 0;
+}
+
+drm_public int amdgpu_cs_submission_submit(amdgpu_cs_submission_handle submission,
+					   struct amdgpu_cs_request *ibs_request)
+{
+	int r;
+
+	if (!submission || !ibs_request)
+		return -EINVAL;
+	if (ibs_request->ip_type != submission->ip_type ||
+	    ibs_request->ip_instance != submission->ip_instance ||
+	    ibs_request->ring != submission->ring)
+		return -EINVAL;
+
+	pthread_mutex_lock(&submission->mutex);
+	r = amdgpu_cs_submission_submit_locked(submission, ibs_request);
+	pthread_mutex_unlock(&submission->mutex);
+
+	return r;
+}
+
+drm_public int amdgpu_cs_submission_destroy(amdgpu_cs_submission_handle submission)
+{
+	if (!submission)
+		return -EINVAL;
+
+	amdgpu_cs_submission_free(submission);
+	return 0;
+}
+
 drm_public int amdgpu_cs_submit(amdgpu_context_handle context,
 				uint64_t flags,
 				struct amdgpu_cs_request *ibs_request,
@@ -103,6 +103,7 @@ static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 	*node = (*node)->next;
 	pthread_mutex_unlock(&dev_mutex);
 
+	amdgpu_bo_cache_fini(dev);
 	close(dev->fd);
 	if ((dev->flink_fd >= 0) && (dev->fd != dev->flink_fd))
 		close(dev->flink_fd);
@@ -114,6 +115,8 @@ static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 	handle_table_fini(&dev->bo_handles);
 	handle_table_fini(&dev->bo_flink_names);
 	pthread_mutex_destroy(&dev->bo_table_mutex);
+	drmSLDestroy(dev->cpu_map_index);
+	pthread_mutex_destroy(&dev->cpu_map_mutex);
 	free(dev->marketing_name);
 	free(dev);
 }
@@ -208,7 +211,7 @@ drm_public int amdgpu_device_initialize(int fd,
 			version->version_patchlevel);
 		drmFreeVersion(version);
 		r = -EBADF;
-		goto cleanup;
+		goto free_dev;
 	}
 
 	dev->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
@@ -218,6 +221,16 @@ drm_public int amdgpu_device_initialize(int fd,
 	drmFreeVersion(version);
 
 	pthread_mutex_init(&dev->bo_table_mutex, NULL);
+	pthread_mutex_init(&dev->cpu_map_mutex, NULL);
+	handle_table_init(&dev->bo_handles);
+	handle_table_init(&dev->bo_flink_names);
+	amdgpu_bo_cache_init(dev);
+
+	dev->cpu_map_index = drmSLCreate();
+	if (!dev->cpu_map_index) {
+		r = -ENOMEM;
+		goto cleanup;
+	}
 
 	/* Check if acceleration is working. */
 	r = amdgpu_query_info(dev, AMDGPU_INFO_ACCEL_WORKING, 4, &accel_working);
@@ -272,8 +285,15 @@ drm_public int amdgpu_device_initialize(int fd,
 	return 0;
 
 cleanup:
-	if (dev->fd >= 0)
-		close(dev->fd);
+	amdgpu_bo_cache_fini(dev);
+	handle_table_fini(&dev->bo_handles);
+	handle_table_fini(&dev->bo_flink_names);
+	pthread_mutex_destroy(&dev->cpu_map_mutex);
+	pthread_mutex_destroy(&dev->bo_table_mutex);
+	close(dev->fd);
+	if (dev->cpu_map_index)
+		drmSLDestroy(dev->cpu_map_index);
+free_dev:
 	free(dev);
 	pthread_mutex_unlock(&dev_mutex);
 	return r;
@@ -43,15 +43,25 @@
 #define AMDGPU_INVALID_VA_ADDRESS	0xffffffffffffffff
 #define AMDGPU_NULL_SUBMIT_SEQ		0
 
+/*
+ * Free VA ranges are kept in an AVL tree ordered by offset. Each node also
+ * caches the largest hole size in its subtree, so the lowest (or highest)
+ * hole that can fit an allocation is found without visiting holes that
+ * are too small.
+ */
 struct amdgpu_bo_va_hole {
-	struct list_head list;
+	struct amdgpu_bo_va_hole *parent;
+	struct amdgpu_bo_va_hole *left;
+	struct amdgpu_bo_va_hole *right;
 	uint64_t offset;
 	uint64_t size;
+	uint64_t max_size;
+	int height;
 };
 
 struct amdgpu_bo_va_mgr {
 	uint64_t va_max;
-	struct list_head va_holes;
+	struct amdgpu_bo_va_hole *va_holes;
 	pthread_mutex_t bo_va_mutex;
 	uint32_t va_alignment;
 };
@@ -64,6 +74,29 @@ struct amdgpu_va {
 	struct amdgpu_bo_va_mgr *vamgr;
 };
 
+/*
+ * Freed BOs kept for reuse by amdgpu_bo_alloc, see amdgpu_bo_cache_enable.
+ * Buckets hold BOs of one rounded size, oldest first; the LRU list holds
+ * every cached BO in the order they were freed.
+ */
+#define AMDGPU_BO_CACHE_MAX_BUCKETS	64
+
+struct amdgpu_bo_cache_bucket {
+	uint64_t size;
+	struct list_head list;
+};
+
+struct amdgpu_bo_cache {
+	pthread_mutex_t mutex;
+	/** 0 if the cache is disabled. */
+	uint32_t max_age_ms;
+	uint64_t max_bytes;
+	unsigned num_buckets;
+	struct amdgpu_bo_cache_bucket buckets[AMDGPU_BO_CACHE_MAX_BUCKETS];
+	struct list_head lru;
+	struct amdgpu_bo_cache_stats stats;
+};
+
 struct amdgpu_device {
 	atomic_t refcount;
 	struct amdgpu_device *next;
@@ -73,12 +106,17 @@ struct amdgpu_device {
 	unsigned minor_version;
 
 	char *marketing_name;
-	/** List of buffer handles. Protected by bo_table_mutex. */
+	/** List of buffer handles. Updates are protected by bo_table_mutex,
+	 * lookups may also run locklessly, see handle_table.h. */
 	struct handle_table bo_handles;
-	/** List of buffer GEM flink names. Protected by bo_table_mutex. */
+	/** List of buffer GEM flink names. Same locking as bo_handles. */
 	struct handle_table bo_flink_names;
 	/** This protects all hash tables. */
 	pthread_mutex_t bo_table_mutex;
+	/** CPU mappings of BOs, a drmSL skip list keyed by cpu_ptr.
+	 * Protected by cpu_map_mutex. */
+	void *cpu_map_index;
+	pthread_mutex_t cpu_map_mutex;
 	struct drm_amdgpu_info_device dev_info;
 	struct amdgpu_gpu_info info;
 	/** The VA manager for the lower virtual address space */
@@ -89,6 +127,8 @@ struct amdgpu_device {
 	struct amdgpu_bo_va_mgr vamgr_high;
 	/** The VA manager for the 32bit high address space */
 	struct amdgpu_bo_va_mgr vamgr_high_32;
+	/** Freed BOs kept for reuse. Nests inside bo_table_mutex. */
+	struct amdgpu_bo_cache bo_cache;
 };
 
 struct amdgpu_bo {
@@ -103,6 +143,17 @@ struct amdgpu_bo {
 	pthread_mutex_t cpu_access_mutex;
 	void *cpu_ptr;
 	int64_t cpu_map_count;
+
+	/** Allocation parameters, used to match cached BOs. */
+	uint32_t heap;
+	uint64_t flags;
+	uint64_t phys_alignment;
+	/** Cleared once the BO is shared or has metadata attached. */
+	bool reusable;
+	/** Links and free time while in the BO cache. */
+	struct list_head cache_bucket;
+	struct list_head cache_lru;
+	uint64_t free_time_ms;
 };
 
 struct amdgpu_bo_list {
@@ -120,6 +171,28 @@ struct amdgpu_context {
 	uint32_t id;
 	uint64_t last_seq[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
 	struct list_head sem_list[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+	/** Prepared submissions used by amdgpu_cs_submit, created on first
+	    use. The pointers are protected by sequence_mutex. */
+	struct amdgpu_cs_submission *submissions[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+};
+
+/**
+ * Chunk and dependency buffers reused by every submission to one ring.
+ * The mutex serializes submissions using the buffers, the kernel call
+ * itself is made without holding the context's sequence_mutex.
+ */
+struct amdgpu_cs_submission {
+	amdgpu_context_handle context;
+	uint32_t ip_type;
+	uint32_t ip_instance;
+	uint32_t ring;
+	pthread_mutex_t mutex;
+
+	uint32_t max_ibs;
+	struct drm_amdgpu_cs_chunk *chunks;
+	struct drm_amdgpu_cs_chunk_data *chunk_data;
+	uint32_t max_deps;
+	struct drm_amdgpu_cs_chunk_dep *deps;
 };
 
 /**
@@ -141,8 +214,19 @@ drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 
 drm_private void amdgpu_vamgr_deinit(struct amdgpu_bo_va_mgr *mgr);
 
+drm_private void amdgpu_bo_cache_init(struct amdgpu_device *dev);
+
+drm_private void amdgpu_bo_cache_fini(struct amdgpu_device *dev);
+
 drm_private void amdgpu_parse_asic_ids(struct amdgpu_device *dev);
 
+drm_private int amdgpu_find_asic_id_bin(struct amdgpu_device *dev,
+					const char *text_path,
+					const char *bin_path);
+
+drm_private void amdgpu_parse_asic_ids_text(struct amdgpu_device *dev,
+					    const char *path);
+
 drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev);
 
 drm_private uint64_t amdgpu_cs_calculate_timeout(uint64_t timeout);
@@ -41,6 +41,171 @@ drm_public int amdgpu_va_range_query(amdgpu_device_handle dev,
 	return 0;
 }
 
+static inline int amdgpu_vamgr_height(struct amdgpu_bo_va_hole *hole)
+{
+	return hole ? hole->height : 0;
+}
+
+static inline uint64_t amdgpu_vamgr_max_size(struct amdgpu_bo_va_hole *hole)
+{
+	return hole ? hole->max_size : 0;
+}
+
+static void amdgpu_vamgr_update(struct amdgpu_bo_va_hole *hole)
+{
+	hole->height = 1 + MAX2(amdgpu_vamgr_height(hole->left),
+				amdgpu_vamgr_height(hole->right));
+	hole->max_size = MAX3(hole->size,
+			      amdgpu_vamgr_max_size(hole->left),
+			      amdgpu_vamgr_max_size(hole->right));
+}
+
+static void amdgpu_vamgr_replace_child(struct amdgpu_bo_va_mgr *mgr,
+				       struct amdgpu_bo_va_hole *parent,
+				       struct amdgpu_bo_va_hole *old,
+				       struct amdgpu_bo_va_hole *new)
+{
+	if (!parent)
+		mgr->va_holes = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+
+	if (new)
+		new->parent = parent;
+}
+
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_rotate_left(struct amdgpu_bo_va_mgr *mgr,
+			 struct amdgpu_bo_va_hole *hole)
+{
+	struct amdgpu_bo_va_hole *pivot = hole->right;
+
+	hole->right = pivot->left;
+	if (pivot->left)
+		pivot->left->parent = hole;
+	amdgpu_vamgr_replace_child(mgr, hole->parent, hole, pivot);
+	pivot->left = hole;
+	hole->parent = pivot;
+
+	amdgpu_vamgr_update(hole);
+	amdgpu_vamgr_update(pivot);
+	return pivot;
+}
+
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_rotate_right(struct amdgpu_bo_va_mgr *mgr,
+			  struct amdgpu_bo_va_hole *hole)
+{
+	struct amdgpu_bo_va_hole *pivot = hole->left;
+
+	hole->left = pivot->right;
+	if (pivot->right)
+		pivot->right->parent = hole;
+	amdgpu_vamgr_replace_child(mgr, hole->parent, hole, pivot);
+	pivot->right = hole;
+	hole->parent = pivot;
+
+	amdgpu_vamgr_update(hole);
+	amdgpu_vamgr_update(pivot);
+	return pivot;
+}
+
+/*
+ * Walk from @hole up to the root, refreshing the cached height and max_size
+ * and restoring the AVL balance on the way. Must be called after a hole is
+ * linked, unlinked or resized.
+ */
+static void amdgpu_vamgr_rebalance(struct amdgpu_bo_va_mgr *mgr,
+				   struct amdgpu_bo_va_hole *hole)
+{
+	while (hole) {
+		int balance;
+
+		amdgpu_vamgr_update(hole);
+		balance = amdgpu_vamgr_height(hole->left) -
+			  amdgpu_vamgr_height(hole->right);
+
+		if (balance > 1) {
+			if (amdgpu_vamgr_height(hole->left->left) <
+			    amdgpu_vamgr_height(hole->left->right))
+				amdgpu_vamgr_rotate_left(mgr, hole->left);
+			hole = amdgpu_vamgr_rotate_right(mgr, hole);
+		} else if (balance < -1) {
+			if (amdgpu_vamgr_height(hole->right->right) <
+			    amdgpu_vamgr_height(hole->right->left))
+				amdgpu_vamgr_rotate_right(mgr, hole->right);
+			hole = amdgpu_vamgr_rotate_left(mgr, hole);
+		}
+
+		hole = hole->parent;
+	}
+}
+
+static void amdgpu_vamgr_insert_hole(struct amdgpu_bo_va_mgr *mgr,
+				     struct amdgpu_bo_va_hole *hole)
+{
+	struct amdgpu_bo_va_hole **link = &mgr->va_holes;
+	struct amdgpu_bo_va_hole *parent = NULL;
+
+	while (*link) {
+		parent = *link;
+		if (hole->offset < parent->offset)
+			link = &parent->left;
+		else
+			link = &parent->right;
+	}
+
+	hole->parent = parent;
+	hole->left = NULL;
+	hole->right = NULL;
+	*link = hole;
+	amdgpu_vamgr_rebalance(mgr, hole);
+}
+
+static void amdgpu_vamgr_remove_hole(struct amdgpu_bo_va_mgr *mgr,
+				     struct amdgpu_bo_va_hole *hole)
+{
+	struct amdgpu_bo_va_hole *start;
+
+	if (hole->left && hole->right) {
+		/* Move the successor, which has no left child, into place. */
+		struct amdgpu_bo_va_hole *next = hole->right;
+
+		while (next->left)
+			next = next->left;
+
+		start = next->parent == hole ? next : next->parent;
+		amdgpu_vamgr_replace_child(mgr, next->parent, next, next->right);
+
+		next->left = hole->left;
+		next->right = hole->right;
+		next->left->parent = next;
+		if (next->right)
+			next->right->parent = next;
+		amdgpu_vamgr_replace_child(mgr, hole->parent, hole, next);
+	} else {
+		start = hole->parent;
+		amdgpu_vamgr_replace_child(mgr, hole->parent, hole,
+					   hole->left ? hole->left : hole->right);
+	}
+
+	amdgpu_vamgr_rebalance(mgr, start);
+}
+
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_alloc_hole(uint64_t offset, uint64_t size)
+{
+	struct amdgpu_bo_va_hole *n = calloc(1, sizeof(struct amdgpu_bo_va_hole));
+
+	if (n) {
+		n->offset = offset;
+		n->size = size;
+	}
+	return n;
+}
+
 drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 				   uint64_t max, uint64_t alignment)
 {
@@ -48,61 +213,142 @@ drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 
 	mgr->va_max = max;
 	mgr->va_alignment = alignment;
+	mgr->va_holes = NULL;
 
-	list_inithead(&mgr->va_holes);
 	pthread_mutex_init(&mgr->bo_va_mutex, NULL);
 	pthread_mutex_lock(&mgr->bo_va_mutex);
-	n = calloc(1, sizeof(struct amdgpu_bo_va_hole));
-	n->size = mgr->va_max - start;
-	n->offset = start;
-	list_add(&n->list, &mgr->va_holes);
+	n = amdgpu_vamgr_alloc_hole(start, mgr->va_max - start);
+	if (n)
+		amdgpu_vamgr_insert_hole(mgr, n);
 	pthread_mutex_unlock(&mgr->bo_va_mutex);
 }
 
+static void amdgpu_vamgr_free_holes(struct amdgpu_bo_va_hole *hole)
+{
+	if (!hole)
+		return;
+
+	amdgpu_vamgr_free_holes(hole->left);
+	amdgpu_vamgr_free_holes(hole->right);
+	free(hole);
+}
+
 drm_private void amdgpu_vamgr_deinit(struct amdgpu_bo_va_mgr *mgr)
 {
-	struct amdgpu_bo_va_hole *hole, *tmp;
-	LIST_FOR_EACH_ENTRY_SAFE(hole, tmp, &mgr->va_holes, list) {
-		list_del(&hole->list);
-		free(hole);
-	}
+	amdgpu_vamgr_free_holes(mgr->va_holes);
+	mgr->va_holes = NULL;
 	pthread_mutex_destroy(&mgr->bo_va_mutex);
 }
 
 static drm_private int
-amdgpu_vamgr_subtract_hole(struct amdgpu_bo_va_hole *hole, uint64_t start_va,
+amdgpu_vamgr_subtract_hole(struct amdgpu_bo_va_mgr *mgr,
+			   struct amdgpu_bo_va_hole *hole, uint64_t start_va,
 			   uint64_t end_va)
 {
 	if (start_va > hole->offset && end_va - hole->offset < hole->size) {
-		struct amdgpu_bo_va_hole *n = calloc(1, sizeof(struct amdgpu_bo_va_hole));
+		struct amdgpu_bo_va_hole *n;
+
+		n = amdgpu_vamgr_alloc_hole(hole->offset,
+					    start_va - hole->offset);
 		if (!n)
 			return -ENOMEM;
 
-		n->size = start_va - hole->offset;
-		n->offset = hole->offset;
-		list_add(&n->list, &hole->list);
-
 		hole->size -= (end_va - hole->offset);
 		hole->offset = end_va;
+		amdgpu_vamgr_rebalance(mgr, hole);
+		amdgpu_vamgr_insert_hole(mgr, n);
 	} else if (start_va > hole->offset) {
 		hole->size = start_va - hole->offset;
+		amdgpu_vamgr_rebalance(mgr, hole);
 	} else if (end_va - hole->offset < hole->size) {
 		hole->size -= (end_va - hole->offset);
 		hole->offset = end_va;
+		amdgpu_vamgr_rebalance(mgr, hole);
 	} else {
-		list_del(&hole->list);
+		amdgpu_vamgr_remove_hole(mgr, hole);
 		free(hole);
 	}
 
 	return 0;
 }
 
+/* Lowest hole with room for @size bytes at @alignment. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_find_lowest(struct amdgpu_bo_va_hole *hole, uint64_t size,
+			 uint64_t alignment, uint64_t *offset)
+{
+	struct amdgpu_bo_va_hole *found;
+	uint64_t waste;
+
+	if (!hole || hole->max_size < size)
+		return NULL;
+
+	found = amdgpu_vamgr_find_lowest(hole->left, size, alignment, offset);
+	if (found)
+		return found;
+
+	waste = hole->offset % alignment;
+	waste = waste ? alignment - waste : 0;
+	*offset = hole->offset + waste;
+	if (*offset < (hole->offset + hole->size) &&
+	    size <= (hole->offset + hole->size) - *offset)
+		return hole;
+
+	return amdgpu_vamgr_find_lowest(hole->right, size, alignment, offset);
+}
+
+/* Highest hole with room for @size bytes at @alignment, placed at its top. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_find_highest(struct amdgpu_bo_va_hole *hole, uint64_t size,
+			  uint64_t alignment, uint64_t *offset)
+{
+	struct amdgpu_bo_va_hole *found;
+
+	if (!hole || hole->max_size < size)
+		return NULL;
+
+	found = amdgpu_vamgr_find_highest(hole->right, size, alignment, offset);
+	if (found)
+		return found;
+
+	if (size <= hole->size) {
+		*offset = hole->offset + hole->size - size;
+		*offset -= *offset % alignment;
+		if (*offset >= hole->offset)
+			return hole;
+	}
+
+	return amdgpu_vamgr_find_highest(hole->left, size, alignment, offset);
+}
+
+/* The hole covering [@va, @va + @size), if any. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_find_containing(struct amdgpu_bo_va_mgr *mgr, uint64_t va,
+			     uint64_t size)
+{
+	struct amdgpu_bo_va_hole *hole = mgr->va_holes;
+	struct amdgpu_bo_va_hole *below = NULL;
+
+	while (hole) {
+		if (hole->offset <= va) {
+			below = hole;
+			hole = hole->right;
+		} else {
+			hole = hole->left;
+		}
+	}
+
+	if (below && (below->offset + below->size) >= (va + size))
+		return below;
+	return NULL;
+}
+
 static drm_private int
 amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 		     uint64_t alignment, uint64_t base_required,
 		     bool search_from_top, uint64_t *va_out)
 {
-	struct amdgpu_bo_va_hole *hole, *n;
+	struct amdgpu_bo_va_hole *hole;
 	uint64_t offset = 0;
 	int ret;
 
@@ -114,60 +360,32 @@ amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 		return -EINVAL;
 
 	pthread_mutex_lock(&mgr->bo_va_mutex);
-	if (!search_from_top) {
-		LIST_FOR_EACH_ENTRY_SAFE_REV(hole, n, &mgr->va_holes, list) {
-			if (base_required) {
-				if (hole->offset > base_required ||
-				   (hole->offset + hole->size) < (base_required + size))
-					continue;
-				offset = base_required;
-			} else {
-				uint64_t waste = hole->offset % alignment;
-				waste = waste ? alignment - waste : 0;
-				offset = hole->offset + waste;
-				if (offset >= (hole->offset + hole->size) ||
-				    size > (hole->offset + hole->size) - offset) {
-					continue;
-				}
-			}
-			ret = amdgpu_vamgr_subtract_hole(hole, offset, offset + size);
-			pthread_mutex_unlock(&mgr->bo_va_mutex);
-			*va_out = offset;
-			return ret;
-		}
+	if (base_required) {
+		hole = amdgpu_vamgr_find_containing(mgr, base_required, size);
+		offset = base_required;
+	} else if (!search_from_top) {
+		hole = amdgpu_vamgr_find_lowest(mgr->va_holes, size,
+						alignment, &offset);
 	} else {
-		LIST_FOR_EACH_ENTRY_SAFE(hole, n, &mgr->va_holes, list) {
-			if (base_required) {
-				if (hole->offset > base_required ||
-				   (hole->offset + hole->size) < (base_required + size))
-					continue;
-				offset = base_required;
-			} else {
-				if (size > hole->size)
-					continue;
-
-				offset = hole->offset + hole->size - size;
-				offset -= offset % alignment;
-				if (offset < hole->offset) {
-					continue;
-				}
-			}
-
-			ret = amdgpu_vamgr_subtract_hole(hole, offset, offset + size);
-			pthread_mutex_unlock(&mgr->bo_va_mutex);
-			*va_out = offset;
-			return ret;
-		}
+		hole = amdgpu_vamgr_find_highest(mgr->va_holes, size,
+						 alignment, &offset);
+	}
+
+	if (!hole) {
+		pthread_mutex_unlock(&mgr->bo_va_mutex);
+		return -ENOMEM;
 	}
 
+	ret = amdgpu_vamgr_subtract_hole(mgr, hole, offset, offset + size);
 	pthread_mutex_unlock(&mgr->bo_va_mutex);
-	return -ENOMEM;
+	*va_out = offset;
+	return ret;
 }
 
 static drm_private void
 amdgpu_vamgr_free_va(struct amdgpu_bo_va_mgr *mgr, uint64_t va, uint64_t size)
 {
-	struct amdgpu_bo_va_hole *hole, *next;
+	struct amdgpu_bo_va_hole *hole, *upper = NULL, *lower = NULL;
 
 	if (va == AMDGPU_INVALID_VA_ADDRESS)
 		return;
@@ -175,46 +393,47 @@ amdgpu_vamgr_free_va(struct amdgpu_bo_va_mgr *mgr, uint64_t va, uint64_t size)
 	size = ALIGN(size, mgr->va_alignment);
 
 	pthread_mutex_lock(&mgr->bo_va_mutex);
-	hole = container_of(&mgr->va_holes, hole, list);
-	LIST_FOR_EACH_ENTRY(next, &mgr->va_holes, list) {
-		if (next->offset < va)
-			break;
-		hole = next;
+	/* Find the closest holes above and below the freed range. */
+	hole = mgr->va_holes;
+	while (hole) {
+		if (hole->offset < va) {
+			lower = hole;
+			hole = hole->right;
+		} else {
+			upper = hole;
+			hole = hole->left;
+		}
 	}
 
-	if (&hole->list != &mgr->va_holes) {
-		/* Grow upper hole if it's adjacent */
-		if (hole->offset == (va + size)) {
-			hole->offset = va;
-			hole->size += size;
-			/* Merge lower hole if it's adjacent */
-			if (next != hole &&
-			    &next->list != &mgr->va_holes &&
-			    (next->offset + next->size) == va) {
-				next->size += hole->size;
-				list_del(&hole->list);
-				free(hole);
-			}
-			goto out;
+	/* Grow upper hole if it's adjacent */
+	if (upper && upper->offset == (va + size)) {
+		upper->offset = va;
+		upper->size += size;
+		/* Merge lower hole if it's adjacent */
+		if (lower && (lower->offset + lower->size) == va) {
+			lower->size += upper->size;
+			amdgpu_vamgr_remove_hole(mgr, upper);
+			free(upper);
+			amdgpu_vamgr_rebalance(mgr, lower);
+		} else {
+			amdgpu_vamgr_rebalance(mgr, upper);
 		}
+		goto out;
 	}
 
 	/* Grow lower hole if it's adjacent */
-	if (next != hole && &next->list != &mgr->va_holes &&
-	    (next->offset + next->size) == va) {
-		next->size += size;
+	if (lower && (lower->offset + lower->size) == va) {
+		lower->size += size;
+		amdgpu_vamgr_rebalance(mgr, lower);
 		goto out;
 	}
 
 	/* FIXME on allocation failure we just lose virtual address space
 	 * maybe print a warning
 	 */
-	next = calloc(1, sizeof(struct amdgpu_bo_va_hole));
-	if (next) {
-		next->size = size;
-		next->offset = va;
-		list_add(&next->list, &hole->list);
-	}
+	hole = amdgpu_vamgr_alloc_hole(va, size);
+	if (hole)
+		amdgpu_vamgr_insert_hole(mgr, hole);
 
 out:
 	pthread_mutex_unlock(&mgr->bo_va_mutex);
@@ -28,45 +28,140 @@
 #include "handle_table.h"
 #include "util_math.h"
 
+static inline struct handle_table_array *
+handle_table_get_array(struct handle_table *table)
+{
+	return *(struct handle_table_array * volatile *)&table->array;
+}
+
+drm_private void handle_table_init(struct handle_table *table)
+{
+	memset(table, 0, sizeof(*table));
+	pthread_mutex_init(&table->mutex, NULL);
+	pthread_cond_init(&table->drained, NULL);
+}
+
 drm_private int handle_table_insert(struct handle_table *table, uint32_t key,
 				    void *value)
 {
-	if (key >= table->max_key) {
+	struct handle_table_array *array = table->array;
+
+	if (!array || key >= array->max_key) {
 		uint32_t alignment = sysconf(_SC_PAGESIZE) / sizeof(void*);
+		uint32_t old_max_key = array ? array->max_key : 0;
 		uint32_t max_key = ALIGN(key + 1, alignment);
-		void **values;
+		struct handle_table_array *new;
 
-		values = realloc(table->values, max_key * sizeof(void *));
-		if (!values)
+		/* Grow geometrically, the old array is copied on each resize. */
+		max_key = MAX2(max_key, old_max_key * 2);
+		new = malloc(sizeof(*new) + max_key * sizeof(void *));
+		if (!new)
 			return -ENOMEM;
 
-		memset(values + table->max_key, 0, (max_key - table->max_key) *
-		       sizeof(void *));
+		new->max_key = max_key;
+		if (old_max_key)
+			memcpy(new->values, array->values,
+			       old_max_key * sizeof(void *));
+		memset(new->values + old_max_key, 0,
+		       (max_key - old_max_key) * sizeof(void *));
 
-		table->max_key = max_key;
-		table->values = values;
+		/* Publish the fully initialized array, then wait for readers
+		 * of the old one before freeing it. */
+		atomic_mb();
+		table->array = new;
+		if (array) {
+			handle_table_synchronize(table);
+			free(array);
+		}
+		array = new;
 	}
-	table->values[key] = value;
+
+	/* Make the value's contents visible before the value itself. */
+	atomic_mb();
+	*(void * volatile *)&array->values[key] = value;
 	return 0;
 }
 
 drm_private void handle_table_remove(struct handle_table *table, uint32_t key)
 {
-	if (key < table->max_key)
-		table->values[key] = NULL;
+	struct handle_table_array *array = table->array;
+
+	if (array && key < array->max_key)
+		*(void * volatile *)&array->values[key] = NULL;
 }
 
 drm_private void *handle_table_lookup(struct handle_table *table, uint32_t key)
 {
-	if (key < table->max_key)
-		return table->values[key];
+	struct handle_table_array *array = handle_table_get_array(table);
+
+	if (array && key < array->max_key)
+		return *(void * volatile *)&array->values[key];
 	else
 		return NULL;
 }
 
+drm_private uint32_t handle_table_max_key(struct handle_table *table)
+{
+	struct handle_table_array *array = handle_table_get_array(table);
+
+	return array ? array->max_key : 0;
+}
+
+/*
+ * Readers register in one of two counters selected by the current epoch.
+ * handle_table_synchronize flips the epoch and waits for the counter of
+ * the previous one to drain; readers arriving after the flip use the
+ * other counter and already see the writer's changes. Doing it twice
+ * covers a reader that sampled the epoch right before a flip.
+ *
+ * The writer sleeps rather than spins while it waits, so that it doesn't
+ * keep readers, preempted inside their lookup, from running and draining
+ * the counter. The reader that drains it wakes the writer up.
+ */
+drm_private int handle_table_read_lock(struct handle_table *table)
+{
+	int idx = atomic_read(&table->epoch) & 1;
+
+	atomic_inc(&table->readers[idx]);
+	return idx;
+}
+
+drm_private void handle_table_read_unlock(struct handle_table *table, int idx)
+{
+	/* Either this sees the writer's waiters increment, or the writer
+	 * sees the counter drained; both are ordered by full barriers. */
+	if (atomic_dec_and_test(&table->readers[idx]) &&
+	    atomic_read(&table->waiters)) {
+		pthread_mutex_lock(&table->mutex);
+		pthread_cond_broadcast(&table->drained);
+		pthread_mutex_unlock(&table->mutex);
+	}
+}
+
+drm_private void handle_table_synchronize(struct handle_table *table)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		int idx = atomic_read(&table->epoch) & 1;
+
+		atomic_inc(&table->epoch);
+		if (!atomic_read(&table->readers[idx]))
+			continue;
+
+		pthread_mutex_lock(&table->mutex);
+		atomic_inc(&table->waiters);
+		while (atomic_read(&table->readers[idx]))
+			pthread_cond_wait(&table->drained, &table->mutex);
+		atomic_dec(&table->waiters, 1);
+		pthread_mutex_unlock(&table->mutex);
+	}
+}
+
 drm_private void handle_table_fini(struct handle_table *table)
 {
-	free(table->values);
-	table->max_key = 0;
-	table->values = NULL;
+	free(table->array);
+	table->array = NULL;
+	pthread_cond_destroy(&table->drained);
+	pthread_mutex_destroy(&table->mutex);
 }
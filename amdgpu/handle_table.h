@@ -24,18 +24,45 @@
 #ifndef _HANDLE_TABLE_H_
 #define _HANDLE_TABLE_H_
 
+#include <pthread.h>
 #include <stdint.h>
 #include "libdrm_macros.h"
+#include "xf86atomic.h"
 
-struct handle_table {
+struct handle_table_array {
 	uint32_t	max_key;
-	void		**values;
+	void		*values[];
 };
 
+/*
+ * Key -> pointer table. Insertions and removals must be serialized by the
+ * caller, but lookups may run concurrently with them when wrapped in
+ * handle_table_read_lock/unlock. A removed value, or an array replaced on
+ * growth, may still be seen by such readers until handle_table_synchronize
+ * returns, so it must not be freed before that. Tables are set up by
+ * handle_table_init.
+ */
+struct handle_table {
+	struct handle_table_array	*array;
+	atomic_t			epoch;
+	atomic_t			readers[2];
+	/* Writers sleeping in handle_table_synchronize, woken by the last
+	 * reader of the epoch they wait for. */
+	atomic_t			waiters;
+	pthread_mutex_t			mutex;
+	pthread_cond_t			drained;
+};
+
+drm_private void handle_table_init(struct handle_table *table);
+
 drm_private int handle_table_insert(struct handle_table *table, uint32_t key,
 				    void *value);
 drm_private void handle_table_remove(struct handle_table *table, uint32_t key);
 drm_private void *handle_table_lookup(struct handle_table *table, uint32_t key);
+drm_private uint32_t handle_table_max_key(struct handle_table *table);
+drm_private int handle_table_read_lock(struct handle_table *table);
+drm_private void handle_table_read_unlock(struct handle_table *table, int idx);
+drm_private void handle_table_synchronize(struct handle_table *table);
 drm_private void handle_table_fini(struct handle_table *table);
 
 #endif /* _HANDLE_TABLE_H_ */
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+
+# Copyright © 2026 The libdrm contributors
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+# OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+# ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+# Helper script that reads amdgpu.ids and writes the sorted binary table
+# looked up by amdgpu_parse_asic_ids(). See amdgpu/amdgpu_asic_id.c for
+# the layout; the lines are split the same way as the text parser does, so
+# both give the same name for a device.
+
+import struct
+import sys
+
+MAGIC = b'AMDGPUID'
+FORMAT = 1
+HEADER = struct.Struct('<8sIIQIII4x')
+ENTRY = struct.Struct('<II')
+
+filename = sys.argv[1]
+towrite = sys.argv[2]
+
+version = None
+entries = {}
+
+with open(filename, 'rb') as f:
+    data = f.read()
+
+for num, line in enumerate(data.split(b'\n'), 1):
+    if not line or line.startswith(b'#'):
+        continue
+
+    # 1st valid line is file version
+    if version is None:
+        version = line
+        continue
+
+    # strtok() skips empty fields
+    fields = [field for field in line.split(b',') if field]
+    try:
+        did = int(fields[0], 16)
+        rid = int(fields[1], 16)
+        name = fields[2].lstrip(b' \t')
+    except (IndexError, ValueError):
+        sys.exit('{}:{}: invalid format'.format(filename, num))
+
+    if did > 0xffff or rid > 0xff or not name:
+        sys.exit('{}:{}: invalid format'.format(filename, num))
+
+    # The text parser stops at the first match
+    entries.setdefault(did << 8 | rid, name)
+
+strings = bytearray()
+offsets = {}
+
+def add_string(s):
+    if s not in offsets:
+        offsets[s] = len(strings)
+        strings.extend(s + b'\0')
+    return offsets[s]
+
+version_offset = add_string(version or b'')
+table = bytearray()
+for key in sorted(entries):
+    table += ENTRY.pack(key, add_string(entries[key]))
+
+strings_offset = HEADER.size + len(table)
+
+with open(towrite, 'wb') as f:
+    f.write(HEADER.pack(MAGIC, FORMAT, len(entries), len(data),
+                        version_offset, strings_offset, len(strings)))
+    f.write(table)
+    f.write(strings)
@@ -0,0 +1,505 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Multi-threaded benchmark for the GEM buffer manager. Every thread keeps
+ * allocating, mapping, writing, unmapping and releasing buffers through one
+ * shared bufmgr, and every few buffers submits a batch with relocations to
+ * them, like several GL contexts of one process do. The i915 ioctls are
+ * answered by the drmIoctl below, so no device is needed and the numbers
+ * show the cost of the bufmgr itself, along with the number of ioctls it
+ * needs per buffer. The fake GPU completes batches in order, each one a few
+ * batches after it was submitted. The fake execbuffer rejects lists with
+ * duplicate buffers, a buffer handed out by drm_intel_bo_alloc must not be
+ * busy, and all handles must be closed once the bufmgr is gone.
+ *
+ * A second, single-threaded part maps a few large textures and many small
+ * buffers in turn, to compare the VMA cache limited in mappings with the
+ * one limited in bytes.
+ *
+ * The last part builds large batches whose thousands of relocations point
+ * to a few state buffers, each with relocations to the same textures, and
+ * asks whether a batch references a texture before every submission, like
+ * a driver does before mapping it. It runs once with relocations and once
+ * with every buffer softpinned, where the fake execbuffer checks that it
+ * gets no relocations and only pinned buffers.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+#include "i915_drm.h"
+#include "intel_bufmgr.h"
+
+#define MAX_THREADS	8
+#define BATCH_BOS	8
+#define RUN_NS		300000000ull
+#define GPU_LAG		4
+#define HANDLE_SLOTS	65536
+
+#define VMA_LARGE	4
+#define VMA_LARGE_SIZE	(8 << 20)
+#define VMA_SMALL	512
+#define VMA_SMALL_SIZE	(16 << 10)
+#define VMA_ROUNDS	20
+
+#define RELOC_BATCH_SIZE	(64 << 10)
+#define RELOC_COUNT		4096
+#define RELOC_STATE		64
+#define RELOC_TEXTURES		16
+#define RELOC_ROUNDS		200
+
+static uint32_t next_handle;
+static unsigned long live_handles;
+static unsigned long bad_execs;
+static unsigned long ioctls;
+static unsigned long busy_ioctls;
+static unsigned long madvise_ioctls;
+static uint32_t exec_objects;
+static unsigned long exec_unpinned;
+
+/* Number of batches submitted, and the last one using each handle. */
+static pthread_mutex_t submit_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long submitted;
+static unsigned long last_exec[HANDLE_SLOTS];
+
+static bool gpu_busy(uint32_t handle)
+{
+	unsigned long last = __atomic_load_n(&last_exec[handle % HANDLE_SLOTS],
+					     __ATOMIC_RELAXED);
+
+	return last &&
+	       last + GPU_LAG > __atomic_load_n(&submitted, __ATOMIC_RELAXED);
+}
+
+/* Stand-in for the kernel, see above. */
+drm_public int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	__sync_add_and_fetch(&ioctls, 1);
+
+	switch (request) {
+	case DRM_IOCTL_I915_GETPARAM: {
+		struct drm_i915_getparam *gp = arg;
+
+		*gp->value = gp->param == I915_PARAM_CHIPSET_ID ? 0x1912 : 1;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_GET_APERTURE: {
+		struct drm_i915_gem_get_aperture *aperture = arg;
+
+		aperture->aper_size = 4ull << 30;
+		aperture->aper_available_size = 4ull << 30;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_CREATE: {
+		struct drm_i915_gem_create *create = arg;
+
+		create->handle = __sync_add_and_fetch(&next_handle, 1);
+		__atomic_store_n(&last_exec[create->handle % HANDLE_SLOTS], 0,
+				 __ATOMIC_RELAXED);
+		__sync_add_and_fetch(&live_handles, 1);
+		return 0;
+	}
+	case DRM_IOCTL_GEM_CLOSE:
+		__sync_sub_and_fetch(&live_handles, 1);
+		return 0;
+	case DRM_IOCTL_I915_GEM_BUSY: {
+		struct drm_i915_gem_busy *busy = arg;
+
+		__sync_add_and_fetch(&busy_ioctls, 1);
+		busy->busy = gpu_busy(busy->handle);
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_MADVISE: {
+		struct drm_i915_gem_madvise *madv = arg;
+
+		__sync_add_and_fetch(&madvise_ioctls, 1);
+		madv->retained = 1;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_GET_TILING: {
+		struct drm_i915_gem_get_tiling *tiling = arg;
+
+		tiling->tiling_mode = I915_TILING_NONE;
+		tiling->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_SET_TILING: {
+		struct drm_i915_gem_set_tiling *tiling = arg;
+
+		tiling->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_MMAP: {
+		struct drm_i915_gem_mmap *mmap_arg = arg;
+		void *ptr;
+
+		ptr = mmap(NULL, mmap_arg->size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return -1;
+		mmap_arg->addr_ptr = (uintptr_t)ptr;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_EXECBUFFER2:
+	case DRM_IOCTL_I915_GEM_EXECBUFFER2_WR: {
+		struct drm_i915_gem_execbuffer2 *execbuf = arg;
+		struct drm_i915_gem_exec_object2 *objects =
+			(void *)(uintptr_t)execbuf->buffers_ptr;
+		unsigned long serial;
+		uint32_t i, j;
+
+		for (i = 0; i < execbuf->buffer_count; i++)
+			for (j = i + 1; j < execbuf->buffer_count; j++)
+				if (objects[i].handle == objects[j].handle)
+					__sync_add_and_fetch(&bad_execs, 1);
+
+		/* Batches are queued in order under the kernel's lock. */
+		for (i = 0; i < execbuf->buffer_count; i++)
+			if (objects[i].relocation_count ||
+			    !(objects[i].flags & EXEC_OBJECT_PINNED))
+				__sync_add_and_fetch(&exec_unpinned, 1);
+
+		pthread_mutex_lock(&submit_lock);
+		exec_objects = execbuf->buffer_count;
+		serial = __atomic_add_fetch(&submitted, 1, __ATOMIC_RELAXED);
+		for (i = 0; i < execbuf->buffer_count; i++)
+			__atomic_store_n(&last_exec[objects[i].handle %
+						    HANDLE_SLOTS],
+					 serial, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&submit_lock);
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_SET_DOMAIN:
+	case DRM_IOCTL_I915_GEM_SW_FINISH:
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+struct bench {
+	drm_intel_bufmgr *bufmgr;
+	volatile bool stop;
+	unsigned long ops[MAX_THREADS];
+	unsigned long errors[MAX_THREADS];
+	unsigned long busy_reused[MAX_THREADS];
+};
+
+struct thread_args {
+	struct bench *bench;
+	unsigned index;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t next_rand(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static void *worker(void *data)
+{
+	struct thread_args *args = data;
+	struct bench *b = args->bench;
+	uint32_t state = 0x9e3779b9u + args->index * 7919;
+	drm_intel_bo *bos[BATCH_BOS];
+	unsigned long ops = 0, errors = 0, busy_reused = 0;
+	int count = 0, i;
+
+	while (!b->stop) {
+		unsigned long size = 4096 * (1 + next_rand(&state) % 16);
+		drm_intel_bo *bo;
+
+		bo = drm_intel_bo_alloc(b->bufmgr, "bench", size, 4096);
+		if (!bo || drm_intel_bo_map(bo, 1)) {
+			errors++;
+			break;
+		}
+		if (gpu_busy(bo->handle))
+			busy_reused++;
+		memset(bo->virtual, 0xcc, 64);
+		drm_intel_bo_unmap(bo);
+		bos[count++] = bo;
+		ops++;
+
+		if (count < BATCH_BOS)
+			continue;
+
+		/* Submit a batch referencing every buffer, one of them twice. */
+		bo = drm_intel_bo_alloc(b->bufmgr, "batch", 4096, 4096);
+		if (!bo) {
+			errors++;
+			break;
+		}
+		for (i = 0; i <= count; i++) {
+			drm_intel_bo *target = bos[i % count];
+
+			if (drm_intel_bo_emit_reloc(bo, i * 8, target, 0,
+						    I915_GEM_DOMAIN_RENDER,
+						    I915_GEM_DOMAIN_RENDER))
+				errors++;
+		}
+		if (drm_intel_bo_exec(bo, 64, NULL, 0, 0))
+			errors++;
+		drm_intel_bo_unreference(bo);
+
+		for (i = 0; i < count; i++)
+			drm_intel_bo_unreference(bos[i]);
+		count = 0;
+	}
+
+	for (i = 0; i < count; i++)
+		drm_intel_bo_unreference(bos[i]);
+
+	b->ops[args->index] = ops;
+	b->errors[args->index] = errors;
+	b->busy_reused[args->index] = busy_reused;
+	return NULL;
+}
+
+static int run(unsigned num_threads)
+{
+	struct thread_args args[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	struct bench b;
+	unsigned long ops = 0, errors = 0, busy_reused = 0;
+	uint64_t start, elapsed;
+	unsigned i;
+
+	memset(&b, 0, sizeof(b));
+	ioctls = busy_ioctls = madvise_ioctls = 0;
+	b.bufmgr = drm_intel_bufmgr_gem_init(-1, 4096);
+	if (!b.bufmgr) {
+		fprintf(stderr, "drm_intel_bufmgr_gem_init failed\n");
+		return 1;
+	}
+	drm_intel_bufmgr_gem_enable_reuse(b.bufmgr);
+
+	start = now_ns();
+	for (i = 0; i < num_threads; i++) {
+		args[i].bench = &b;
+		args[i].index = i;
+		pthread_create(&threads[i], NULL, worker, &args[i]);
+	}
+
+	while (now_ns() - start < RUN_NS) {
+		struct timespec ts = { 0, 10000000 };
+
+		nanosleep(&ts, NULL);
+	}
+	b.stop = true;
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+		ops += b.ops[i];
+		errors += b.errors[i];
+		busy_reused += b.busy_reused[i];
+	}
+	elapsed = now_ns() - start;
+
+	printf("%u threads: %7.3f Mbuffers/s, %5.2f ioctls/buffer "
+	       "(busy %4.2f, madvise %4.2f)%s%s%s\n", num_threads,
+	       ops * 1000.0 / elapsed, (double)ioctls / ops,
+	       (double)busy_ioctls / ops, (double)madvise_ioctls / ops,
+	       errors ? ", ERRORS" : "",
+	       bad_execs ? ", DUPLICATE EXEC OBJECTS" : "",
+	       busy_reused ? ", BUSY BUFFERS REUSED" : "");
+
+	drm_intel_bufmgr_destroy(b.bufmgr);
+	if (live_handles) {
+		fprintf(stderr, "%lu handles leaked\n", live_handles);
+		return 1;
+	}
+
+	return errors || bad_execs || busy_reused;
+}
+
+static int run_vma(const char *name, int limit, int64_t limit_bytes)
+{
+	drm_intel_bo *bos[VMA_LARGE + VMA_SMALL];
+	struct drm_intel_gem_vma_stats stats;
+	drm_intel_bufmgr *bufmgr;
+	uint64_t start, elapsed;
+	int i, j, round, ret = 0;
+
+	bufmgr = drm_intel_bufmgr_gem_init(-1, 4096);
+	if (!bufmgr) {
+		fprintf(stderr, "drm_intel_bufmgr_gem_init failed\n");
+		return 1;
+	}
+	drm_intel_bufmgr_gem_set_vma_cache_size(bufmgr, limit);
+	drm_intel_bufmgr_gem_set_vma_cache_bytes(bufmgr, limit_bytes);
+
+	for (i = 0; i < VMA_LARGE + VMA_SMALL; i++)
+		bos[i] = drm_intel_bo_alloc(bufmgr, "vma", i < VMA_LARGE ?
+					    VMA_LARGE_SIZE : VMA_SMALL_SIZE,
+					    4096);
+
+	/* Every texture is mapped once for each 32 small buffers. */
+	start = now_ns();
+	for (round = 0; round < VMA_ROUNDS; round++) {
+		for (i = 0; i < VMA_SMALL; i++) {
+			j = i % 32 ? VMA_LARGE + i : (i / 32) % VMA_LARGE;
+			if (drm_intel_bo_map(bos[j], 1)) {
+				ret = 1;
+				break;
+			}
+			memset(bos[j]->virtual, 0xcc, 64);
+			drm_intel_bo_unmap(bos[j]);
+		}
+	}
+	elapsed = now_ns() - start;
+
+	drm_intel_bufmgr_gem_get_vma_cache_stats(bufmgr, DRM_INTEL_GEM_VMA_CPU,
+						 &stats);
+	if (limit_bytes >= 0 && stats.mapped_bytes > (uint64_t)limit_bytes)
+		ret = 1;
+
+	printf("vma cache, %s: %5.1f%% hits, %4llu MiB mapped, %6.2f us/map%s\n",
+	       name, stats.hits * 100.0 / (stats.hits + stats.misses),
+	       (unsigned long long)stats.mapped_bytes >> 20,
+	       elapsed / 1000.0 / (VMA_ROUNDS * VMA_SMALL),
+	       ret ? ", ERRORS" : "");
+
+	for (i = 0; i < VMA_LARGE + VMA_SMALL; i++)
+		drm_intel_bo_unreference(bos[i]);
+	drm_intel_bufmgr_destroy(bufmgr);
+
+	return ret;
+}
+
+static int run_relocs(bool softpin)
+{
+	drm_intel_bo *state[RELOC_STATE], *textures[RELOC_TEXTURES], *batch;
+	drm_intel_bufmgr *bufmgr;
+	uint64_t start, elapsed, exec_start, exec_ns = 0;
+	int i, j, round, ret = 0;
+
+	bufmgr = drm_intel_bufmgr_gem_init(-1, RELOC_BATCH_SIZE);
+	if (!bufmgr) {
+		fprintf(stderr, "drm_intel_bufmgr_gem_init failed\n");
+		return 1;
+	}
+	drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+	if (softpin && drm_intel_bufmgr_gem_enable_softpin(bufmgr, 1 << 20,
+							   1ull << 32)) {
+		fprintf(stderr, "drm_intel_bufmgr_gem_enable_softpin failed\n");
+		return 1;
+	}
+	exec_unpinned = 0;
+
+	for (i = 0; i < RELOC_TEXTURES; i++)
+		textures[i] = drm_intel_bo_alloc(bufmgr, "texture", 65536, 4096);
+
+	start = now_ns();
+	for (round = 0; round < RELOC_ROUNDS; round++) {
+		for (i = 0; i < RELOC_STATE; i++) {
+			state[i] = drm_intel_bo_alloc(bufmgr, "state", 4096, 4096);
+			for (j = 0; j < RELOC_TEXTURES; j++)
+				ret |= drm_intel_bo_emit_reloc(state[i], j * 4,
+							       textures[j], 0,
+							       I915_GEM_DOMAIN_SAMPLER,
+							       0);
+		}
+
+		batch = drm_intel_bo_alloc(bufmgr, "batch", RELOC_BATCH_SIZE,
+					   4096);
+		for (i = 0; i < RELOC_COUNT; i++)
+			ret |= drm_intel_bo_emit_reloc(batch, i * 4,
+						       state[i % RELOC_STATE],
+						       0,
+						       I915_GEM_DOMAIN_INSTRUCTION,
+						       0);
+
+		for (i = 0; i < RELOC_TEXTURES; i++)
+			if (!drm_intel_bo_references(batch, textures[i]))
+				ret = 1;
+
+		exec_start = now_ns();
+		ret |= drm_intel_bo_exec(batch, RELOC_BATCH_SIZE, NULL, 0, 0);
+		exec_ns += now_ns() - exec_start;
+		if (exec_objects != 1 + RELOC_STATE + RELOC_TEXTURES)
+			ret = 1;
+
+		drm_intel_bo_unreference(batch);
+		for (i = 0; i < RELOC_STATE; i++)
+			drm_intel_bo_unreference(state[i]);
+	}
+	elapsed = now_ns() - start;
+
+	if (softpin && exec_unpinned)
+		ret = 1;
+
+	printf("%s, %d to %d buffers: %8.2f us/batch, %7.2f us/exec%s\n",
+	       softpin ? "softpin" : "relocs ", RELOC_COUNT,
+	       RELOC_STATE + RELOC_TEXTURES, elapsed / 1000.0 / RELOC_ROUNDS,
+	       exec_ns / 1000.0 / RELOC_ROUNDS, ret ? ", ERRORS" : "");
+
+	for (i = 0; i < RELOC_TEXTURES; i++)
+		drm_intel_bo_unreference(textures[i]);
+	drm_intel_bufmgr_destroy(bufmgr);
+	if (live_handles) {
+		fprintf(stderr, "%lu handles leaked\n", live_handles);
+		return 1;
+	}
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned threads[] = { 1, 2, 4, 8 };
+	unsigned i;
+	int ret = 0;
+
+	for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+		ret |= run(threads[i]);
+
+	ret |= run_vma("64 mappings", 64, -1);
+	ret |= run_vma("64 MiB", -1, 64 << 20);
+	ret |= run_relocs(false);
+	ret |= run_relocs(true);
+
+	return ret;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Throughput of drm_intel_decode on large batches, like the ones dumped
+ * from GPU hangs. Each test batch is repeated until it is several
+ * megabytes long and decoded past its MI_BATCHBUFFER_ENDs, first in the
+ * calling thread and then on a few threads, best of a few rounds. Both
+ * decodes must give the same output. The last decode passes the commands
+ * to a callback instead, as a tool looking for some state packets would,
+ * and must find as many commands as the text output has.
+ *
+ * Usage: decode_bench <batch>...
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "intel_bufmgr.h"
+#include "intel_chipset.h"
+
+#define HW_OFFSET	0x12300000
+#define BATCH_BYTES	(2 << 20)
+#define THREADS		4
+#define ROUNDS		5
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t infer_devid(const char *filename)
+{
+	static const struct {
+		const char *name;
+		uint32_t devid;
+	} chipsets[] = {
+		{ "gen4", 0x2a02 },
+		{ "gm45", 0x2a42 },
+		{ "gen5", PCI_CHIP_ILD_G },
+		{ "gen6", PCI_CHIP_SANDYBRIDGE_GT2 },
+		{ "gen7", PCI_CHIP_IVYBRIDGE_GT2 },
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(chipsets) / sizeof(chipsets[0]); i++) {
+		if (strstr(filename, chipsets[i].name))
+			return chipsets[i].devid;
+	}
+	return 0;
+}
+
+static uint32_t *read_batch(const char *filename, size_t *count)
+{
+	uint32_t *batch, *big;
+	size_t size, i;
+	FILE *fp;
+
+	fp = fopen(filename, "rb");
+	if (!fp)
+		return NULL;
+
+	batch = malloc(BATCH_BYTES);
+	size = fread(batch, 1, BATCH_BYTES, fp) / 4;
+	fclose(fp);
+	if (!size) {
+		free(batch);
+		return NULL;
+	}
+
+	big = malloc(BATCH_BYTES);
+	for (i = 0; i + size <= BATCH_BYTES / 4; i += size)
+		memcpy(big + i, batch, size * 4);
+	free(batch);
+
+	*count = i;
+	return big;
+}
+
+static char *decode(struct drm_intel_decode *ctx, int threads,
+		    size_t *size, uint64_t *ns)
+{
+	uint64_t start, elapsed;
+	char *text = NULL;
+	FILE *out;
+	int round;
+
+	drm_intel_decode_set_parallel(ctx, threads, 0);
+
+	*ns = UINT64_MAX;
+	for (round = 0; round < ROUNDS; round++) {
+		free(text);
+		out = open_memstream(&text, size);
+		if (!out)
+			return NULL;
+
+		drm_intel_decode_set_output_file(ctx, out);
+
+		start = now_ns();
+		drm_intel_decode(ctx);
+		fflush(out);
+		elapsed = now_ns() - start;
+		if (elapsed < *ns)
+			*ns = elapsed;
+
+		fclose(out);
+	}
+
+	return text;
+}
+
+static void count_packet(const struct drm_intel_decode_packet *packet,
+			 void *priv)
+{
+	size_t *packets = priv;
+
+	(*packets)++;
+}
+
+static size_t count_lines(const char *text, size_t size)
+{
+	size_t lines = 0;
+	const char *p;
+
+	/* Each command starts with its header, which has no indent. */
+	for (p = text; p < text + size; p = strchr(p, '\n') + 1) {
+		if (!strncmp(p + 10, ":      0x", 9) ||
+		    !strncmp(p + 10, ": HEAD 0x", 9) ||
+		    !strncmp(p + 10, ": TAIL 0x", 9)) {
+			if (strncmp(p + 28, "   ", 3))
+				lines++;
+		}
+	}
+
+	return lines;
+}
+
+static uint64_t decode_packets(struct drm_intel_decode *ctx, size_t *packets)
+{
+	uint64_t start, elapsed, ns = UINT64_MAX;
+	int round;
+
+	drm_intel_decode_set_packet_callback(ctx, count_packet, NULL, packets);
+
+	for (round = 0; round < ROUNDS; round++) {
+		*packets = 0;
+		start = now_ns();
+		drm_intel_decode(ctx);
+		elapsed = now_ns() - start;
+		if (elapsed < ns)
+			ns = elapsed;
+	}
+
+	drm_intel_decode_set_packet_callback(ctx, NULL, NULL, NULL);
+	return ns;
+}
+
+static int bench(const char *filename)
+{
+	struct drm_intel_decode *ctx;
+	uint64_t seq_ns, par_ns, packet_ns;
+	size_t count, seq_size, par_size, packets;
+	char *seq, *par;
+	uint32_t *batch, devid;
+	int ret = 1;
+
+	devid = infer_devid(filename);
+	batch = read_batch(filename, &count);
+	if (!devid || !batch) {
+		fprintf(stderr, "%s: couldn't load batch\n", filename);
+		free(batch);
+		return 1;
+	}
+
+	ctx = drm_intel_decode_context_alloc(devid);
+	drm_intel_decode_set_batch_pointer(ctx, batch, HW_OFFSET, count);
+	drm_intel_decode_set_dump_past_end(ctx, 1);
+
+	seq = decode(ctx, 1, &seq_size, &seq_ns);
+	par = decode(ctx, THREADS, &par_size, &par_ns);
+	packet_ns = decode_packets(ctx, &packets);
+
+	if (!seq || !par) {
+		fprintf(stderr, "%s: out of memory\n", filename);
+	} else if (seq_size != par_size || memcmp(seq, par, seq_size)) {
+		fprintf(stderr, "%s: parallel decode differs\n", filename);
+	} else if (packets != count_lines(seq, seq_size)) {
+		fprintf(stderr, "%s: %zu commands, expected %zu\n", filename,
+			packets, count_lines(seq, seq_size));
+	} else {
+		printf("%-24s %5zu KiB: 1 thread %7.1f MiB/s, "
+		       "%d threads %7.1f MiB/s, %zu MiB of output, "
+		       "callback %7.1f MiB/s\n",
+		       strrchr(filename, '/') ? strrchr(filename, '/') + 1 :
+		       filename, count / 256,
+		       count * 4 / 1048576.0 / (seq_ns / 1e9), THREADS,
+		       count * 4 / 1048576.0 / (par_ns / 1e9), seq_size >> 20,
+		       count * 4 / 1048576.0 / (packet_ns / 1e9));
+		ret = 0;
+	}
+
+	free(seq);
+	free(par);
+	drm_intel_decode_context_free(ctx);
+	free(batch);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int i, ret = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <batch>...\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++)
+		ret |= bench(argv[i]);
+
+	return ret;
+}
@@ -34,6 +34,7 @@
 #ifndef INTEL_BUFMGR_H
 #define INTEL_BUFMGR_H
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -178,8 +179,29 @@ drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 						unsigned int handle);
 void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr);
+int drm_intel_bufmgr_gem_enable_softpin(drm_intel_bufmgr *bufmgr,
+				       uint64_t start, uint64_t size);
 void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
 					     int limit);
+
+/* Kinds of mappings, see drm_intel_bufmgr_gem_get_vma_cache_stats(). */
+#define DRM_INTEL_GEM_VMA_CPU	0
+#define DRM_INTEL_GEM_VMA_WC	1
+#define DRM_INTEL_GEM_VMA_GTT	2
+
+struct drm_intel_gem_vma_stats {
+	uint64_t hits;		/* maps which reused a mapping */
+	uint64_t misses;	/* maps which had to mmap */
+	uint64_t evictions;	/* unused mappings dropped to fit the cache */
+	uint64_t cached_bytes;	/* unused mappings kept in the cache */
+	uint64_t mapped_bytes;	/* all mappings, used or not */
+};
+
+void drm_intel_bufmgr_gem_set_vma_cache_bytes(drm_intel_bufmgr *bufmgr,
+					      int64_t limit);
+int drm_intel_bufmgr_gem_get_vma_cache_stats(drm_intel_bufmgr *bufmgr,
+					     int type,
+					     struct drm_intel_gem_vma_stats *stats);
 int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo);
 int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo);
 int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo);
@@ -266,6 +288,44 @@ void drm_intel_bo_fake_disable_backing_store(drm_intel_bo *bo,
 void drm_intel_bufmgr_fake_contended_lock_take(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_fake_evict_all(drm_intel_bufmgr *bufmgr);
 
+/**
+ * A command of a decoded batch, as passed to the callback set with
+ * drm_intel_decode_set_packet_callback().
+ */
+struct drm_intel_decode_packet {
+	/** GPU address of the command. */
+	uint32_t offset;
+	/**
+	 * Length of the command in DWORDs, cut short at the end of a
+	 * truncated batch, so that all of data[0..length) can be read.
+	 */
+	uint32_t length;
+	/** Command type from bits 31:29 of the header: 0 MI, 2 2D, 3 3D. */
+	uint32_t type;
+	/**
+	 * Bits of the header which select the command: 28:23 for MI, 28:22
+	 * for 2D and 28:16 for gen4+ 3D. Gen2 and gen3 3D commands have the
+	 * opcode in bits 12:8 and, for opcode 0x1d, the sub-opcode in 7:0.
+	 */
+	uint32_t opcode;
+	/** The DWORDs of the command, only valid during the callback. */
+	const uint32_t *data;
+};
+
+#if defined(__GNUC__) && (__GNUC__ >= 3)
+#define DRM_INTEL_PRINTFLIKE(f, a) __attribute__ ((format(__printf__, f, a)))
+#else
+#define DRM_INTEL_PRINTFLIKE(f, a)
+#endif
+
+/**
+ * Callback for the fields of a decoded command: the DWORD at @offset holds
+ * @value, described by @format and @va as for vprintf().
+ */
+typedef void (*drm_intel_decode_field_func)(uint32_t offset, uint32_t value,
+					    const char *format, va_list va,
+					    void *priv) DRM_INTEL_PRINTFLIKE(3, 0);
+
 struct drm_intel_decode *drm_intel_decode_context_alloc(uint32_t devid);
 void drm_intel_decode_context_free(struct drm_intel_decode *ctx);
 void drm_intel_decode_set_batch_pointer(struct drm_intel_decode *ctx,
@@ -276,6 +336,13 @@ void drm_intel_decode_set_dump_past_end(struct drm_intel_decode *ctx,
 void drm_intel_decode_set_head_tail(struct drm_intel_decode *ctx,
 				    uint32_t head, uint32_t tail);
 void drm_intel_decode_set_output_file(struct drm_intel_decode *ctx, FILE *out);
+void drm_intel_decode_set_parallel(struct drm_intel_decode *ctx, int threads,
+				   uint32_t chunk_dwords);
+void drm_intel_decode_set_packet_callback(struct drm_intel_decode *ctx,
+					  void (*packet) (const struct drm_intel_decode_packet *packet,
+							  void *priv),
+					  drm_intel_decode_field_func field,
+					  void *priv);
 void drm_intel_decode(struct drm_intel_decode *ctx);
 
 int drm_intel_reg_read(drm_intel_bufmgr *bufmgr,
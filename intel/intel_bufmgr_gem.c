@@ -37,6 +37,7 @@
 #include <xf86drm.h>
 #include <xf86atomic.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -57,6 +58,7 @@
 #include "intel_bufmgr.h"
 #include "intel_bufmgr_priv.h"
 #include "intel_chipset.h"
+#include "mm.h"
 #include "string.h"
 
 #include "i915_drm.h"
@@ -99,20 +101,82 @@
 typedef struct _drm_intel_bo_gem drm_intel_bo_gem;
 
 struct drm_intel_gem_bo_bucket {
+	pthread_mutex_t lock;
 	drmMMListHead head;
 	unsigned long size;
 };
 
-typedef struct _drm_intel_bufmgr_gem {
-	drm_intel_bufmgr bufmgr;
+#define DRM_INTEL_GEM_MAGAZINE_SIZE 32
 
-	atomic_t refcount;
+/*
+ * Cached BOs up to this size are only marked purgeable once they have been
+ * unused for a second, which saves two madvise calls for most reuses.
+ */
+#define DRM_INTEL_GEM_LAZY_MADVISE_MAX_SIZE (256 * 1024)
 
-	int fd;
+/**
+ * Stack of idle BOs of any size class, owned by one thread and sitting in
+ * front of the shared buckets, so that a thread which keeps freeing and
+ * allocating buffers doesn't touch the shared buckets at all.
+ *
+ * Only the owning thread adds and takes BOs; the lock is for the cache
+ * cleanup and bufmgr destruction, so it is essentially never contended.
+ */
+struct drm_intel_gem_bo_magazine {
+	pthread_mutex_t lock;
+	drmMMListHead link;
+	struct _drm_intel_bufmgr_gem *bufmgr_gem;
+	int count;
+	/** Oldest first, with their sizes kept aside for a cheap search. */
+	drm_intel_bo_gem *bos[DRM_INTEL_GEM_MAGAZINE_SIZE];
+	unsigned long sizes[DRM_INTEL_GEM_MAGAZINE_SIZE];
+};
 
-	int max_relocs;
+#define DRM_INTEL_GEM_VMA_TYPES 3
 
-	pthread_mutex_t lock;
+/**
+ * Unused mappings of one kind, which are kept around in case their BO is
+ * mapped again, and what happened to them.
+ */
+struct drm_intel_gem_vma_cache {
+	/** Least recently unmapped first. */
+	drmMMListHead lru;
+	struct drm_intel_gem_vma_stats stats;
+};
+
+#define DRM_INTEL_GEM_NUM_TIMELINES 16
+
+/* How long a BO seen busy makes later BOs on its timeline count as busy. */
+#define DRM_INTEL_GEM_BUSY_HINT_NS 1000000
+
+/**
+ * What we know about the progress of one context on one engine, whose
+ * batches complete in submission order. Serials are handed out by the
+ * bufmgr to every execbuffer before it is submitted; batches submitted
+ * concurrently on one timeline may reach the kernel in either order, so
+ * their buffers aren't tracked.
+ */
+struct drm_intel_gem_timeline {
+	/** Context and engine, see drm_intel_gem_timeline_key(); 0 if unused. */
+	uint64_t key;
+	/** Batches being submitted, and a count of overlapping submissions. */
+	unsigned int inflight;
+	unsigned int generation;
+	/** Every batch up to this serial has completed. */
+	uint64_t retired;
+	/** The batch with this serial was still running at busy_time. */
+	uint64_t busy;
+	uint64_t busy_time;
+};
+
+/**
+ * Validation list of one execbuffer call.
+ *
+ * Each exec takes one of these from bufmgr_gem->exec_states, so that
+ * batches can be validated and submitted by several threads at once.
+ */
+struct drm_intel_gem_exec_state {
+	struct drm_intel_gem_exec_state *next;
 
 	struct drm_i915_gem_exec_object *exec_objects;
 	struct drm_i915_gem_exec_object2 *exec2_objects;
@@ -120,18 +184,96 @@ typedef struct _drm_intel_bufmgr_gem {
 	int exec_size;
 	int exec_count;
 
+	/** Open-addressed map from BO to 1 + its index in exec_bos. */
+	int *index;
+	unsigned int index_mask;
+
+	/** Whether growing the validation list failed. */
+	bool has_error;
+
+	/** Serial, timeline and its generation at submission. */
+	uint64_t serial;
+	uint64_t timeline;
+	unsigned int generation;
+};
+
+typedef struct _drm_intel_bufmgr_gem {
+	drm_intel_bufmgr bufmgr;
+
+	atomic_t refcount;
+
+	int fd;
+
+	int max_relocs;
+
+	/**
+	 * There is no lock covering the whole bufmgr. Each bucket has its
+	 * own lock, and neither those nor the locks below are ever nested,
+	 * except for the magazines and for timeline_lock and softpin_lock,
+	 * which are taken last.
+	 */
+
+	/** Protects the unused exec states. */
+	pthread_mutex_t exec_lock;
+	struct drm_intel_gem_exec_state *exec_states;
+
+	/**
+	 * Protects the timelines, the exec and context serials and the
+	 * exec_serial, exec_timeline and idle fields of reusable BOs.
+	 */
+	pthread_mutex_t timeline_lock;
+	uint64_t exec_serial;
+	uint32_t context_serial;
+	struct drm_intel_gem_timeline timelines[DRM_INTEL_GEM_NUM_TIMELINES];
+
 	/** Array of lists of cached gem objects of power-of-two sizes */
 	struct drm_intel_gem_bo_bucket cache_bucket[14 * 4];
 	int num_buckets;
+
+	/**
+	 * Per-thread magazines. magazine_lock protects the list of all of
+	 * them, and is the one lock under which another (a magazine's own)
+	 * is taken.
+	 */
+	pthread_key_t magazine_key;
+	bool has_magazines;
+	pthread_mutex_t magazine_lock;
+	drmMMListHead magazines;
+
+	/** Protects time, the last time the cache was cleaned up. */
+	pthread_mutex_t cache_lock;
 	time_t time;
 
 	drmMMListHead managers;
 
+	/**
+	 * Protects name_table and handle_table, and the final unreference
+	 * of BOs which can be found in them by an import.
+	 */
+	pthread_mutex_t table_lock;
 	drm_intel_bo_gem *name_table;
 	drm_intel_bo_gem *handle_table;
 
-	drmMMListHead vma_cache;
+	/**
+	 * Protects the VMA cache and the mappings of all BOs. The cache is
+	 * limited both in number of mappings, counting twice as many for
+	 * the BOs in use, and in bytes of address space, counting the
+	 * mappings in use; -1 means unlimited.
+	 */
+	pthread_mutex_t vma_lock;
+	struct drm_intel_gem_vma_cache vma_cache[DRM_INTEL_GEM_VMA_TYPES];
 	int vma_count, vma_open, vma_max;
+	int64_t vma_max_bytes;
+	uint64_t vma_stamp;
+
+	/**
+	 * Protects the heap of GPU addresses, in pages, from which every BO
+	 * gets its softpin offset once drm_intel_bufmgr_gem_enable_softpin()
+	 * was called.
+	 */
+	pthread_mutex_t softpin_lock;
+	struct mem_block *softpin_heap;
+	unsigned long softpin_kflags;
 
 	uint64_t gtt_size;
 	int available_fences;
@@ -148,6 +290,14 @@ typedef struct _drm_intel_bufmgr_gem {
 	unsigned int has_exec_async : 1;
 	bool fenced_relocs;
 
+	/**
+	 * Set once the relocation tree of a buffer has changed after it
+	 * became a relocation target, which leaves the trees of the buffers
+	 * pointing to it incomplete, or once its offset or kflags changed
+	 * after they were copied into their target_objects.
+	 */
+	atomic_t stale_reloc_trees;
+
 	struct {
 		void *ptr;
 		uint32_t handle;
@@ -157,11 +307,34 @@ typedef struct _drm_intel_bufmgr_gem {
 
 #define DRM_INTEL_RELOC_FENCE (1<<0)
 
+/* The softpin heap is managed in pages, which lets mm.c's int offsets cover 8TiB. */
+#define DRM_INTEL_GEM_SOFTPIN_PAGE_SHIFT 12
+
 typedef struct _drm_intel_reloc_target_info {
 	drm_intel_bo *bo;
 	int flags;
 } drm_intel_reloc_target;
 
+/* A direct target of relocations or softpin entries, see drm_intel_gem_target. */
+#define DRM_INTEL_TARGET_RELOC (1<<1)
+#define DRM_INTEL_TARGET_SOFTPIN (1<<2)
+/* Used by drm_intel_gem_bo_clear_relocs() while trimming the tree. */
+#define DRM_INTEL_TARGET_KEEP (1<<3)
+#define DRM_INTEL_TARGET_KEEP_RELOC (1<<4)
+#define DRM_INTEL_TARGET_KEEP_FENCE (1<<5)
+
+/**
+ * A buffer in the relocation tree of another. Only direct targets carry
+ * DRM_INTEL_TARGET_* flags, and DRM_INTEL_RELOC_FENCE if any of the
+ * relocations to them needs a fence; the others are only there to answer
+ * drm_intel_bo_references(), and aren't dereferenced.
+ */
+struct drm_intel_gem_target {
+	drm_intel_bo *bo;
+	uint32_t handle;
+	int flags;
+};
+
 struct _drm_intel_bo_gem {
 	drm_intel_bo bo;
 
@@ -179,12 +352,6 @@ struct _drm_intel_bo_gem {
 	UT_hash_handle handle_hh;
 	UT_hash_handle name_hh;
 
-	/**
-	 * Index of the buffer within the validation list while preparing a
-	 * batchbuffer execution.
-	 */
-	int validate_index;
-
 	/**
 	 * Current tiling mode
 	 */
@@ -210,6 +377,24 @@ struct _drm_intel_bo_gem {
 	int softpin_target_count;
 	/** Maximum amount of softpinned BOs that are referenced by this buffer */
 	int softpin_target_size;
+	/**
+	 * Every buffer in the relocation tree of this one, once each, and
+	 * an open-addressed map from their handles to 1 + their index.
+	 * Each direct target of a relocation holds one reference.
+	 */
+	struct drm_intel_gem_target *targets;
+	int target_count;
+	int target_size;
+	int *target_index;
+	unsigned int target_index_mask;
+	/**
+	 * With softpin enabled, the execbuffer entries of the targets,
+	 * built as they are added.
+	 */
+	struct drm_i915_gem_exec_object2 *target_objects;
+
+	/** The block of bufmgr_gem->softpin_heap assigned to this buffer. */
+	struct mem_block *softpin_block;
 
 	/** Mapped address for the buffer, saved across map/unmap cycles */
 	void *mem_virtual;
@@ -223,7 +408,9 @@ struct _drm_intel_bo_gem {
 	 */
 	void *user_virtual;
 	int map_count;
-	drmMMListHead vma_list;
+	/** Links in the VMA cache, and when the BO was last unmapped. */
+	drmMMListHead vma_list[DRM_INTEL_GEM_VMA_TYPES];
+	uint64_t vma_stamp;
 
 	/** BO cache list */
 	drmMMListHead head;
@@ -241,6 +428,19 @@ struct _drm_intel_bo_gem {
 	 */
 	bool used_as_reloc_target;
 
+	/**
+	 * Boolean of whether this buffer is in the relocation tree of
+	 * another, so that changing its own tree leaves that one stale.
+	 */
+	bool in_reloc_tree;
+
+	/**
+	 * Boolean of whether the relocation tree of this buffer has
+	 * relocations or buffers which aren't softpinned, and so can't be
+	 * submitted with target_objects as they are.
+	 */
+	bool needs_relocs;
+
 	/**
 	 * Boolean of whether we have encountered an error whilst building the relocation tree.
 	 */
@@ -260,6 +460,18 @@ struct _drm_intel_bo_gem {
 	 */
 	bool idle;
 
+	/**
+	 * Serial and timeline of the last batch using a reusable buffer,
+	 * which lets its idleness be inferred from other buffers. The
+	 * timeline is 0 if the buffer was used by batches on several
+	 * timelines since it was last known to be idle.
+	 */
+	uint64_t exec_serial;
+	uint64_t exec_timeline;
+
+	/** Whether the kernel may drop the pages of the cached buffer. */
+	bool purgeable;
+
 	/**
 	 * Boolean of whether this buffer was allocated with userptr
 	 */
@@ -298,18 +510,47 @@ drm_intel_gem_bo_set_tiling_internal(drm_intel_bo *bo,
 				     uint32_t tiling_mode,
 				     uint32_t stride);
 
-static void drm_intel_gem_bo_unreference_locked_timed(drm_intel_bo *bo,
-						      time_t time);
+static void drm_intel_gem_bo_unreference_timed(drm_intel_bo *bo, time_t time);
 
 static void drm_intel_gem_bo_unreference(drm_intel_bo *bo);
 
 static void drm_intel_gem_bo_free(drm_intel_bo *bo);
 
+static void drm_intel_gem_bo_release(drm_intel_bo *bo);
+
+static void drm_intel_gem_bo_unlink(drm_intel_bufmgr_gem *bufmgr_gem,
+				    drm_intel_bo_gem *bo_gem);
+
+static void drm_intel_gem_bo_free_list(drmMMListHead *list);
+
 static inline drm_intel_bo_gem *to_bo_gem(drm_intel_bo *bo)
 {
         return (drm_intel_bo_gem *)bo;
 }
 
+/* Returns where the mapping of @type of a BO is kept. */
+static void **
+drm_intel_gem_bo_vma(drm_intel_bo_gem *bo_gem, int type)
+{
+	switch (type) {
+	case DRM_INTEL_GEM_VMA_CPU:
+		return &bo_gem->mem_virtual;
+	case DRM_INTEL_GEM_VMA_WC:
+		return &bo_gem->wc_virtual;
+	default:
+		return &bo_gem->gtt_virtual;
+	}
+}
+
+static void
+drm_intel_gem_bo_init_vma(drm_intel_bo_gem *bo_gem)
+{
+	int type;
+
+	for (type = 0; type < DRM_INTEL_GEM_VMA_TYPES; type++)
+		DRMINITLISTHEAD(&bo_gem->vma_list[type]);
+}
+
 static unsigned long
 drm_intel_gem_bo_tile_size(drm_intel_bufmgr_gem *bufmgr_gem, unsigned long size,
 			   uint32_t *tiling_mode)
@@ -392,30 +633,41 @@ drm_intel_gem_bo_tile_pitch(drm_intel_bufmgr_gem *bufmgr_gem,
 	return i;
 }
 
+/**
+ * Returns the smallest bucket holding @size bytes, computed from the layout
+ * built by init_cache_buckets: one, two, three and four pages, then four
+ * steps for each power of two up to the maximum cached size.
+ */
 static struct drm_intel_gem_bo_bucket *
 drm_intel_gem_bo_bucket_for_size(drm_intel_bufmgr_gem *bufmgr_gem,
 				 unsigned long size)
 {
-	int i;
+	unsigned long last;
+	int i, order;
 
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
+	if (size <= 4 * 4096) {
+		i = size ? (size - 1) / 4096 : 0;
+	} else {
+		/* The bucket is the next quarter step above size - 1. */
+		last = size - 1;
+		order = sizeof(last) * 8 - 1 - __builtin_clzl(last);
+		i = 4 * (order - 14) + 4 + ((last >> (order - 2)) & 3);
 	}
 
-	return NULL;
+	if (i >= bufmgr_gem->num_buckets)
+		return NULL;
+
+	return &bufmgr_gem->cache_bucket[i];
 }
 
 static void
-drm_intel_gem_dump_validation_list(drm_intel_bufmgr_gem *bufmgr_gem)
+drm_intel_gem_dump_validation_list(drm_intel_bufmgr_gem *bufmgr_gem,
+				   struct drm_intel_gem_exec_state *exec)
 {
 	int i, j;
 
-	for (i = 0; i < bufmgr_gem->exec_count; i++) {
-		drm_intel_bo *bo = bufmgr_gem->exec_bos[i];
+	for (i = 0; i < exec->exec_count; i++) {
+		drm_intel_bo *bo = exec->exec_bos[i];
 		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
 		if (bo_gem->relocs == NULL && bo_gem->softpin_target == NULL) {
@@ -471,6 +723,177 @@ drm_intel_gem_bo_reference(drm_intel_bo *bo)
 	atomic_inc(&bo_gem->refcount);
 }
 
+static struct drm_intel_gem_exec_state *
+drm_intel_gem_exec_state_get(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	struct drm_intel_gem_exec_state *exec;
+
+	pthread_mutex_lock(&bufmgr_gem->exec_lock);
+	exec = bufmgr_gem->exec_states;
+	if (exec)
+		bufmgr_gem->exec_states = exec->next;
+	pthread_mutex_unlock(&bufmgr_gem->exec_lock);
+
+	if (!exec)
+		exec = calloc(1, sizeof(*exec));
+
+	return exec;
+}
+
+static void
+drm_intel_gem_exec_state_put(drm_intel_bufmgr_gem *bufmgr_gem,
+			     struct drm_intel_gem_exec_state *exec)
+{
+	int i;
+
+	for (i = 0; i < exec->exec_count; i++)
+		exec->exec_bos[i] = NULL;
+	exec->exec_count = 0;
+	exec->has_error = false;
+	if (exec->index)
+		memset(exec->index, 0,
+		       (exec->index_mask + 1) * sizeof(*exec->index));
+
+	pthread_mutex_lock(&bufmgr_gem->exec_lock);
+	exec->next = bufmgr_gem->exec_states;
+	bufmgr_gem->exec_states = exec;
+	pthread_mutex_unlock(&bufmgr_gem->exec_lock);
+}
+
+static void
+drm_intel_gem_exec_state_free(struct drm_intel_gem_exec_state *exec)
+{
+	free(exec->exec_objects);
+	free(exec->exec2_objects);
+	free(exec->exec_bos);
+	free(exec->index);
+	free(exec);
+}
+
+static unsigned int
+drm_intel_gem_exec_hash(drm_intel_bo *bo)
+{
+	return (unsigned int)((uintptr_t)bo >> 4) * 0x9e3779b1u;
+}
+
+/* Returns the slot of bo in exec->index, or the empty slot it would go to. */
+static unsigned int
+drm_intel_gem_exec_slot(struct drm_intel_gem_exec_state *exec,
+			drm_intel_bo *bo)
+{
+	unsigned int slot = drm_intel_gem_exec_hash(bo) & exec->index_mask;
+
+	while (exec->index[slot] &&
+	       exec->exec_bos[exec->index[slot] - 1] != bo)
+		slot = (slot + 1) & exec->index_mask;
+
+	return slot;
+}
+
+/* Returns the index of bo in the validation list, or -1. */
+static int
+drm_intel_gem_exec_find(struct drm_intel_gem_exec_state *exec,
+			drm_intel_bo *bo)
+{
+	if (!exec->index)
+		return -1;
+
+	return exec->index[drm_intel_gem_exec_slot(exec, bo)] - 1;
+}
+
+/**
+ * Makes room for @count buffers in the validation list.
+ *
+ * An exec state may serve both execbuffer flavours, so only the object array
+ * of the one being built is kept at exec_size; the other is dropped.
+ */
+static bool
+drm_intel_gem_exec_reserve(struct drm_intel_gem_exec_state *exec, int count,
+			   bool exec2)
+{
+	bool missing = exec2 ? !exec->exec2_objects : !exec->exec_objects;
+
+	if (count > exec->exec_size || missing) {
+		int new_size = exec->exec_size;
+
+		if (count > exec->exec_size) {
+			drm_intel_bo **exec_bos;
+
+			new_size = new_size ? new_size * 2 : 5;
+			if (new_size < count)
+				new_size = count;
+			exec_bos = realloc(exec->exec_bos,
+					   sizeof(*exec_bos) * new_size);
+			if (!exec_bos)
+				goto err;
+			exec->exec_bos = exec_bos;
+		}
+
+		if (exec2) {
+			struct drm_i915_gem_exec_object2 *objects;
+
+			objects = realloc(exec->exec2_objects,
+					  sizeof(*objects) * new_size);
+			if (!objects)
+				goto err;
+			exec->exec2_objects = objects;
+			free(exec->exec_objects);
+			exec->exec_objects = NULL;
+		} else {
+			struct drm_i915_gem_exec_object *objects;
+
+			objects = realloc(exec->exec_objects,
+					  sizeof(*objects) * new_size);
+			if (!objects)
+				goto err;
+			exec->exec_objects = objects;
+			free(exec->exec2_objects);
+			exec->exec2_objects = NULL;
+		}
+
+		exec->exec_size = new_size;
+	}
+
+	return true;
+
+err:
+	exec->has_error = true;
+	return false;
+}
+
+/**
+ * Makes room for one more buffer in the validation list, keeping the index
+ * at most half full.
+ */
+static bool
+drm_intel_gem_exec_grow(struct drm_intel_gem_exec_state *exec, bool exec2)
+{
+	if (!drm_intel_gem_exec_reserve(exec, exec->exec_count + 1, exec2))
+		return false;
+
+	if (!exec->index || 2 * (unsigned int)(exec->exec_count + 1) > exec->index_mask + 1) {
+		unsigned int size = exec->index ? 2 * (exec->index_mask + 1) : 64;
+		int *index = calloc(size, sizeof(*index));
+		int i;
+
+		if (!index)
+			goto err;
+
+		free(exec->index);
+		exec->index = index;
+		exec->index_mask = size - 1;
+
+		for (i = 0; i < exec->exec_count; i++)
+			index[drm_intel_gem_exec_slot(exec, exec->exec_bos[i])] = i + 1;
+	}
+
+	return true;
+
+err:
+	exec->has_error = true;
+	return false;
+}
+
 /**
  * Adds the given buffer to the list of buffers to be validated (moved into the
  * appropriate memory type) with the next batch submission.
@@ -480,47 +903,35 @@ drm_intel_gem_bo_reference(drm_intel_bo *bo)
  * access flags.
  */
 static void
-drm_intel_add_validate_buffer(drm_intel_bo *bo)
+drm_intel_add_validate_buffer(struct drm_intel_gem_exec_state *exec,
+			      drm_intel_bo *bo)
 {
-	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	int index;
 
-	if (bo_gem->validate_index != -1)
+	if (drm_intel_gem_exec_find(exec, bo) != -1)
 		return;
 
 	/* Extend the array of validation entries as necessary. */
-	if (bufmgr_gem->exec_count == bufmgr_gem->exec_size) {
-		int new_size = bufmgr_gem->exec_size * 2;
-
-		if (new_size == 0)
-			new_size = 5;
-
-		bufmgr_gem->exec_objects =
-		    realloc(bufmgr_gem->exec_objects,
-			    sizeof(*bufmgr_gem->exec_objects) * new_size);
-		bufmgr_gem->exec_bos =
-		    realloc(bufmgr_gem->exec_bos,
-			    sizeof(*bufmgr_gem->exec_bos) * new_size);
-		bufmgr_gem->exec_size = new_size;
-	}
+	if (!drm_intel_gem_exec_grow(exec, false))
+		return;
 
-	index = bufmgr_gem->exec_count;
-	bo_gem->validate_index = index;
+	index = exec->exec_count;
+	exec->index[drm_intel_gem_exec_slot(exec, bo)] = index + 1;
 	/* Fill in array entry */
-	bufmgr_gem->exec_objects[index].handle = bo_gem->gem_handle;
-	bufmgr_gem->exec_objects[index].relocation_count = bo_gem->reloc_count;
-	bufmgr_gem->exec_objects[index].relocs_ptr = (uintptr_t) bo_gem->relocs;
-	bufmgr_gem->exec_objects[index].alignment = bo->align;
-	bufmgr_gem->exec_objects[index].offset = 0;
-	bufmgr_gem->exec_bos[index] = bo;
-	bufmgr_gem->exec_count++;
+	exec->exec_objects[index].handle = bo_gem->gem_handle;
+	exec->exec_objects[index].relocation_count = bo_gem->reloc_count;
+	exec->exec_objects[index].relocs_ptr = (uintptr_t) bo_gem->relocs;
+	exec->exec_objects[index].alignment = bo->align;
+	exec->exec_objects[index].offset = 0;
+	exec->exec_bos[index] = bo;
+	exec->exec_count++;
 }
 
 static void
-drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
+drm_intel_add_validate_buffer2(struct drm_intel_gem_exec_state *exec,
+			       drm_intel_bo *bo, int need_fence)
 {
-	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *)bo;
 	int index;
 	unsigned long flags;
@@ -529,134 +940,562 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 	if (need_fence)
 		flags |= EXEC_OBJECT_NEEDS_FENCE;
 
-	if (bo_gem->validate_index != -1) {
-		bufmgr_gem->exec2_objects[bo_gem->validate_index].flags |= flags;
+	index = drm_intel_gem_exec_find(exec, bo);
+	if (index != -1) {
+		exec->exec2_objects[index].flags |= flags;
 		return;
 	}
 
 	/* Extend the array of validation entries as necessary. */
-	if (bufmgr_gem->exec_count == bufmgr_gem->exec_size) {
-		int new_size = bufmgr_gem->exec_size * 2;
+	if (!drm_intel_gem_exec_grow(exec, true))
+		return;
 
-		if (new_size == 0)
-			new_size = 5;
+	index = exec->exec_count;
+	exec->index[drm_intel_gem_exec_slot(exec, bo)] = index + 1;
+	/* Fill in array entry */
+	exec->exec2_objects[index].handle = bo_gem->gem_handle;
+	exec->exec2_objects[index].relocation_count = bo_gem->reloc_count;
+	exec->exec2_objects[index].relocs_ptr = (uintptr_t)bo_gem->relocs;
+	exec->exec2_objects[index].alignment = bo->align;
+	exec->exec2_objects[index].offset = bo->offset64;
+	exec->exec2_objects[index].flags = bo_gem->kflags | flags;
+	exec->exec2_objects[index].rsvd1 = 0;
+	exec->exec2_objects[index].rsvd2 = 0;
+	exec->exec_bos[index] = bo;
+	exec->exec_count++;
+}
 
-		bufmgr_gem->exec2_objects =
-			realloc(bufmgr_gem->exec2_objects,
-				sizeof(*bufmgr_gem->exec2_objects) * new_size);
-		bufmgr_gem->exec_bos =
-			realloc(bufmgr_gem->exec_bos,
-				sizeof(*bufmgr_gem->exec_bos) * new_size);
-		bufmgr_gem->exec_size = new_size;
-	}
+/**
+ * Whether the batch @bo_gem can be submitted from its target_objects: every
+ * buffer in its tree is softpinned and there are no relocations at all.
+ */
+static bool
+drm_intel_gem_bo_is_flat(drm_intel_bufmgr_gem *bufmgr_gem,
+			 drm_intel_bo_gem *bo_gem)
+{
+	return bufmgr_gem->softpin_heap &&
+	       (bo_gem->target_objects || !bo_gem->target_count) &&
+	       !bo_gem->needs_relocs &&
+	       bo_gem->kflags & EXEC_OBJECT_PINNED &&
+	       !atomic_read(&bufmgr_gem->stale_reloc_trees);
+}
 
-	index = bufmgr_gem->exec_count;
-	bo_gem->validate_index = index;
-	/* Fill in array entry */
-	bufmgr_gem->exec2_objects[index].handle = bo_gem->gem_handle;
-	bufmgr_gem->exec2_objects[index].relocation_count = bo_gem->reloc_count;
-	bufmgr_gem->exec2_objects[index].relocs_ptr = (uintptr_t)bo_gem->relocs;
-	bufmgr_gem->exec2_objects[index].alignment = bo->align;
-	bufmgr_gem->exec2_objects[index].offset = bo->offset64;
-	bufmgr_gem->exec2_objects[index].flags = bo_gem->kflags | flags;
-	bufmgr_gem->exec2_objects[index].rsvd1 = 0;
-	bufmgr_gem->exec2_objects[index].rsvd2 = 0;
-	bufmgr_gem->exec_bos[index] = bo;
-	bufmgr_gem->exec_count++;
+/* Sets up the validation list of a flat batch, without walking its tree. */
+static void
+drm_intel_add_validate_flat(struct drm_intel_gem_exec_state *exec,
+			    drm_intel_bo *bo)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	struct drm_i915_gem_exec_object2 *object;
+	int i, count = bo_gem->target_count;
+
+	if (!drm_intel_gem_exec_reserve(exec, count + 1, true))
+		return;
+
+	if (count)
+		memcpy(exec->exec2_objects, bo_gem->target_objects,
+		       count * sizeof(*exec->exec2_objects));
+	for (i = 0; i < count; i++)
+		exec->exec_bos[i] = bo_gem->targets[i].bo;
+
+	object = &exec->exec2_objects[count];
+	memclear(*object);
+	object->handle = bo_gem->gem_handle;
+	object->alignment = bo->align;
+	object->offset = bo->offset64;
+	object->flags = bo_gem->kflags;
+	exec->exec_bos[count] = bo;
+	exec->exec_count = count + 1;
 }
 
 #define RELOC_BUF_SIZE(x) ((I915_RELOC_HEADER + x * I915_RELOC0_STRIDE) * \
 	sizeof(uint32_t))
 
 static void
-drm_intel_bo_gem_set_in_aperture_size(drm_intel_bufmgr_gem *bufmgr_gem,
-				      drm_intel_bo_gem *bo_gem,
-				      unsigned int alignment)
+drm_intel_bo_gem_set_in_aperture_size(drm_intel_bufmgr_gem *bufmgr_gem,
+				      drm_intel_bo_gem *bo_gem,
+				      unsigned int alignment)
+{
+	unsigned int size;
+
+	assert(!bo_gem->used_as_reloc_target);
+
+	/* The older chipsets are far-less flexible in terms of tiling,
+	 * and require tiled buffer to be size aligned in the aperture.
+	 * This means that in the worst possible case we will need a hole
+	 * twice as large as the object in order for it to fit into the
+	 * aperture. Optimal packing is for wimps.
+	 */
+	size = bo_gem->bo.size;
+	if (bufmgr_gem->gen < 4 && bo_gem->tiling_mode != I915_TILING_NONE) {
+		unsigned int min_size;
+
+		if (bufmgr_gem->has_relaxed_fencing) {
+			if (bufmgr_gem->gen == 3)
+				min_size = 1024*1024;
+			else
+				min_size = 512*1024;
+
+			while (min_size < size)
+				min_size *= 2;
+		} else
+			min_size = size;
+
+		/* Account for worst-case alignment. */
+		alignment = MAX2(alignment, min_size);
+	}
+
+	bo_gem->reloc_tree_size = size + alignment;
+}
+
+static int
+drm_intel_setup_reloc_list(drm_intel_bo *bo)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	unsigned int max_relocs = bufmgr_gem->max_relocs;
+
+	if (bo->size / 4 < max_relocs)
+		max_relocs = bo->size / 4;
+
+	bo_gem->relocs = malloc(max_relocs *
+				sizeof(struct drm_i915_gem_relocation_entry));
+	bo_gem->reloc_target_info = malloc(max_relocs *
+					   sizeof(drm_intel_reloc_target));
+	if (bo_gem->relocs == NULL || bo_gem->reloc_target_info == NULL) {
+		bo_gem->has_error = true;
+
+		free (bo_gem->relocs);
+		bo_gem->relocs = NULL;
+
+		free (bo_gem->reloc_target_info);
+		bo_gem->reloc_target_info = NULL;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Returns the slot of @bo in the target index, or the empty slot it would go to. */
+static unsigned int
+drm_intel_gem_target_slot(drm_intel_bo_gem *bo_gem, drm_intel_bo *bo,
+			  uint32_t handle)
+{
+	unsigned int slot = (handle * 0x9e3779b1u) & bo_gem->target_index_mask;
+
+	while (bo_gem->target_index[slot]) {
+		struct drm_intel_gem_target *target =
+		    &bo_gem->targets[bo_gem->target_index[slot] - 1];
+
+		if (target->handle == handle && target->bo == bo)
+			break;
+		slot = (slot + 1) & bo_gem->target_index_mask;
+	}
+
+	return slot;
+}
+
+/* Returns the index of @bo in the relocation tree of @bo_gem, or -1. */
+static int
+drm_intel_gem_target_find(drm_intel_bo_gem *bo_gem, drm_intel_bo *bo)
+{
+	uint32_t handle = ((drm_intel_bo_gem *) bo)->gem_handle;
+
+	if (!bo_gem->target_index)
+		return -1;
+
+	return bo_gem->target_index[drm_intel_gem_target_slot(bo_gem, bo,
+							      handle)] - 1;
+}
+
+/* Adds @bo to the relocation tree of @bo_gem with @flags; returns its index. */
+static int
+drm_intel_gem_target_add(drm_intel_bo_gem *bo_gem, drm_intel_bo *bo,
+			 uint32_t handle, int flags)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem =
+	    (drm_intel_bufmgr_gem *) bo_gem->bo.bufmgr;
+	unsigned int slot;
+	int index;
+
+	if (bo_gem->target_index) {
+		slot = drm_intel_gem_target_slot(bo_gem, bo, handle);
+		if (bo_gem->target_index[slot]) {
+			index = bo_gem->target_index[slot] - 1;
+			bo_gem->targets[index].flags |= flags;
+			return index;
+		}
+	}
+
+	if (bo_gem->target_count == bo_gem->target_size) {
+		int new_size = bo_gem->target_size ? bo_gem->target_size * 2 : 8;
+		struct drm_intel_gem_target *targets;
+
+		targets = realloc(bo_gem->targets, new_size * sizeof(*targets));
+		if (!targets)
+			return -1;
+		bo_gem->targets = targets;
+
+		if (bufmgr_gem->softpin_heap) {
+			struct drm_i915_gem_exec_object2 *objects;
+
+			objects = realloc(bo_gem->target_objects,
+					  new_size * sizeof(*objects));
+			if (!objects)
+				return -1;
+			bo_gem->target_objects = objects;
+		}
+		bo_gem->target_size = new_size;
+	}
+
+	/* Keep the index at most half full. */
+	if (!bo_gem->target_index ||
+	    2 * (unsigned int)(bo_gem->target_count + 1) >
+	    bo_gem->target_index_mask + 1) {
+		unsigned int size = bo_gem->target_index ?
+			2 * (bo_gem->target_index_mask + 1) : 16;
+		int *target_index = calloc(size, sizeof(*target_index));
+
+		if (!target_index)
+			return -1;
+
+		free(bo_gem->target_index);
+		bo_gem->target_index = target_index;
+		bo_gem->target_index_mask = size - 1;
+		for (index = 0; index < bo_gem->target_count; index++) {
+			struct drm_intel_gem_target *target =
+			    &bo_gem->targets[index];
+
+			slot = drm_intel_gem_target_slot(bo_gem, target->bo,
+							 target->handle);
+			target_index[slot] = index + 1;
+		}
+	}
+
+	index = bo_gem->target_count++;
+	bo_gem->targets[index].bo = bo;
+	bo_gem->targets[index].handle = handle;
+	bo_gem->targets[index].flags = flags;
+	if (bo_gem->target_objects) {
+		struct drm_i915_gem_exec_object2 *object =
+		    &bo_gem->target_objects[index];
+
+		memclear(*object);
+		object->handle = handle;
+		object->alignment = bo->align;
+		object->offset = bo->offset64;
+		object->flags = to_bo_gem(bo)->kflags;
+	}
+	bo_gem->target_index[drm_intel_gem_target_slot(bo_gem, bo,
+						       handle)] = index + 1;
+
+	return index;
+}
+
+/**
+ * Adds @target_bo as a direct target of @bo_gem with @flags, along with
+ * its own relocation tree if it is new. Returns whether it already was a
+ * direct target of the same kind, or -1 if we ran out of memory.
+ */
+static int
+drm_intel_gem_bo_add_target(drm_intel_bo_gem *bo_gem, drm_intel_bo *target_bo,
+			    int flags)
+{
+	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
+	int index, old_flags;
+	int i;
+
+	index = drm_intel_gem_target_find(bo_gem, target_bo);
+	if (index != -1) {
+		/* Its own tree is already in ours. */
+		old_flags = bo_gem->targets[index].flags;
+		bo_gem->targets[index].flags |= flags;
+		return (old_flags & flags & ~DRM_INTEL_RELOC_FENCE) != 0;
+	}
+
+	/* Add the direct target last, so that it's only flagged, and so
+	 * expects a reference to be held, once everything else fitted.
+	 */
+	if (target_bo_gem != bo_gem) {
+		for (i = 0; i < target_bo_gem->target_count; i++) {
+			struct drm_intel_gem_target *target =
+			    &target_bo_gem->targets[i];
+
+			if (drm_intel_gem_target_add(bo_gem, target->bo,
+						     target->handle, 0) == -1)
+				return -1;
+		}
+		target_bo_gem->in_reloc_tree = true;
+	}
+
+	if (drm_intel_gem_target_add(bo_gem, target_bo,
+				     target_bo_gem->gem_handle, flags) == -1)
+		return -1;
+
+	/* A buffer listed twice can't be submitted from target_objects. */
+	if (target_bo_gem->needs_relocs ||
+	    !(target_bo_gem->kflags & EXEC_OBJECT_PINNED) ||
+	    drm_intel_gem_target_find(bo_gem, &bo_gem->bo) != -1)
+		bo_gem->needs_relocs = true;
+
+	return 0;
+}
+
+/* Forgets the relocation tree of @bo_gem, without dropping references. */
+static void
+drm_intel_gem_bo_clear_targets(drm_intel_bo_gem *bo_gem)
+{
+	free(bo_gem->targets);
+	bo_gem->targets = NULL;
+	bo_gem->target_count = 0;
+	bo_gem->target_size = 0;
+	free(bo_gem->target_index);
+	bo_gem->target_index = NULL;
+	bo_gem->target_index_mask = 0;
+	free(bo_gem->target_objects);
+	bo_gem->target_objects = NULL;
+}
+
+/* Called when the offset or kflags which target_objects copy change. */
+static void
+drm_intel_gem_bo_kflags_changed(drm_intel_bo_gem *bo_gem)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem =
+	    (drm_intel_bufmgr_gem *) bo_gem->bo.bufmgr;
+
+	if (bufmgr_gem->softpin_heap && bo_gem->in_reloc_tree)
+		atomic_set(&bufmgr_gem->stale_reloc_trees, 1);
+}
+
+static uint64_t
+drm_intel_gem_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Returns the timeline key of an execbuffer, or 0 if the engine it runs on
+ * isn't known up front.
+ *
+ * The kernel reuses the ids of destroyed contexts, whose batches may still
+ * be running and be overtaken by those of the new context, so contexts are
+ * told apart by their serial instead.
+ */
+static uint64_t
+drm_intel_gem_timeline_key(drm_intel_context *ctx, unsigned int flags)
+{
+	unsigned int ring = flags & I915_EXEC_RING_MASK;
+
+	if (ring == I915_EXEC_DEFAULT)
+		ring = I915_EXEC_RENDER;
+	/* The kernel picks the BSD engine unless told. */
+	if (ring == I915_EXEC_BSD &&
+	    (flags & I915_EXEC_BSD_MASK) == I915_EXEC_BSD_DEFAULT)
+		return 0;
+	if (ring == I915_EXEC_BSD)
+		ring |= (flags & I915_EXEC_BSD_MASK) >> (I915_EXEC_BSD_SHIFT - 6);
+
+	return ((uint64_t)(ctx ? ctx->serial : 0) << 8 | ring) + 1;
+}
+
+/* Returns the timeline for @key; timeline_lock must be held. */
+static struct drm_intel_gem_timeline *
+drm_intel_gem_timeline_get(drm_intel_bufmgr_gem *bufmgr_gem, uint64_t key,
+			   bool create)
+{
+	struct drm_intel_gem_timeline *timeline;
+
+	timeline = &bufmgr_gem->timelines[(key * 0x9e3779b97f4a7c15ull) >> 60];
+	if (timeline->key == key)
+		return timeline;
+	if (!create || timeline->inflight)
+		return NULL;
+
+	/* Evict whichever timeline used the slot, forgetting its progress. */
+	memset(timeline, 0, sizeof(*timeline));
+	timeline->key = key;
+	return timeline;
+}
+
+/* Starts the submission of a batch on timeline @key, see below. */
+static void
+drm_intel_gem_timeline_begin(drm_intel_bufmgr_gem *bufmgr_gem,
+			     struct drm_intel_gem_exec_state *exec,
+			     uint64_t key)
 {
-	unsigned int size;
+	struct drm_intel_gem_timeline *timeline = NULL;
+
+	pthread_mutex_lock(&bufmgr_gem->timeline_lock);
+	exec->serial = ++bufmgr_gem->exec_serial;
+	if (key)
+		timeline = drm_intel_gem_timeline_get(bufmgr_gem, key, true);
+	if (timeline) {
+		/* Make both this and the other submissions untracked. */
+		if (timeline->inflight++)
+			exec->generation = timeline->generation++;
+		else
+			exec->generation = timeline->generation;
+		exec->timeline = key;
+	} else {
+		exec->timeline = 0;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->timeline_lock);
+}
 
-	assert(!bo_gem->used_as_reloc_target);
+/*
+ * Records that the buffers of a batch are busy, and with which serial and
+ * timeline if it was @submitted.
+ */
+static void
+drm_intel_gem_timeline_end(drm_intel_bufmgr_gem *bufmgr_gem,
+			   struct drm_intel_gem_exec_state *exec,
+			   bool submitted)
+{
+	struct drm_intel_gem_timeline *timeline = NULL;
+	uint64_t key = exec->timeline;
+	int i;
 
-	/* The older chipsets are far-less flexible in terms of tiling,
-	 * and require tiled buffer to be size aligned in the aperture.
-	 * This means that in the worst possible case we will need a hole
-	 * twice as large as the object in order for it to fit into the
-	 * aperture. Optimal packing is for wimps.
-	 */
-	size = bo_gem->bo.size;
-	if (bufmgr_gem->gen < 4 && bo_gem->tiling_mode != I915_TILING_NONE) {
-		unsigned int min_size;
+	pthread_mutex_lock(&bufmgr_gem->timeline_lock);
+	if (key)
+		timeline = drm_intel_gem_timeline_get(bufmgr_gem, key, false);
+	if (timeline) {
+		timeline->inflight--;
+		if (timeline->generation != exec->generation)
+			key = 0;
+	}
+	for (i = 0; i < exec->exec_count; i++) {
+		drm_intel_bo_gem *bo_gem = to_bo_gem(exec->exec_bos[i]);
 
-		if (bufmgr_gem->has_relaxed_fencing) {
-			if (bufmgr_gem->gen == 3)
-				min_size = 1024*1024;
+		if (submitted) {
+			if (bo_gem->idle || bo_gem->exec_timeline == key)
+				bo_gem->exec_timeline = key;
 			else
-				min_size = 512*1024;
-
-			while (min_size < size)
-				min_size *= 2;
-		} else
-			min_size = size;
-
-		/* Account for worst-case alignment. */
-		alignment = MAX2(alignment, min_size);
+				bo_gem->exec_timeline = 0;
+			bo_gem->exec_serial = exec->serial;
+		}
+		bo_gem->idle = false;
 	}
+	pthread_mutex_unlock(&bufmgr_gem->timeline_lock);
+}
 
-	bo_gem->reloc_tree_size = size + alignment;
+/*
+ * Records what the kernel told us about a reusable BO, which was last
+ * submitted with @serial, and about the batches before it.
+ */
+static void
+drm_intel_gem_timeline_update(drm_intel_bufmgr_gem *bufmgr_gem,
+			      drm_intel_bo_gem *bo_gem, uint64_t serial,
+			      bool busy)
+{
+	struct drm_intel_gem_timeline *timeline = NULL;
+
+	pthread_mutex_lock(&bufmgr_gem->timeline_lock);
+	/* Don't trust the answer if it raced with another submission. */
+	if (bo_gem->exec_serial == serial) {
+		if (bo_gem->exec_timeline)
+			timeline = drm_intel_gem_timeline_get(bufmgr_gem,
+							      bo_gem->exec_timeline,
+							      false);
+		if (busy && timeline) {
+			uint64_t now = drm_intel_gem_time_ns();
+
+			if (serial < timeline->busy ||
+			    now - timeline->busy_time >=
+			    DRM_INTEL_GEM_BUSY_HINT_NS) {
+				timeline->busy = serial;
+				timeline->busy_time = now;
+			}
+		} else if (!busy) {
+			bo_gem->idle = true;
+			if (timeline && serial > timeline->retired)
+				timeline->retired = serial;
+		}
+	}
+	pthread_mutex_unlock(&bufmgr_gem->timeline_lock);
 }
 
+/*
+ * Returns whether a reusable BO is idle or, for @hint, whether it is
+ * likely to be still busy, without asking the kernel. Returns -1 when
+ * neither is known.
+ */
 static int
-drm_intel_setup_reloc_list(drm_intel_bo *bo)
+drm_intel_gem_bo_known_idle(drm_intel_bufmgr_gem *bufmgr_gem,
+			    drm_intel_bo_gem *bo_gem, bool hint,
+			    uint64_t *serial)
 {
-	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
-	unsigned int max_relocs = bufmgr_gem->max_relocs;
-
-	if (bo->size / 4 < max_relocs)
-		max_relocs = bo->size / 4;
-
-	bo_gem->relocs = malloc(max_relocs *
-				sizeof(struct drm_i915_gem_relocation_entry));
-	bo_gem->reloc_target_info = malloc(max_relocs *
-					   sizeof(drm_intel_reloc_target));
-	if (bo_gem->relocs == NULL || bo_gem->reloc_target_info == NULL) {
-		bo_gem->has_error = true;
-
-		free (bo_gem->relocs);
-		bo_gem->relocs = NULL;
-
-		free (bo_gem->reloc_target_info);
-		bo_gem->reloc_target_info = NULL;
+	struct drm_intel_gem_timeline *timeline = NULL;
+	int known = -1;
 
-		return 1;
+	pthread_mutex_lock(&bufmgr_gem->timeline_lock);
+	*serial = bo_gem->exec_serial;
+	if (bo_gem->idle) {
+		known = 1;
+	} else {
+		if (bo_gem->exec_timeline)
+			timeline = drm_intel_gem_timeline_get(bufmgr_gem,
+							      bo_gem->exec_timeline,
+							      false);
+		if (timeline && bo_gem->exec_serial <= timeline->retired) {
+			bo_gem->idle = true;
+			known = 1;
+		} else if (timeline && hint && timeline->busy_time &&
+			   bo_gem->exec_serial >= timeline->busy &&
+			   drm_intel_gem_time_ns() - timeline->busy_time <
+			   DRM_INTEL_GEM_BUSY_HINT_NS) {
+			known = 0;
+		}
 	}
+	pthread_mutex_unlock(&bufmgr_gem->timeline_lock);
 
-	return 0;
+	return known;
 }
 
+/*
+ * Returns whether the GPU may be accessing a BO. With @hint, a reusable BO
+ * submitted after one which was just seen busy counts as busy too; that
+ * may be stale, which only costs a cache hit.
+ */
 static int
-drm_intel_gem_bo_busy(drm_intel_bo *bo)
+drm_intel_gem_bo_busy_internal(drm_intel_bo *bo, bool hint)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_i915_gem_busy busy;
+	uint64_t serial = 0;
 	int ret;
 
-	if (bo_gem->reusable && bo_gem->idle)
-		return false;
+	if (bo_gem->reusable) {
+		ret = drm_intel_gem_bo_known_idle(bufmgr_gem, bo_gem, hint,
+						  &serial);
+		if (ret != -1)
+			return !ret;
+	}
 
 	memclear(busy);
 	busy.handle = bo_gem->gem_handle;
 
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_BUSY, &busy);
 	if (ret == 0) {
-		bo_gem->idle = !busy.busy;
+		if (bo_gem->reusable)
+			drm_intel_gem_timeline_update(bufmgr_gem, bo_gem,
+						      serial, busy.busy);
 		return busy.busy;
 	} else {
 		return false;
 	}
 }
 
+static int
+drm_intel_gem_bo_busy(drm_intel_bo *bo)
+{
+	return drm_intel_gem_bo_busy_internal(bo, false);
+}
+
 static int
 drm_intel_gem_bo_madvise_internal(drm_intel_bufmgr_gem *bufmgr_gem,
 				  drm_intel_bo_gem *bo_gem, int state)
@@ -668,6 +1507,7 @@ drm_intel_gem_bo_madvise_internal(drm_intel_bufmgr_gem *bufmgr_gem,
 	madv.madv = state;
 	madv.retained = 1;
 	drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_MADVISE, &madv);
+	bo_gem->purgeable = state == I915_MADV_DONTNEED;
 
 	return madv.retained;
 }
@@ -686,6 +1526,11 @@ static void
 drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
 				    struct drm_intel_gem_bo_bucket *bucket)
 {
+	drmMMListHead purged;
+
+	DRMINITLISTHEAD(&purged);
+
+	pthread_mutex_lock(&bucket->lock);
 	while (!DRMLISTEMPTY(&bucket->head)) {
 		drm_intel_bo_gem *bo_gem;
 
@@ -696,8 +1541,239 @@ drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
 			break;
 
 		DRMLISTDEL(&bo_gem->head);
-		drm_intel_gem_bo_free(&bo_gem->bo);
+		DRMLISTADDTAIL(&bo_gem->head, &purged);
+	}
+	pthread_mutex_unlock(&bucket->lock);
+
+	drm_intel_gem_bo_free_list(&purged);
+}
+
+static drm_intel_bo_gem *
+drm_intel_gem_bo_bucket_take(struct drm_intel_gem_bo_bucket *bucket,
+			     bool for_render)
+{
+	drm_intel_bo_gem *bo_gem = NULL;
+
+	pthread_mutex_lock(&bucket->lock);
+	if (!DRMLISTEMPTY(&bucket->head)) {
+		if (for_render) {
+			/* Allocate new render-target BOs from the tail (MRU)
+			 * of the list, as it will likely be hot in the GPU
+			 * cache and in the aperture for us.
+			 */
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+					      bucket->head.prev, head);
+			DRMLISTDEL(&bo_gem->head);
+		} else {
+			/* For non-render-target BOs (where we're probably
+			 * going to map it first thing in order to fill it
+			 * with data), check if the last BO in the cache is
+			 * unbusy, and only reuse in that case. Otherwise,
+			 * allocating a new buffer is probably faster than
+			 * waiting for the GPU to finish.
+			 */
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+					      bucket->head.next, head);
+			if (drm_intel_gem_bo_busy_internal(&bo_gem->bo, true))
+				bo_gem = NULL;
+			else
+				DRMLISTDEL(&bo_gem->head);
+		}
+	}
+	pthread_mutex_unlock(&bucket->lock);
+
+	return bo_gem;
+}
+
+/* Returns the magazine of the calling thread, creating it if @create. */
+static struct drm_intel_gem_bo_magazine *
+drm_intel_gem_bo_magazine_get(drm_intel_bufmgr_gem *bufmgr_gem, bool create)
+{
+	struct drm_intel_gem_bo_magazine *mag;
+
+	if (!bufmgr_gem->has_magazines)
+		return NULL;
+
+	mag = pthread_getspecific(bufmgr_gem->magazine_key);
+	if (mag || !create)
+		return mag;
+
+	mag = calloc(1, sizeof(*mag));
+	if (!mag)
+		return NULL;
+
+	pthread_mutex_init(&mag->lock, NULL);
+	mag->bufmgr_gem = bufmgr_gem;
+	if (pthread_setspecific(bufmgr_gem->magazine_key, mag) != 0) {
+		pthread_mutex_destroy(&mag->lock);
+		free(mag);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&bufmgr_gem->magazine_lock);
+	DRMLISTADDTAIL(&mag->link, &bufmgr_gem->magazines);
+	pthread_mutex_unlock(&bufmgr_gem->magazine_lock);
+
+	return mag;
+}
+
+/* Returns idle BOs taken out of a magazine to their shared buckets. */
+static void
+drm_intel_gem_bo_magazine_spill(drm_intel_bufmgr_gem *bufmgr_gem,
+				drm_intel_bo_gem **bos, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		struct drm_intel_gem_bo_bucket *bucket =
+		    drm_intel_gem_bo_bucket_for_size(bufmgr_gem,
+						     bos[i]->bo.size);
+
+		pthread_mutex_lock(&bucket->lock);
+		DRMLISTADDTAIL(&bos[i]->head, &bucket->head);
+		pthread_mutex_unlock(&bucket->lock);
+	}
+}
+
+/**
+ * Takes a BO of @bucket's size from the calling thread's magazine, with the
+ * same policy as for the shared buckets: the most recently freed one for
+ * render targets, otherwise the oldest one if it is idle.
+ */
+static drm_intel_bo_gem *
+drm_intel_gem_bo_magazine_take(drm_intel_bufmgr_gem *bufmgr_gem,
+			       struct drm_intel_gem_bo_bucket *bucket,
+			       bool for_render)
+{
+	struct drm_intel_gem_bo_magazine *mag;
+	drm_intel_bo_gem *bo_gem = NULL;
+	int i;
+
+	mag = drm_intel_gem_bo_magazine_get(bufmgr_gem, false);
+	if (!mag)
+		return NULL;
+
+	pthread_mutex_lock(&mag->lock);
+	if (for_render) {
+		for (i = mag->count - 1; i >= 0; i--)
+			if (mag->sizes[i] == bucket->size)
+				break;
+	} else {
+		for (i = 0; i < mag->count; i++)
+			if (mag->sizes[i] == bucket->size)
+				break;
+		if (i < mag->count &&
+		    drm_intel_gem_bo_busy_internal(&mag->bos[i]->bo, true))
+			i = mag->count;
+	}
+	if (i >= 0 && i < mag->count) {
+		bo_gem = mag->bos[i];
+		mag->count--;
+		memmove(&mag->bos[i], &mag->bos[i + 1],
+			(mag->count - i) * sizeof(mag->bos[0]));
+		memmove(&mag->sizes[i], &mag->sizes[i + 1],
+			(mag->count - i) * sizeof(mag->sizes[0]));
+	}
+	pthread_mutex_unlock(&mag->lock);
+
+	return bo_gem;
+}
+
+/**
+ * Puts an idle BO into the calling thread's magazine, moving the older
+ * half of a full magazine to the shared buckets. Returns false if the
+ * thread has no magazine.
+ */
+static bool
+drm_intel_gem_bo_magazine_put(drm_intel_bufmgr_gem *bufmgr_gem,
+			      drm_intel_bo_gem *bo_gem)
+{
+	drm_intel_bo_gem *spilled[DRM_INTEL_GEM_MAGAZINE_SIZE / 2];
+	struct drm_intel_gem_bo_magazine *mag;
+	int count = 0;
+
+	mag = drm_intel_gem_bo_magazine_get(bufmgr_gem, true);
+	if (!mag)
+		return false;
+
+	pthread_mutex_lock(&mag->lock);
+	if (mag->count == DRM_INTEL_GEM_MAGAZINE_SIZE) {
+		count = ARRAY_SIZE(spilled);
+		memcpy(spilled, mag->bos, sizeof(spilled));
+		mag->count -= count;
+		memmove(&mag->bos[0], &mag->bos[count],
+			mag->count * sizeof(mag->bos[0]));
+		memmove(&mag->sizes[0], &mag->sizes[count],
+			mag->count * sizeof(mag->sizes[0]));
+	}
+	mag->sizes[mag->count] = bo_gem->bo.size;
+	mag->bos[mag->count++] = bo_gem;
+	pthread_mutex_unlock(&mag->lock);
+
+	drm_intel_gem_bo_magazine_spill(bufmgr_gem, spilled, count);
+	return true;
+}
+
+/* Thread exit: hand the magazine's BOs over to the shared buckets. */
+static void
+drm_intel_gem_bo_magazine_destroy(void *data)
+{
+	struct drm_intel_gem_bo_magazine *mag = data;
+	drm_intel_bufmgr_gem *bufmgr_gem = mag->bufmgr_gem;
+
+	pthread_mutex_lock(&bufmgr_gem->magazine_lock);
+	DRMLISTDEL(&mag->link);
+	pthread_mutex_unlock(&bufmgr_gem->magazine_lock);
+
+	drm_intel_gem_bo_magazine_spill(bufmgr_gem, mag->bos, mag->count);
+	pthread_mutex_destroy(&mag->lock);
+	free(mag);
+}
+
+/**
+ * Gives @bo_gem its softpin offset out of the heap, unless the one it got
+ * before suits @alignment already. Returns 0, or -ENOSPC when the heap is
+ * full.
+ */
+static int
+drm_intel_gem_bo_place(drm_intel_bufmgr_gem *bufmgr_gem,
+		       drm_intel_bo_gem *bo_gem, unsigned int alignment)
+{
+	struct mem_block *block = bo_gem->softpin_block;
+	int align2 = 0;
+
+	if (!bufmgr_gem->softpin_heap)
+		return 0;
+
+	while (align2 < 30 &&
+	       (1ul << (align2 + DRM_INTEL_GEM_SOFTPIN_PAGE_SHIFT)) < alignment)
+		align2++;
+
+	if (!block || (block->ofs & ((1 << align2) - 1))) {
+		int pages = (bo_gem->bo.size +
+			     (1ul << DRM_INTEL_GEM_SOFTPIN_PAGE_SHIFT) - 1) >>
+			DRM_INTEL_GEM_SOFTPIN_PAGE_SHIFT;
+
+		pthread_mutex_lock(&bufmgr_gem->softpin_lock);
+		if (block)
+			mmFreeMem(block);
+		block = mmAllocMem(bufmgr_gem->softpin_heap, pages, align2, 0);
+		pthread_mutex_unlock(&bufmgr_gem->softpin_lock);
+
+		bo_gem->softpin_block = block;
+		if (!block) {
+			DBG("bo_place: no room for %d (%s)\n",
+			    bo_gem->gem_handle, bo_gem->name);
+			return -ENOSPC;
+		}
 	}
+
+	bo_gem->bo.offset64 = (uint64_t)block->ofs <<
+		DRM_INTEL_GEM_SOFTPIN_PAGE_SHIFT;
+	bo_gem->bo.offset = bo_gem->bo.offset64;
+	bo_gem->kflags |= bufmgr_gem->softpin_kflags;
+
+	return 0;
 }
 
 static drm_intel_bo *
@@ -735,53 +1811,36 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 		bo_size = bucket->size;
 	}
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
 	/* Get a buffer out of the cache if available */
 retry:
 	alloc_from_cache = false;
-	if (bucket != NULL && !DRMLISTEMPTY(&bucket->head)) {
-		if (for_render) {
-			/* Allocate new render-target BOs from the tail (MRU)
-			 * of the list, as it will likely be hot in the GPU
-			 * cache and in the aperture for us.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.prev, head);
-			DRMLISTDEL(&bo_gem->head);
+	if (bucket != NULL) {
+		assert(for_render || alignment == 0);
+		bo_gem = drm_intel_gem_bo_magazine_take(bufmgr_gem, bucket,
+							for_render);
+		if (!bo_gem)
+			bo_gem = drm_intel_gem_bo_bucket_take(bucket, for_render);
+		if (bo_gem) {
 			alloc_from_cache = true;
-			bo_gem->bo.align = alignment;
-		} else {
-			assert(alignment == 0);
-			/* For non-render-target BOs (where we're probably
-			 * going to map it first thing in order to fill it
-			 * with data), check if the last BO in the cache is
-			 * unbusy, and only reuse in that case. Otherwise,
-			 * allocating a new buffer is probably faster than
-			 * waiting for the GPU to finish.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			if (!drm_intel_gem_bo_busy(&bo_gem->bo)) {
-				alloc_from_cache = true;
-				DRMLISTDEL(&bo_gem->head);
-			}
+			if (for_render)
+				bo_gem->bo.align = alignment;
 		}
+	}
 
-		if (alloc_from_cache) {
-			if (!drm_intel_gem_bo_madvise_internal
-			    (bufmgr_gem, bo_gem, I915_MADV_WILLNEED)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				drm_intel_gem_bo_cache_purge_bucket(bufmgr_gem,
-								    bucket);
-				goto retry;
-			}
+	if (alloc_from_cache) {
+		if (bo_gem->purgeable && !drm_intel_gem_bo_madvise_internal
+		    (bufmgr_gem, bo_gem, I915_MADV_WILLNEED)) {
+			drm_intel_gem_bo_free(&bo_gem->bo);
+			drm_intel_gem_bo_cache_purge_bucket(bufmgr_gem,
+							    bucket);
+			goto retry;
+		}
 
-			if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
-								 tiling_mode,
-								 stride)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				goto retry;
-			}
+		if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
+							 tiling_mode,
+							 stride)) {
+			drm_intel_gem_bo_free(&bo_gem->bo);
+			goto retry;
 		}
 	}
 
@@ -794,7 +1853,7 @@ retry:
 
 		/* drm_intel_gem_bo_free calls DRMLISTDEL() for an uninitialized
 		   list (vma_list), so better set the list head here */
-		DRMINITLISTHEAD(&bo_gem->vma_list);
+		drm_intel_gem_bo_init_vma(bo_gem);
 
 		bo_gem->bo.size = bo_size;
 
@@ -810,9 +1869,11 @@ retry:
 		}
 
 		bo_gem->gem_handle = create.handle;
+		pthread_mutex_lock(&bufmgr_gem->table_lock);
 		HASH_ADD(handle_hh, bufmgr_gem->handle_table,
 			 gem_handle, sizeof(bo_gem->gem_handle),
 			 bo_gem);
+		pthread_mutex_unlock(&bufmgr_gem->table_lock);
 
 		bo_gem->bo.handle = bo_gem->gem_handle;
 		bo_gem->bo.bufmgr = bufmgr;
@@ -830,14 +1891,15 @@ retry:
 
 	bo_gem->name = name;
 	atomic_set(&bo_gem->refcount, 1);
-	bo_gem->validate_index = -1;
 	bo_gem->reloc_tree_fences = 0;
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->has_error = false;
 	bo_gem->reusable = true;
 
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, alignment);
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	if (drm_intel_gem_bo_place(bufmgr_gem, bo_gem, alignment))
+		goto err_free;
 
 	DBG("bo_create: buf %d (%s) %ldb\n",
 	    bo_gem->gem_handle, bo_gem->name, size);
@@ -847,7 +1909,6 @@ retry:
 err_free:
 	drm_intel_gem_bo_free(&bo_gem->bo);
 err:
-	pthread_mutex_unlock(&bufmgr_gem->lock);
 	return NULL;
 }
 
@@ -950,7 +2011,7 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 		return NULL;
 
 	atomic_set(&bo_gem->refcount, 1);
-	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_gem_bo_init_vma(bo_gem);
 
 	bo_gem->bo.size = size;
 
@@ -970,8 +2031,6 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 		return NULL;
 	}
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
-
 	bo_gem->gem_handle = userptr.handle;
 	bo_gem->bo.handle = bo_gem->gem_handle;
 	bo_gem->bo.bufmgr    = bufmgr;
@@ -983,19 +2042,24 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 	bo_gem->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
 	bo_gem->stride       = 0;
 
-	HASH_ADD(handle_hh, bufmgr_gem->handle_table,
-		 gem_handle, sizeof(bo_gem->gem_handle),
-		 bo_gem);
-
 	bo_gem->name = name;
-	bo_gem->validate_index = -1;
 	bo_gem->reloc_tree_fences = 0;
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->has_error = false;
 	bo_gem->reusable = false;
 
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	pthread_mutex_lock(&bufmgr_gem->table_lock);
+	HASH_ADD(handle_hh, bufmgr_gem->handle_table,
+		 gem_handle, sizeof(bo_gem->gem_handle),
+		 bo_gem);
+	pthread_mutex_unlock(&bufmgr_gem->table_lock);
+
+	if (drm_intel_gem_bo_place(bufmgr_gem, bo_gem, 0)) {
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		return NULL;
+	}
 
 	DBG("bo_create_userptr: "
 	    "ptr %p buf %d (%s) size %ldb, stride 0x%x, tile mode %d\n",
@@ -1113,7 +2177,7 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 	 * alternating names for the front/back buffer a linear search
 	 * provides a sufficiently fast match.
 	 */
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bufmgr_gem->table_lock);
 	HASH_FIND(name_hh, bufmgr_gem->name_table,
 		  &handle, sizeof(handle), bo_gem);
 	if (bo_gem) {
@@ -1148,7 +2212,7 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 		goto out;
 
 	atomic_set(&bo_gem->refcount, 1);
-	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_gem_bo_init_vma(bo_gem);
 
 	bo_gem->bo.size = open_arg.size;
 	bo_gem->bo.offset = 0;
@@ -1156,7 +2220,6 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 	bo_gem->bo.virtual = NULL;
 	bo_gem->bo.bufmgr = bufmgr;
 	bo_gem->name = name;
-	bo_gem->validate_index = -1;
 	bo_gem->gem_handle = open_arg.handle;
 	bo_gem->bo.handle = open_arg.handle;
 	bo_gem->global_name = handle;
@@ -1174,45 +2237,67 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 
 	/* XXX stride is unknown */
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
+	if (drm_intel_gem_bo_place(bufmgr_gem, bo_gem, 0))
+		goto err_unref;
 	DBG("bo_create_from_handle: %d (%s)\n", handle, bo_gem->name);
 
 out:
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bufmgr_gem->table_lock);
 	return &bo_gem->bo;
 
 err_unref:
-	drm_intel_gem_bo_free(&bo_gem->bo);
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	drm_intel_gem_bo_unlink(bufmgr_gem, bo_gem);
+	pthread_mutex_unlock(&bufmgr_gem->table_lock);
+	drm_intel_gem_bo_release(&bo_gem->bo);
 	return NULL;
 }
 
+/* Drops @bo_gem from the name and handle tables; table_lock must be held. */
 static void
-drm_intel_gem_bo_free(drm_intel_bo *bo)
+drm_intel_gem_bo_unlink(drm_intel_bufmgr_gem *bufmgr_gem,
+			drm_intel_bo_gem *bo_gem)
+{
+	if (bo_gem->global_name)
+		HASH_DELETE(name_hh, bufmgr_gem->name_table, bo_gem);
+	HASH_DELETE(handle_hh, bufmgr_gem->handle_table, bo_gem);
+}
+
+/* Unmaps an unused mapping; vma_lock must be held. */
+static void
+drm_intel_gem_bo_unmap_vma(drm_intel_bufmgr_gem *bufmgr_gem,
+			   drm_intel_bo_gem *bo_gem, int type)
+{
+	struct drm_intel_gem_vma_stats *stats =
+	    &bufmgr_gem->vma_cache[type].stats;
+	void **virtual = drm_intel_gem_bo_vma(bo_gem, type);
+
+#if HAVE_VALGRIND
+	if (type != DRM_INTEL_GEM_VMA_GTT)
+		VALGRIND_FREELIKE_BLOCK(*virtual, 0);
+#endif
+	drm_munmap(*virtual, bo_gem->bo.size);
+	*virtual = NULL;
+
+	DRMLISTDELINIT(&bo_gem->vma_list[type]);
+	stats->cached_bytes -= bo_gem->bo.size;
+	stats->mapped_bytes -= bo_gem->bo.size;
+	bufmgr_gem->vma_count--;
+}
+
+/* Closes and frees a buffer that is no longer in the lookup tables. */
+static void
+drm_intel_gem_bo_release(drm_intel_bo *bo)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_gem_close close;
-	int ret;
-
-	DRMLISTDEL(&bo_gem->vma_list);
-	if (bo_gem->mem_virtual) {
-		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->mem_virtual, 0));
-		drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
-		bufmgr_gem->vma_count--;
-	}
-	if (bo_gem->wc_virtual) {
-		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->wc_virtual, 0));
-		drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
-		bufmgr_gem->vma_count--;
-	}
-	if (bo_gem->gtt_virtual) {
-		drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
-		bufmgr_gem->vma_count--;
-	}
+	int ret, type;
 
-	if (bo_gem->global_name)
-		HASH_DELETE(name_hh, bufmgr_gem->name_table, bo_gem);
-	HASH_DELETE(handle_hh, bufmgr_gem->handle_table, bo_gem);
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
+	for (type = 0; type < DRM_INTEL_GEM_VMA_TYPES; type++)
+		if (*drm_intel_gem_bo_vma(bo_gem, type))
+			drm_intel_gem_bo_unmap_vma(bufmgr_gem, bo_gem, type);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 
 	/* Close this object */
 	memclear(close);
@@ -1222,9 +2307,40 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 		DBG("DRM_IOCTL_GEM_CLOSE %d failed (%s): %s\n",
 		    bo_gem->gem_handle, bo_gem->name, strerror(errno));
 	}
+
+	if (bo_gem->softpin_block) {
+		pthread_mutex_lock(&bufmgr_gem->softpin_lock);
+		mmFreeMem(bo_gem->softpin_block);
+		pthread_mutex_unlock(&bufmgr_gem->softpin_lock);
+	}
 	free(bo);
 }
 
+static void
+drm_intel_gem_bo_free(drm_intel_bo *bo)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->table_lock);
+	drm_intel_gem_bo_unlink(bufmgr_gem, (drm_intel_bo_gem *) bo);
+	pthread_mutex_unlock(&bufmgr_gem->table_lock);
+
+	drm_intel_gem_bo_release(bo);
+}
+
+/* Frees buffers taken off the cache buckets, without holding any lock. */
+static void
+drm_intel_gem_bo_free_list(drmMMListHead *list)
+{
+	while (!DRMLISTEMPTY(list)) {
+		drm_intel_bo_gem *bo_gem;
+
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem, list->next, head);
+		DRMLISTDEL(&bo_gem->head);
+		drm_intel_gem_bo_free(&bo_gem->bo);
+	}
+}
+
 static void
 drm_intel_gem_bo_mark_mmaps_incoherent(drm_intel_bo *bo)
 {
@@ -1246,102 +2362,188 @@ drm_intel_gem_bo_mark_mmaps_incoherent(drm_intel_bo *bo)
 static void
 drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
 {
+	struct drm_intel_gem_bo_magazine *mag;
+	drmMMListHead expired;
 	int i;
 
-	if (bufmgr_gem->time == time)
+	pthread_mutex_lock(&bufmgr_gem->cache_lock);
+	if (bufmgr_gem->time == time) {
+		pthread_mutex_unlock(&bufmgr_gem->cache_lock);
 		return;
+	}
+	bufmgr_gem->time = time;
+	pthread_mutex_unlock(&bufmgr_gem->cache_lock);
+
+	DRMINITLISTHEAD(&expired);
+
+	pthread_mutex_lock(&bufmgr_gem->magazine_lock);
+	DRMLISTFOREACHENTRY(mag, &bufmgr_gem->magazines, link) {
+		int j, kept = 0;
+
+		pthread_mutex_lock(&mag->lock);
+		for (j = 0; j < mag->count; j++) {
+			drm_intel_bo_gem *bo_gem = mag->bos[j];
+
+			if (time - bo_gem->free_time <= 1) {
+				mag->sizes[kept] = mag->sizes[j];
+				mag->bos[kept++] = bo_gem;
+			} else
+				DRMLISTADDTAIL(&bo_gem->head, &expired);
+		}
+		mag->count = kept;
+		pthread_mutex_unlock(&mag->lock);
+	}
+	pthread_mutex_unlock(&bufmgr_gem->magazine_lock);
 
 	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
 		struct drm_intel_gem_bo_bucket *bucket =
 		    &bufmgr_gem->cache_bucket[i];
+		drm_intel_bo_gem *bo_gem, *next;
 
+		pthread_mutex_lock(&bucket->lock);
 		while (!DRMLISTEMPTY(&bucket->head)) {
-			drm_intel_bo_gem *bo_gem;
-
 			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
 					      bucket->head.next, head);
 			if (time - bo_gem->free_time <= 1)
 				break;
 
 			DRMLISTDEL(&bo_gem->head);
+			DRMLISTADDTAIL(&bo_gem->head, &expired);
+		}
 
-			drm_intel_gem_bo_free(&bo_gem->bo);
+		/* Let the kernel reclaim what has been unused for a while. */
+		DRMLISTFOREACHENTRYSAFE(bo_gem, next, &bucket->head, head) {
+			if (bo_gem->purgeable || time == bo_gem->free_time)
+				continue;
+			if (!drm_intel_gem_bo_madvise_internal
+			    (bufmgr_gem, bo_gem, I915_MADV_DONTNEED)) {
+				DRMLISTDEL(&bo_gem->head);
+				DRMLISTADDTAIL(&bo_gem->head, &expired);
+			}
 		}
+		pthread_mutex_unlock(&bucket->lock);
 	}
 
-	bufmgr_gem->time = time;
+	drm_intel_gem_bo_free_list(&expired);
 }
 
 static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 {
-	int limit;
+	uint64_t cached = 0, mapped = 0;
+	int64_t limit_bytes = INT64_MAX;
+	int limit = INT_MAX;
+	int type;
 
-	DBG("%s: cached=%d, open=%d, limit=%d\n", __FUNCTION__,
-	    bufmgr_gem->vma_count, bufmgr_gem->vma_open, bufmgr_gem->vma_max);
+	DBG("%s: cached=%d, open=%d, limit=%d, limit_bytes=%lld\n",
+	    __FUNCTION__, bufmgr_gem->vma_count, bufmgr_gem->vma_open,
+	    bufmgr_gem->vma_max, (long long)bufmgr_gem->vma_max_bytes);
 
-	if (bufmgr_gem->vma_max < 0)
+	if (bufmgr_gem->vma_max < 0 && bufmgr_gem->vma_max_bytes < 0)
 		return;
 
 	/* We may need to evict a few entries in order to create new mmaps */
-	limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
-	if (limit < 0)
-		limit = 0;
+	if (bufmgr_gem->vma_max >= 0) {
+		limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
+		if (limit < 0)
+			limit = 0;
+	}
 
-	while (bufmgr_gem->vma_count > limit) {
-		drm_intel_bo_gem *bo_gem;
+	for (type = 0; type < DRM_INTEL_GEM_VMA_TYPES; type++) {
+		cached += bufmgr_gem->vma_cache[type].stats.cached_bytes;
+		mapped += bufmgr_gem->vma_cache[type].stats.mapped_bytes;
+	}
+	if (bufmgr_gem->vma_max_bytes >= 0) {
+		limit_bytes = bufmgr_gem->vma_max_bytes - (mapped - cached);
+		if (limit_bytes < 0)
+			limit_bytes = 0;
+	}
 
-		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-				      bufmgr_gem->vma_cache.next,
-				      vma_list);
-		assert(bo_gem->map_count == 0);
-		DRMLISTDELINIT(&bo_gem->vma_list);
-
-		if (bo_gem->mem_virtual) {
-			drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
-			bo_gem->mem_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
-		if (bo_gem->wc_virtual) {
-			drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
-			bo_gem->wc_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
-		if (bo_gem->gtt_virtual) {
-			drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
-			bo_gem->gtt_virtual = NULL;
-			bufmgr_gem->vma_count--;
+	/* Evict the least recently used mapping of any kind. */
+	while (bufmgr_gem->vma_count > limit ||
+	       cached > (uint64_t)limit_bytes) {
+		drm_intel_bo_gem *bo_gem = NULL;
+		int victim = -1;
+
+		for (type = 0; type < DRM_INTEL_GEM_VMA_TYPES; type++) {
+			drmMMListHead *lru = &bufmgr_gem->vma_cache[type].lru;
+			drm_intel_bo_gem *oldest;
+
+			if (DRMLISTEMPTY(lru))
+				continue;
+			oldest = DRMLISTENTRY(drm_intel_bo_gem, lru->next,
+					      vma_list[type]);
+			if (!bo_gem || oldest->vma_stamp < bo_gem->vma_stamp) {
+				bo_gem = oldest;
+				victim = type;
+			}
 		}
+		assert(bo_gem && bo_gem->map_count == 0);
+
+		cached -= bo_gem->bo.size;
+		bufmgr_gem->vma_cache[victim].stats.evictions++;
+		drm_intel_gem_bo_unmap_vma(bufmgr_gem, bo_gem, victim);
 	}
 }
 
 static void drm_intel_gem_bo_close_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 				       drm_intel_bo_gem *bo_gem)
 {
+	int type;
+
 	bufmgr_gem->vma_open--;
-	DRMLISTADDTAIL(&bo_gem->vma_list, &bufmgr_gem->vma_cache);
-	if (bo_gem->mem_virtual)
-		bufmgr_gem->vma_count++;
-	if (bo_gem->wc_virtual)
-		bufmgr_gem->vma_count++;
-	if (bo_gem->gtt_virtual)
+	bo_gem->vma_stamp = ++bufmgr_gem->vma_stamp;
+	for (type = 0; type < DRM_INTEL_GEM_VMA_TYPES; type++) {
+		struct drm_intel_gem_vma_cache *cache =
+		    &bufmgr_gem->vma_cache[type];
+
+		if (!*drm_intel_gem_bo_vma(bo_gem, type))
+			continue;
+		DRMLISTADDTAIL(&bo_gem->vma_list[type], &cache->lru);
+		cache->stats.cached_bytes += bo_gem->bo.size;
 		bufmgr_gem->vma_count++;
+	}
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
 static void drm_intel_gem_bo_open_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 				      drm_intel_bo_gem *bo_gem)
 {
+	int type;
+
 	bufmgr_gem->vma_open++;
-	DRMLISTDEL(&bo_gem->vma_list);
-	if (bo_gem->mem_virtual)
-		bufmgr_gem->vma_count--;
-	if (bo_gem->wc_virtual)
-		bufmgr_gem->vma_count--;
-	if (bo_gem->gtt_virtual)
+	for (type = 0; type < DRM_INTEL_GEM_VMA_TYPES; type++) {
+		struct drm_intel_gem_vma_cache *cache =
+		    &bufmgr_gem->vma_cache[type];
+
+		if (!*drm_intel_gem_bo_vma(bo_gem, type))
+			continue;
+		DRMLISTDELINIT(&bo_gem->vma_list[type]);
+		cache->stats.cached_bytes -= bo_gem->bo.size;
 		bufmgr_gem->vma_count--;
+	}
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
+/*
+ * Accounts for a map of an open BO, which needed a new mapping of @type
+ * unless it was a @hit.
+ */
+static void drm_intel_gem_bo_use_vma(drm_intel_bufmgr_gem *bufmgr_gem,
+				     drm_intel_bo_gem *bo_gem, int type,
+				     bool hit)
+{
+	struct drm_intel_gem_vma_stats *stats =
+	    &bufmgr_gem->vma_cache[type].stats;
+
+	if (hit) {
+		stats->hits++;
+	} else {
+		stats->misses++;
+		stats->mapped_bytes += bo_gem->bo.size;
+		drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	}
+}
+
 static void
 drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 {
@@ -1351,20 +2553,23 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 	int i;
 
 	/* Unreference all the target buffers */
-	for (i = 0; i < bo_gem->reloc_count; i++) {
-		if (bo_gem->reloc_target_info[i].bo != bo) {
-			drm_intel_gem_bo_unreference_locked_timed(bo_gem->
-								  reloc_target_info[i].bo,
-								  time);
+	for (i = 0; i < bo_gem->target_count; i++) {
+		if (bo_gem->targets[i].flags & DRM_INTEL_TARGET_RELOC &&
+		    bo_gem->targets[i].bo != bo) {
+			drm_intel_gem_bo_unreference_timed(bo_gem->targets[i].bo,
+							   time);
 		}
 	}
 	for (i = 0; i < bo_gem->softpin_target_count; i++)
-		drm_intel_gem_bo_unreference_locked_timed(bo_gem->softpin_target[i],
-								  time);
-	bo_gem->kflags = 0;
+		drm_intel_gem_bo_unreference_timed(bo_gem->softpin_target[i],
+						   time);
+	bo_gem->kflags = bo_gem->softpin_block ? bufmgr_gem->softpin_kflags : 0;
 	bo_gem->reloc_count = 0;
 	bo_gem->used_as_reloc_target = false;
+	bo_gem->in_reloc_tree = false;
+	bo_gem->needs_relocs = false;
 	bo_gem->softpin_target_count = 0;
+	drm_intel_gem_bo_clear_targets(bo_gem);
 
 	DBG("bo_unreference final: %d (%s)\n",
 	    bo_gem->gem_handle, bo_gem->name);
@@ -1387,35 +2592,81 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 	/* Clear any left-over mappings */
 	if (bo_gem->map_count) {
 		DBG("bo freed with non-zero map-count %d\n", bo_gem->map_count);
+		pthread_mutex_lock(&bufmgr_gem->vma_lock);
 		bo_gem->map_count = 0;
 		drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
+		pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 	}
 
+	if (!bo_gem->reusable) {
+		/* Already dropped from the lookup tables by the last unref. */
+		drm_intel_gem_bo_release(bo);
+		return;
+	}
+
 	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, bo->size);
-	/* Put the buffer into our internal cache for reuse if we can. */
-	if (bufmgr_gem->bo_reuse && bo_gem->reusable && bucket != NULL &&
-	    drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
-					      I915_MADV_DONTNEED)) {
-		bo_gem->free_time = time;
+	if (!bufmgr_gem->bo_reuse || bucket == NULL) {
+		drm_intel_gem_bo_free(bo);
+		return;
+	}
 
-		bo_gem->name = NULL;
-		bo_gem->validate_index = -1;
+	/* Put the buffer into our internal cache for reuse if we can. Small
+	 * ones are left to drm_intel_gem_cleanup_bo_cache() to madvise.
+	 */
+	if (bo->size > DRM_INTEL_GEM_LAZY_MADVISE_MAX_SIZE &&
+	    !drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
+					       I915_MADV_DONTNEED)) {
+		drm_intel_gem_bo_free(bo);
+		return;
+	}
 
+	bo_gem->free_time = time;
+	bo_gem->name = NULL;
+
+	if (!drm_intel_gem_bo_magazine_put(bufmgr_gem, bo_gem)) {
+		pthread_mutex_lock(&bucket->lock);
 		DRMLISTADDTAIL(&bo_gem->head, &bucket->head);
+		pthread_mutex_unlock(&bucket->lock);
+	}
+}
+
+/*
+ * Drops the last reference to @bo. A reusable buffer has never been flinked
+ * or exported, so no import can find it in the tables and the count can
+ * simply hit zero. A shared one is dropped from the tables under table_lock
+ * together with its last reference, so that an import racing with us either
+ * takes a new reference first or does not find it at all.
+ */
+static bool drm_intel_gem_bo_unreference_last(drm_intel_bo *bo, time_t time)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	bool last;
+
+	if (bo_gem->reusable) {
+		last = atomic_dec_and_test(&bo_gem->refcount);
 	} else {
-		drm_intel_gem_bo_free(bo);
+		pthread_mutex_lock(&bufmgr_gem->table_lock);
+		last = atomic_dec_and_test(&bo_gem->refcount);
+		if (last)
+			drm_intel_gem_bo_unlink(bufmgr_gem, bo_gem);
+		pthread_mutex_unlock(&bufmgr_gem->table_lock);
 	}
+
+	if (last)
+		drm_intel_gem_bo_unreference_final(bo, time);
+
+	return last;
 }
 
-static void drm_intel_gem_bo_unreference_locked_timed(drm_intel_bo *bo,
-						      time_t time)
+static void drm_intel_gem_bo_unreference_timed(drm_intel_bo *bo, time_t time)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
 	assert(atomic_read(&bo_gem->refcount) > 0);
-	if (atomic_dec_and_test(&bo_gem->refcount))
-		drm_intel_gem_bo_unreference_final(bo, time);
+	if (atomic_add_unless(&bo_gem->refcount, -1, 1))
+		drm_intel_gem_bo_unreference_last(bo, time);
 }
 
 static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
@@ -1431,14 +2682,8 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
 
 		clock_gettime(CLOCK_MONOTONIC, &time);
 
-		pthread_mutex_lock(&bufmgr_gem->lock);
-
-		if (atomic_dec_and_test(&bo_gem->refcount)) {
-			drm_intel_gem_bo_unreference_final(bo, time.tv_sec);
+		if (drm_intel_gem_bo_unreference_last(bo, time.tv_sec))
 			drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time.tv_sec);
-		}
-
-		pthread_mutex_unlock(&bufmgr_gem->lock);
 	}
 }
 
@@ -1455,7 +2700,7 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 		return 0;
 	}
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 
 	if (bo_gem->map_count++ == 0)
 		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
@@ -1479,16 +2724,27 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 			    bo_gem->name, strerror(errno));
 			if (--bo_gem->map_count == 0)
 				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
-			pthread_mutex_unlock(&bufmgr_gem->lock);
+			pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 			return ret;
 		}
 		VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 		bo_gem->mem_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+		drm_intel_gem_bo_use_vma(bufmgr_gem, bo_gem,
+					 DRM_INTEL_GEM_VMA_CPU, false);
+	} else {
+		drm_intel_gem_bo_use_vma(bufmgr_gem, bo_gem,
+					 DRM_INTEL_GEM_VMA_CPU, true);
 	}
 	DBG("bo_map: %d (%s) -> %p\n", bo_gem->gem_handle, bo_gem->name,
 	    bo_gem->mem_virtual);
 	bo->virtual = bo_gem->mem_virtual;
 
+	if (write_enable)
+		bo_gem->mapped_cpu_write = true;
+
+	/* The mapping is held now; don't stall other mappers on the GPU. */
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+
 	memclear(set_domain);
 	set_domain.handle = bo_gem->gem_handle;
 	set_domain.read_domains = I915_GEM_DOMAIN_CPU;
@@ -1505,12 +2761,8 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 		    strerror(errno));
 	}
 
-	if (write_enable)
-		bo_gem->mapped_cpu_write = true;
-
 	drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 	VG(VALGRIND_MAKE_MEM_DEFINED(bo_gem->mem_virtual, bo->size));
-	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	return 0;
 }
@@ -1568,6 +2820,11 @@ map_gtt(drm_intel_bo *bo)
 				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
 			return ret;
 		}
+		drm_intel_gem_bo_use_vma(bufmgr_gem, bo_gem,
+					 DRM_INTEL_GEM_VMA_GTT, false);
+	} else {
+		drm_intel_gem_bo_use_vma(bufmgr_gem, bo_gem,
+					 DRM_INTEL_GEM_VMA_GTT, true);
 	}
 
 	bo->virtual = bo_gem->gtt_virtual;
@@ -1586,13 +2843,11 @@ drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
 	struct drm_i915_gem_set_domain set_domain;
 	int ret;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
-
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 	ret = map_gtt(bo);
-	if (ret) {
-		pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+	if (ret)
 		return ret;
-	}
 
 	/* Now move it to the GTT domain so that the GPU and CPU
 	 * caches are flushed and the GPU isn't actively using the
@@ -1618,7 +2873,6 @@ drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
 
 	drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 	VG(VALGRIND_MAKE_MEM_DEFINED(bo_gem->gtt_virtual, bo->size));
-	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	return 0;
 }
@@ -1656,7 +2910,7 @@ drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo)
 	if (!bufmgr_gem->has_llc)
 		return drm_intel_gem_bo_map_gtt(bo);
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 
 	ret = map_gtt(bo);
 	if (ret == 0) {
@@ -1664,7 +2918,7 @@ drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo)
 		VG(VALGRIND_MAKE_MEM_DEFINED(bo_gem->gtt_virtual, bo->size));
 	}
 
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 
 	return ret;
 }
@@ -1683,11 +2937,11 @@ static int drm_intel_gem_bo_unmap(drm_intel_bo *bo)
 
 	bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 
 	if (bo_gem->map_count <= 0) {
 		DBG("attempted to unmap an unmapped bo\n");
-		pthread_mutex_unlock(&bufmgr_gem->lock);
+		pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 		/* Preserve the old behaviour of just treating this as a
 		 * no-op rather than reporting the error.
 		 */
@@ -1721,7 +2975,7 @@ static int drm_intel_gem_bo_unmap(drm_intel_bo *bo)
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 		bo->virtual = NULL;
 	}
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 
 	return ret;
 }
@@ -1945,6 +3199,7 @@ drm_intel_gem_bo_wait(drm_intel_bo *bo, int64_t timeout_ns)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_i915_gem_wait wait;
+	uint64_t serial;
 	int ret;
 
 	if (!bufmgr_gem->has_wait_timeout) {
@@ -1961,10 +3216,18 @@ drm_intel_gem_bo_wait(drm_intel_bo *bo, int64_t timeout_ns)
 	memclear(wait);
 	wait.bo_handle = bo_gem->gem_handle;
 	wait.timeout_ns = timeout_ns;
+	pthread_mutex_lock(&bufmgr_gem->timeline_lock);
+	serial = bo_gem->exec_serial;
+	pthread_mutex_unlock(&bufmgr_gem->timeline_lock);
+
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_WAIT, &wait);
 	if (ret == -1)
 		return -errno;
 
+	if (bo_gem->reusable)
+		drm_intel_gem_timeline_update(bufmgr_gem, bo_gem, serial,
+					      false);
+
 	return ret;
 }
 
@@ -2002,14 +3265,30 @@ static void
 drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	struct drm_intel_gem_exec_state *exec;
 	struct drm_gem_close close_bo;
 	int i, ret;
 
-	free(bufmgr_gem->exec2_objects);
-	free(bufmgr_gem->exec_objects);
-	free(bufmgr_gem->exec_bos);
+	while ((exec = bufmgr_gem->exec_states) != NULL) {
+		bufmgr_gem->exec_states = exec->next;
+		drm_intel_gem_exec_state_free(exec);
+	}
 
-	pthread_mutex_destroy(&bufmgr_gem->lock);
+	/* No thread exit may touch the magazines from here on. */
+	if (bufmgr_gem->has_magazines)
+		pthread_key_delete(bufmgr_gem->magazine_key);
+	while (!DRMLISTEMPTY(&bufmgr_gem->magazines)) {
+		struct drm_intel_gem_bo_magazine *mag;
+
+		mag = DRMLISTENTRY(struct drm_intel_gem_bo_magazine,
+				   bufmgr_gem->magazines.next, link);
+		DRMLISTDEL(&mag->link);
+		for (i = 0; i < mag->count; i++)
+			drm_intel_gem_bo_free(&mag->bos[i]->bo);
+		pthread_mutex_destroy(&mag->lock);
+		free(mag);
+	}
+	pthread_mutex_destroy(&bufmgr_gem->magazine_lock);
 
 	/* Free any cached buffer objects we were going to reuse */
 	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
@@ -2024,8 +3303,18 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 
 			drm_intel_gem_bo_free(&bo_gem->bo);
 		}
+		pthread_mutex_destroy(&bucket->lock);
 	}
 
+	pthread_mutex_destroy(&bufmgr_gem->exec_lock);
+	pthread_mutex_destroy(&bufmgr_gem->cache_lock);
+	pthread_mutex_destroy(&bufmgr_gem->table_lock);
+	pthread_mutex_destroy(&bufmgr_gem->vma_lock);
+	pthread_mutex_destroy(&bufmgr_gem->timeline_lock);
+
+	mmDestroy(bufmgr_gem->softpin_heap);
+	pthread_mutex_destroy(&bufmgr_gem->softpin_lock);
+
 	/* Release userptr bo kept hanging around for optimisation. */
 	if (bufmgr_gem->userptr_active.ptr) {
 		memclear(close_bo);
@@ -2060,6 +3349,7 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
 	bool fenced_command;
+	int ret;
 
 	if (bo_gem->has_error)
 		return -ENOMEM;
@@ -2100,6 +3390,22 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	 * already been accounted for.
 	 */
 	assert(!bo_gem->used_as_reloc_target);
+	if (bo_gem->in_reloc_tree)
+		atomic_set(&bufmgr_gem->stale_reloc_trees, 1);
+
+	/* Only the first relocation to a target references it. */
+	ret = drm_intel_gem_bo_add_target(bo_gem, target_bo,
+					  DRM_INTEL_TARGET_RELOC |
+					  (fenced_command ?
+					   DRM_INTEL_RELOC_FENCE : 0));
+	if (ret < 0) {
+		bo_gem->has_error = true;
+		return -ENOMEM;
+	}
+	if (ret == 0 && target_bo != bo)
+		drm_intel_gem_bo_reference(target_bo);
+	bo_gem->needs_relocs = true;
+
 	if (target_bo_gem != bo_gem) {
 		target_bo_gem->used_as_reloc_target = true;
 		bo_gem->reloc_tree_size += target_bo_gem->reloc_tree_size;
@@ -2107,8 +3413,6 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	}
 
 	bo_gem->reloc_target_info[bo_gem->reloc_count].bo = target_bo;
-	if (target_bo != bo)
-		drm_intel_gem_bo_reference(target_bo);
 	if (fenced_command)
 		bo_gem->reloc_target_info[bo_gem->reloc_count].flags =
 			DRM_INTEL_RELOC_FENCE;
@@ -2136,6 +3440,7 @@ drm_intel_gem_bo_use_48b_address_range(drm_intel_bo *bo, uint32_t enable)
 		bo_gem->kflags |= EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
 	else
 		bo_gem->kflags &= ~EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+	drm_intel_gem_bo_kflags_changed(bo_gem);
 }
 
 static int
@@ -2144,6 +3449,8 @@ drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
+	int ret;
+
 	if (bo_gem->has_error)
 		return -ENOMEM;
 
@@ -2157,6 +3464,9 @@ drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo)
 	if (target_bo_gem == bo_gem)
 		return -EINVAL;
 
+	if (bo_gem->in_reloc_tree)
+		atomic_set(&bufmgr_gem->stale_reloc_trees, 1);
+
 	if (bo_gem->softpin_target_count == bo_gem->softpin_target_size) {
 		int new_size = bo_gem->softpin_target_size * 2;
 		if (new_size == 0)
@@ -2169,6 +3479,16 @@ drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo)
 
 		bo_gem->softpin_target_size = new_size;
 	}
+
+	/* Each target is only listed, and referenced, once. */
+	ret = drm_intel_gem_bo_add_target(bo_gem, target_bo,
+					  DRM_INTEL_TARGET_SOFTPIN);
+	if (ret < 0) {
+		bo_gem->has_error = true;
+		return -ENOMEM;
+	}
+	if (ret)
+		return 0;
 	bo_gem->softpin_target[bo_gem->softpin_target_count] = target_bo;
 	drm_intel_gem_bo_reference(target_bo);
 	bo_gem->softpin_target_count++;
@@ -2230,34 +3550,95 @@ drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	int i;
+	int i, j, count;
 	struct timespec time;
 
 	clock_gettime(CLOCK_MONOTONIC, &time);
 
 	assert(bo_gem->reloc_count >= start);
 
-	/* Unreference the cleared target buffers */
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (bo_gem->in_reloc_tree)
+		atomic_set(&bufmgr_gem->stale_reloc_trees, 1);
 
 	for (i = start; i < bo_gem->reloc_count; i++) {
 		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) bo_gem->reloc_target_info[i].bo;
-		if (&target_bo_gem->bo != bo) {
+		if (&target_bo_gem->bo != bo)
 			bo_gem->reloc_tree_fences -= target_bo_gem->reloc_tree_fences;
-			drm_intel_gem_bo_unreference_locked_timed(&target_bo_gem->bo,
-								  time.tv_sec);
-		}
 	}
 	bo_gem->reloc_count = start;
 
+	/* Mark what the remaining relocations still reach; as the tree
+	 * only shrinks this is done in place, without allocating.
+	 */
+	for (i = 0; i < start; i++) {
+		drm_intel_bo *target_bo = bo_gem->reloc_target_info[i].bo;
+		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
+		struct drm_intel_gem_target *target =
+		    &bo_gem->targets[drm_intel_gem_target_find(bo_gem, target_bo)];
+
+		target->flags |= DRM_INTEL_TARGET_KEEP_RELOC |
+			(bo_gem->reloc_target_info[i].flags &
+			 DRM_INTEL_RELOC_FENCE ? DRM_INTEL_TARGET_KEEP_FENCE : 0);
+		if (target_bo_gem == bo_gem)
+			continue;
+
+		for (j = 0; j < target_bo_gem->target_count; j++) {
+			int index = drm_intel_gem_target_find(bo_gem,
+							      target_bo_gem->targets[j].bo);
+
+			if (index != -1)
+				bo_gem->targets[index].flags |= DRM_INTEL_TARGET_KEEP;
+		}
+	}
+
+	/* Unreference the cleared target buffers, and drop whatever
+	 * isn't reachable anymore.
+	 */
+	count = 0;
+	for (i = 0; i < bo_gem->target_count; i++) {
+		struct drm_intel_gem_target target = bo_gem->targets[i];
+		int flags = 0;
+
+		if (target.flags & DRM_INTEL_TARGET_KEEP_RELOC)
+			flags |= DRM_INTEL_TARGET_RELOC;
+		if (target.flags & DRM_INTEL_TARGET_KEEP_FENCE)
+			flags |= DRM_INTEL_RELOC_FENCE;
+
+		if (target.flags & DRM_INTEL_TARGET_RELOC &&
+		    !(flags & DRM_INTEL_TARGET_RELOC) && target.bo != bo)
+			drm_intel_gem_bo_unreference_timed(target.bo,
+							   time.tv_sec);
+
+		if (!(target.flags & (DRM_INTEL_TARGET_KEEP |
+				      DRM_INTEL_TARGET_KEEP_RELOC)))
+			continue;
+
+		target.flags = flags;
+		if (bo_gem->target_objects)
+			bo_gem->target_objects[count] = bo_gem->target_objects[i];
+		bo_gem->targets[count++] = target;
+	}
+	bo_gem->target_count = count;
+	bo_gem->needs_relocs = start > 0;
+
+	if (bo_gem->target_index) {
+		memset(bo_gem->target_index, 0,
+		       (bo_gem->target_index_mask + 1) *
+		       sizeof(*bo_gem->target_index));
+		for (i = 0; i < count; i++) {
+			struct drm_intel_gem_target *target = &bo_gem->targets[i];
+
+			bo_gem->target_index[drm_intel_gem_target_slot(bo_gem,
+								       target->bo,
+								       target->handle)] = i + 1;
+		}
+	}
+
 	for (i = 0; i < bo_gem->softpin_target_count; i++) {
 		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) bo_gem->softpin_target[i];
-		drm_intel_gem_bo_unreference_locked_timed(&target_bo_gem->bo, time.tv_sec);
+		drm_intel_gem_bo_unreference_timed(&target_bo_gem->bo, time.tv_sec);
 	}
 	bo_gem->softpin_target_count = 0;
-
-	pthread_mutex_unlock(&bufmgr_gem->lock);
-
 }
 
 /**
@@ -2266,105 +3647,101 @@ drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
  * index values into the validation list.
  */
 static void
-drm_intel_gem_bo_process_reloc(drm_intel_bo *bo)
+drm_intel_gem_bo_process_reloc(struct drm_intel_gem_exec_state *exec,
+			       drm_intel_bo *bo)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	int i;
 
-	if (bo_gem->relocs == NULL)
-		return;
-
-	for (i = 0; i < bo_gem->reloc_count; i++) {
-		drm_intel_bo *target_bo = bo_gem->reloc_target_info[i].bo;
+	for (i = 0; i < bo_gem->target_count; i++) {
+		drm_intel_bo *target_bo = bo_gem->targets[i].bo;
 
-		if (target_bo == bo)
+		if (!(bo_gem->targets[i].flags & DRM_INTEL_TARGET_RELOC) ||
+		    target_bo == bo)
 			continue;
 
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 
-		/* Continue walking the tree depth-first. */
-		drm_intel_gem_bo_process_reloc(target_bo);
+		/* Continue walking the tree depth-first, unless the target,
+		 * and so its own tree, is on the validate list already.
+		 */
+		if (drm_intel_gem_exec_find(exec, target_bo) == -1)
+			drm_intel_gem_bo_process_reloc(exec, target_bo);
 
 		/* Add the target to the validate list */
-		drm_intel_add_validate_buffer(target_bo);
+		drm_intel_add_validate_buffer(exec, target_bo);
 	}
 }
 
 static void
-drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
+drm_intel_gem_bo_process_reloc2(struct drm_intel_gem_exec_state *exec,
+				drm_intel_bo *bo)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *)bo;
 	int i;
 
-	if (bo_gem->relocs == NULL && bo_gem->softpin_target == NULL)
-		return;
-
-	for (i = 0; i < bo_gem->reloc_count; i++) {
-		drm_intel_bo *target_bo = bo_gem->reloc_target_info[i].bo;
+	for (i = 0; i < bo_gem->target_count; i++) {
+		drm_intel_bo *target_bo = bo_gem->targets[i].bo;
 		int need_fence;
 
-		if (target_bo == bo)
+		if (!(bo_gem->targets[i].flags & (DRM_INTEL_TARGET_RELOC |
+						  DRM_INTEL_TARGET_SOFTPIN)) ||
+		    target_bo == bo)
 			continue;
 
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 
-		/* Continue walking the tree depth-first. */
-		drm_intel_gem_bo_process_reloc2(target_bo);
+		/* Continue walking the tree depth-first, unless the target,
+		 * and so its own tree, is on the validate list already.
+		 */
+		if (drm_intel_gem_exec_find(exec, target_bo) == -1)
+			drm_intel_gem_bo_process_reloc2(exec, target_bo);
 
-		need_fence = (bo_gem->reloc_target_info[i].flags &
+		need_fence = (bo_gem->targets[i].flags &
 			      DRM_INTEL_RELOC_FENCE);
 
 		/* Add the target to the validate list */
-		drm_intel_add_validate_buffer2(target_bo, need_fence);
-	}
-
-	for (i = 0; i < bo_gem->softpin_target_count; i++) {
-		drm_intel_bo *target_bo = bo_gem->softpin_target[i];
-
-		if (target_bo == bo)
-			continue;
-
-		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
-		drm_intel_gem_bo_process_reloc2(target_bo);
-		drm_intel_add_validate_buffer2(target_bo, false);
+		drm_intel_add_validate_buffer2(exec, target_bo, need_fence);
 	}
 }
 
 
 static void
-drm_intel_update_buffer_offsets(drm_intel_bufmgr_gem *bufmgr_gem)
+drm_intel_update_buffer_offsets(drm_intel_bufmgr_gem *bufmgr_gem,
+				struct drm_intel_gem_exec_state *exec)
 {
 	int i;
 
-	for (i = 0; i < bufmgr_gem->exec_count; i++) {
-		drm_intel_bo *bo = bufmgr_gem->exec_bos[i];
+	for (i = 0; i < exec->exec_count; i++) {
+		drm_intel_bo *bo = exec->exec_bos[i];
 		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
 		/* Update the buffer offset */
-		if (bufmgr_gem->exec_objects[i].offset != bo->offset64) {
+		if (exec->exec_objects[i].offset != bo->offset64) {
 			DBG("BO %d (%s) migrated: 0x%08x %08x -> 0x%08x %08x\n",
 			    bo_gem->gem_handle, bo_gem->name,
 			    upper_32_bits(bo->offset64),
 			    lower_32_bits(bo->offset64),
-			    upper_32_bits(bufmgr_gem->exec_objects[i].offset),
-			    lower_32_bits(bufmgr_gem->exec_objects[i].offset));
-			bo->offset64 = bufmgr_gem->exec_objects[i].offset;
-			bo->offset = bufmgr_gem->exec_objects[i].offset;
+			    upper_32_bits(exec->exec_objects[i].offset),
+			    lower_32_bits(exec->exec_objects[i].offset));
+			bo->offset64 = exec->exec_objects[i].offset;
+			bo->offset = exec->exec_objects[i].offset;
 		}
 	}
 }
 
 static void
-drm_intel_update_buffer_offsets2 (drm_intel_bufmgr_gem *bufmgr_gem)
+drm_intel_update_buffer_offsets2 (drm_intel_bufmgr_gem *bufmgr_gem,
+				  struct drm_intel_gem_exec_state *exec)
 {
 	int i;
 
-	for (i = 0; i < bufmgr_gem->exec_count; i++) {
-		drm_intel_bo *bo = bufmgr_gem->exec_bos[i];
+	for (i = 0; i < exec->exec_count; i++) {
+		drm_intel_bo *bo = exec->exec_bos[i];
 		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *)bo;
 
 		/* Update the buffer offset */
-		if (bufmgr_gem->exec2_objects[i].offset != bo->offset64) {
+		if (exec->exec2_objects[i].offset != bo->offset64) {
 			/* If we're seeing softpinned object here it means that the kernel
 			 * has relocated our object... Indicating a programming error
 			 */
@@ -2373,14 +3750,18 @@ drm_intel_update_buffer_offsets2 (drm_intel_bufmgr_gem *bufmgr_gem)
 			    bo_gem->gem_handle, bo_gem->name,
 			    upper_32_bits(bo->offset64),
 			    lower_32_bits(bo->offset64),
-			    upper_32_bits(bufmgr_gem->exec2_objects[i].offset),
-			    lower_32_bits(bufmgr_gem->exec2_objects[i].offset));
-			bo->offset64 = bufmgr_gem->exec2_objects[i].offset;
-			bo->offset = bufmgr_gem->exec2_objects[i].offset;
+			    upper_32_bits(exec->exec2_objects[i].offset),
+			    lower_32_bits(exec->exec2_objects[i].offset));
+			bo->offset64 = exec->exec2_objects[i].offset;
+			bo->offset = exec->exec2_objects[i].offset;
 		}
 	}
 }
 
+/**
+ * Formerly dumped a BMP of the bo to the AUB file. AUB dumping has been
+ * removed, so this does nothing.
+ */
 drm_public void
 drm_intel_gem_bo_aub_dump_bmp(drm_intel_bo *bo,
 			      int x1, int y1, int width, int height,
@@ -2394,24 +3775,33 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 		      drm_clip_rect_t * cliprects, int num_cliprects, int DR4)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	struct drm_intel_gem_exec_state *exec;
 	struct drm_i915_gem_execbuffer execbuf;
-	int ret, i;
+	int ret;
 
 	if (to_bo_gem(bo)->has_error)
 		return -ENOMEM;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	exec = drm_intel_gem_exec_state_get(bufmgr_gem);
+	if (!exec)
+		return -ENOMEM;
+
 	/* Update indices and set up the validate list. */
-	drm_intel_gem_bo_process_reloc(bo);
+	drm_intel_gem_bo_process_reloc(exec, bo);
 
 	/* Add the batch buffer to the validation list.  There are no
 	 * relocations pointing to it.
 	 */
-	drm_intel_add_validate_buffer(bo);
+	drm_intel_add_validate_buffer(exec, bo);
+
+	if (exec->has_error) {
+		drm_intel_gem_exec_state_put(bufmgr_gem, exec);
+		return -ENOMEM;
+	}
 
 	memclear(execbuf);
-	execbuf.buffers_ptr = (uintptr_t) bufmgr_gem->exec_objects;
-	execbuf.buffer_count = bufmgr_gem->exec_count;
+	execbuf.buffers_ptr = (uintptr_t) exec->exec_objects;
+	execbuf.buffer_count = exec->exec_count;
 	execbuf.batch_start_offset = 0;
 	execbuf.batch_len = used;
 	execbuf.cliprects_ptr = (uintptr_t) cliprects;
@@ -2419,6 +3809,9 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 	execbuf.DR1 = 0;
 	execbuf.DR4 = DR4;
 
+	drm_intel_gem_timeline_begin(bufmgr_gem, exec,
+				     drm_intel_gem_timeline_key(NULL,
+								I915_EXEC_RENDER));
 	ret = drmIoctl(bufmgr_gem->fd,
 		       DRM_IOCTL_I915_GEM_EXECBUFFER,
 		       &execbuf);
@@ -2427,31 +3820,22 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 		if (errno == ENOSPC) {
 			DBG("Execbuffer fails to pin. "
 			    "Estimate: %u. Actual: %u. Available: %u\n",
-			    drm_intel_gem_estimate_batch_space(bufmgr_gem->exec_bos,
-							       bufmgr_gem->
-							       exec_count),
-			    drm_intel_gem_compute_batch_space(bufmgr_gem->exec_bos,
-							      bufmgr_gem->
-							      exec_count),
+			    drm_intel_gem_estimate_batch_space(exec->exec_bos,
+							       exec->exec_count),
+			    drm_intel_gem_compute_batch_space(exec->exec_bos,
+							      exec->exec_count),
 			    (unsigned int)bufmgr_gem->gtt_size);
 		}
 	}
-	drm_intel_update_buffer_offsets(bufmgr_gem);
+	drm_intel_update_buffer_offsets(bufmgr_gem, exec);
 
 	if (bufmgr_gem->bufmgr.debug)
-		drm_intel_gem_dump_validation_list(bufmgr_gem);
-
-	for (i = 0; i < bufmgr_gem->exec_count; i++) {
-		drm_intel_bo_gem *bo_gem = to_bo_gem(bufmgr_gem->exec_bos[i]);
+		drm_intel_gem_dump_validation_list(bufmgr_gem, exec);
 
-		bo_gem->idle = false;
+	drm_intel_gem_timeline_end(bufmgr_gem, exec, ret == 0);
 
-		/* Disconnect the buffer from the validate list */
-		bo_gem->validate_index = -1;
-		bufmgr_gem->exec_bos[i] = NULL;
-	}
-	bufmgr_gem->exec_count = 0;
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	/* Disconnect the buffers from the validate list */
+	drm_intel_gem_exec_state_put(bufmgr_gem, exec);
 
 	return ret;
 }
@@ -2463,9 +3847,10 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	 unsigned int flags)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
+	struct drm_intel_gem_exec_state *exec;
 	struct drm_i915_gem_execbuffer2 execbuf;
+	bool flat;
 	int ret = 0;
-	int i;
 
 	if (to_bo_gem(bo)->has_error)
 		return -ENOMEM;
@@ -2490,18 +3875,32 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 		break;
 	}
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
-	/* Update indices and set up the validate list. */
-	drm_intel_gem_bo_process_reloc2(bo);
+	exec = drm_intel_gem_exec_state_get(bufmgr_gem);
+	if (!exec)
+		return -ENOMEM;
 
-	/* Add the batch buffer to the validation list.  There are no relocations
-	 * pointing to it.
-	 */
-	drm_intel_add_validate_buffer2(bo, 0);
+	flat = drm_intel_gem_bo_is_flat(bufmgr_gem, to_bo_gem(bo));
+	if (flat) {
+		/* Every offset is known, there is nothing to relocate. */
+		drm_intel_add_validate_flat(exec, bo);
+	} else {
+		/* Update indices and set up the validate list. */
+		drm_intel_gem_bo_process_reloc2(exec, bo);
+
+		/* Add the batch buffer to the validation list.  There are
+		 * no relocations pointing to it.
+		 */
+		drm_intel_add_validate_buffer2(exec, bo, 0);
+	}
+
+	if (exec->has_error) {
+		drm_intel_gem_exec_state_put(bufmgr_gem, exec);
+		return -ENOMEM;
+	}
 
 	memclear(execbuf);
-	execbuf.buffers_ptr = (uintptr_t)bufmgr_gem->exec2_objects;
-	execbuf.buffer_count = bufmgr_gem->exec_count;
+	execbuf.buffers_ptr = (uintptr_t)exec->exec2_objects;
+	execbuf.buffer_count = exec->exec_count;
 	execbuf.batch_start_offset = 0;
 	execbuf.batch_len = used;
 	execbuf.cliprects_ptr = (uintptr_t)cliprects;
@@ -2523,6 +3922,9 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 		execbuf.flags |= I915_EXEC_FENCE_OUT;
 	}
 
+	drm_intel_gem_timeline_begin(bufmgr_gem, exec,
+				     drm_intel_gem_timeline_key(ctx, flags));
+
 	if (bufmgr_gem->no_exec)
 		goto skip_execution;
 
@@ -2534,33 +3936,28 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 		if (ret == -ENOSPC) {
 			DBG("Execbuffer fails to pin. "
 			    "Estimate: %u. Actual: %u. Available: %u\n",
-			    drm_intel_gem_estimate_batch_space(bufmgr_gem->exec_bos,
-							       bufmgr_gem->exec_count),
-			    drm_intel_gem_compute_batch_space(bufmgr_gem->exec_bos,
-							      bufmgr_gem->exec_count),
+			    drm_intel_gem_estimate_batch_space(exec->exec_bos,
+							       exec->exec_count),
+			    drm_intel_gem_compute_batch_space(exec->exec_bos,
+							      exec->exec_count),
 			    (unsigned int) bufmgr_gem->gtt_size);
 		}
 	}
-	drm_intel_update_buffer_offsets2(bufmgr_gem);
+	if (!flat)
+		drm_intel_update_buffer_offsets2(bufmgr_gem, exec);
 
 	if (ret == 0 && out_fence != NULL)
 		*out_fence = execbuf.rsvd2 >> 32;
 
 skip_execution:
 	if (bufmgr_gem->bufmgr.debug)
-		drm_intel_gem_dump_validation_list(bufmgr_gem);
+		drm_intel_gem_dump_validation_list(bufmgr_gem, exec);
 
-	for (i = 0; i < bufmgr_gem->exec_count; i++) {
-		drm_intel_bo_gem *bo_gem = to_bo_gem(bufmgr_gem->exec_bos[i]);
+	drm_intel_gem_timeline_end(bufmgr_gem, exec,
+				   ret == 0 && !bufmgr_gem->no_exec);
 
-		bo_gem->idle = false;
-
-		/* Disconnect the buffer from the validate list */
-		bo_gem->validate_index = -1;
-		bufmgr_gem->exec_bos[i] = NULL;
-	}
-	bufmgr_gem->exec_count = 0;
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	/* Disconnect the buffers from the validate list */
+	drm_intel_gem_exec_state_put(bufmgr_gem, exec);
 
 	return ret;
 }
@@ -2727,6 +4124,7 @@ drm_intel_gem_bo_set_softpin_offset(drm_intel_bo *bo, uint64_t offset)
 	bo->offset64 = offset;
 	bo->offset = offset;
 	bo_gem->kflags |= EXEC_OBJECT_PINNED;
+	drm_intel_gem_bo_kflags_changed(bo_gem);
 
 	return 0;
 }
@@ -2739,11 +4137,11 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 	uint32_t handle;
 	drm_intel_bo_gem *bo_gem;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bufmgr_gem->table_lock);
 	ret = drmPrimeFDToHandle(bufmgr_gem->fd, prime_fd, &handle);
 	if (ret) {
 		DBG("create_from_prime: failed to obtain handle from fd: %s\n", strerror(errno));
-		pthread_mutex_unlock(&bufmgr_gem->lock);
+		pthread_mutex_unlock(&bufmgr_gem->table_lock);
 		return NULL;
 	}
 
@@ -2764,7 +4162,7 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 		goto out;
 
 	atomic_set(&bo_gem->refcount, 1);
-	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_gem_bo_init_vma(bo_gem);
 
 	/* Determine size of bo.  The fd-to-handle ioctl really should
 	 * return the size, but it doesn't.  If we have kernel 3.12 or
@@ -2785,7 +4183,6 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 		 gem_handle, sizeof(bo_gem->gem_handle), bo_gem);
 
 	bo_gem->name = "prime";
-	bo_gem->validate_index = -1;
 	bo_gem->reloc_tree_fences = 0;
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->has_error = false;
@@ -2798,14 +4195,17 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 
 	/* XXX stride is unknown */
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
+	if (drm_intel_gem_bo_place(bufmgr_gem, bo_gem, 0))
+		goto err;
 
 out:
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bufmgr_gem->table_lock);
 	return &bo_gem->bo;
 
 err:
-	drm_intel_gem_bo_free(&bo_gem->bo);
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	drm_intel_gem_bo_unlink(bufmgr_gem, bo_gem);
+	pthread_mutex_unlock(&bufmgr_gem->table_lock);
+	drm_intel_gem_bo_release(&bo_gem->bo);
 	return NULL;
 }
 
@@ -2838,7 +4238,7 @@ drm_intel_gem_bo_flink(drm_intel_bo *bo, uint32_t * name)
 		if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_GEM_FLINK, &flink))
 			return -errno;
 
-		pthread_mutex_lock(&bufmgr_gem->lock);
+		pthread_mutex_lock(&bufmgr_gem->table_lock);
 		if (!bo_gem->global_name) {
 			bo_gem->global_name = flink.name;
 			bo_gem->reusable = false;
@@ -2847,7 +4247,7 @@ drm_intel_gem_bo_flink(drm_intel_bo *bo, uint32_t * name)
 				 global_name, sizeof(bo_gem->global_name),
 				 bo_gem);
 		}
-		pthread_mutex_unlock(&bufmgr_gem->lock);
+		pthread_mutex_unlock(&bufmgr_gem->table_lock);
 	}
 
 	*name = bo_gem->global_name;
@@ -2889,6 +4289,7 @@ drm_intel_gem_bo_disable_implicit_sync(drm_intel_bo *bo)
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
 	bo_gem->kflags |= EXEC_OBJECT_ASYNC;
+	drm_intel_gem_bo_kflags_changed(bo_gem);
 }
 
 /**
@@ -2908,6 +4309,7 @@ drm_intel_gem_bo_enable_implicit_sync(drm_intel_bo *bo)
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
 	bo_gem->kflags &= ~EXEC_OBJECT_ASYNC;
+	drm_intel_gem_bo_kflags_changed(bo_gem);
 }
 
 /**
@@ -2938,6 +4340,56 @@ drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr)
 		bufmgr_gem->fenced_relocs = true;
 }
 
+/**
+ * Enable softpinning of every buffer object.
+ *
+ * Each BO then gets its GPU address in [start, start + size) when it is
+ * created, keeps it while it sits in the BO cache and gives it back when
+ * it is closed. Relocations to such BOs become softpin targets, and a batch
+ * whose tree has no relocations is submitted straight from the list of
+ * execbuffer objects built as its targets were added, without walking the
+ * tree or updating offsets afterwards.
+ *
+ * This must be called before any BO is allocated or imported. start and
+ * size must be page aligned and the range must end below 8TiB; BOs above
+ * 4GiB are flagged as supporting 48-bit addresses. Returns 0, -ENODEV if
+ * the kernel can't softpin, -EINVAL for a bad range or -EBUSY.
+ */
+drm_public int
+drm_intel_bufmgr_gem_enable_softpin(drm_intel_bufmgr *bufmgr,
+				    uint64_t start, uint64_t size)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	const uint64_t page_mask = (1ull << DRM_INTEL_GEM_SOFTPIN_PAGE_SHIFT) - 1;
+	int ret = 0;
+
+	if (!bufmgr_gem->bufmgr.bo_set_softpin_offset)
+		return -ENODEV;
+
+	if (!size || (start | size) & page_mask ||
+	    (start + size) >> DRM_INTEL_GEM_SOFTPIN_PAGE_SHIFT > INT_MAX)
+		return -EINVAL;
+
+	pthread_mutex_lock(&bufmgr_gem->table_lock);
+	if (bufmgr_gem->softpin_heap || HASH_CNT(handle_hh,
+						 bufmgr_gem->handle_table)) {
+		ret = -EBUSY;
+	} else {
+		bufmgr_gem->softpin_heap =
+			mmInit(start >> DRM_INTEL_GEM_SOFTPIN_PAGE_SHIFT,
+			       size >> DRM_INTEL_GEM_SOFTPIN_PAGE_SHIFT);
+		if (!bufmgr_gem->softpin_heap)
+			ret = -ENOMEM;
+		bufmgr_gem->softpin_kflags = EXEC_OBJECT_PINNED;
+		if (start + size > 1ull << 32)
+			bufmgr_gem->softpin_kflags |=
+				EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->table_lock);
+
+	return ret;
+}
+
 /**
  * Return the additional aperture space required by the tree of buffer objects
  * rooted at bo.
@@ -3160,13 +4612,25 @@ _drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 static int
 drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem;
 	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
 
 	if (bo == NULL || target_bo == NULL)
 		return 0;
-	if (target_bo_gem->used_as_reloc_target)
+	/* Softpin targets count too, they aren't used_as_reloc_target. */
+	if (!target_bo_gem->in_reloc_tree)
+		return 0;
+
+	/* The tree of bo is complete unless one of the buffers in it
+	 * changed its own afterwards, which regular batch building
+	 * never does.
+	 */
+	bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	if (atomic_read(&bufmgr_gem->stale_reloc_trees))
 		return _drm_intel_gem_bo_references(bo, target_bo);
-	return 0;
+
+	return drm_intel_gem_target_find((drm_intel_bo_gem *) bo,
+					 target_bo) != -1;
 }
 
 static void
@@ -3176,6 +4640,7 @@ add_bucket(drm_intel_bufmgr_gem *bufmgr_gem, int size)
 
 	assert(i < ARRAY_SIZE(bufmgr_gem->cache_bucket));
 
+	pthread_mutex_init(&bufmgr_gem->cache_bucket[i].lock, NULL);
 	DRMINITLISTHEAD(&bufmgr_gem->cache_bucket[i].head);
 	bufmgr_gem->cache_bucket[i].size = size;
 	bufmgr_gem->num_buckets++;
@@ -3213,9 +4678,54 @@ drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
 
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 	bufmgr_gem->vma_max = limit;
 
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+}
+
+/**
+ * Limits the address space taken by the mappings of all BOs, in bytes, or
+ * removes the limit if @limit is negative. Unlike with
+ * drm_intel_bufmgr_gem_set_vma_cache_size(), a large mapping counts for
+ * more than a small one, and the CPU, WC and GTT mappings of a BO are
+ * evicted separately, least recently unmapped first. Mappings in use are
+ * never evicted, so the limit may be exceeded while they are.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_vma_cache_bytes(drm_intel_bufmgr *bufmgr,
+					 int64_t limit)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
+	bufmgr_gem->vma_max_bytes = limit < 0 ? -1 : limit;
+
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+}
+
+/**
+ * Returns the statistics of the mappings of @type, one of the
+ * DRM_INTEL_GEM_VMA_* values. The first map of a BO through the
+ * drm_intel_gem_bo_map__*() functions counts as a miss, but later ones
+ * don't count at all.
+ */
+drm_public int
+drm_intel_bufmgr_gem_get_vma_cache_stats(drm_intel_bufmgr *bufmgr, int type,
+					 struct drm_intel_gem_vma_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	if (type < 0 || type >= DRM_INTEL_GEM_VMA_TYPES)
+		return -EINVAL;
+
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
+	*stats = bufmgr_gem->vma_cache[type].stats;
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+
+	return 0;
 }
 
 static int
@@ -3288,8 +4798,8 @@ drm_intel_bufmgr_gem_get_devid(drm_intel_bufmgr *bufmgr)
 /**
  * Sets the AUB filename.
  *
- * This function has to be called before drm_intel_bufmgr_gem_set_aub_dump()
- * for it to have any effect.
+ * AUB dumping has been removed, so this does nothing. It is kept for
+ * binary compatibility; see drm_intel_bufmgr_gem_set_aub_dump().
  */
 drm_public void
 drm_intel_bufmgr_gem_set_aub_filename(drm_intel_bufmgr *bufmgr,
@@ -3301,9 +4811,9 @@ drm_intel_bufmgr_gem_set_aub_filename(drm_intel_bufmgr *bufmgr,
  * Sets up AUB dumping.
  *
  * This is a trace file format that can be used with the simulator.
- * Packets are emitted in a format somewhat like GPU command packets.
- * You can set up a GTT and upload your objects into the referenced
- * space, then send off batchbuffers and get BMPs out the other end.
+ * libdrm no longer writes it: this only points at intel_aubdump from
+ * intel-gpu-tools, which captures a process's execbuffers from outside
+ * of it, so nothing is written from the submission path here.
  */
 drm_public void
 drm_intel_bufmgr_gem_set_aub_dump(drm_intel_bufmgr *bufmgr, int enable)
@@ -3338,6 +4848,9 @@ drm_intel_gem_context_create(drm_intel_bufmgr *bufmgr)
 
 	context->ctx_id = create.ctx_id;
 	context->bufmgr = bufmgr;
+	pthread_mutex_lock(&bufmgr_gem->timeline_lock);
+	context->serial = ++bufmgr_gem->context_serial;
+	pthread_mutex_unlock(&bufmgr_gem->timeline_lock);
 
 	return context;
 }
@@ -3358,7 +4871,7 @@ drm_intel_gem_context_destroy(drm_intel_context *ctx)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem;
 	struct drm_i915_gem_context_destroy destroy;
-	int ret;
+	int i, ret;
 
 	if (ctx == NULL)
 		return;
@@ -3366,6 +4879,18 @@ drm_intel_gem_context_destroy(drm_intel_context *ctx)
 	memclear(destroy);
 
 	bufmgr_gem = (drm_intel_bufmgr_gem *)ctx->bufmgr;
+
+	/* Its timelines can't be used again, make room for others. */
+	pthread_mutex_lock(&bufmgr_gem->timeline_lock);
+	for (i = 0; i < DRM_INTEL_GEM_NUM_TIMELINES; i++) {
+		struct drm_intel_gem_timeline *timeline =
+			&bufmgr_gem->timelines[i];
+
+		if (timeline->key && (timeline->key - 1) >> 8 == ctx->serial)
+			memset(timeline, 0, sizeof(*timeline));
+	}
+	pthread_mutex_unlock(&bufmgr_gem->timeline_lock);
+
 	destroy.ctx_id = ctx->ctx_id;
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_CONTEXT_DESTROY,
 		       &destroy);
@@ -3510,6 +5035,8 @@ drm_intel_get_min_eu_in_pool(int fd)
  * Annotations are stored for the lifetime of the bo; to reset to the
  * default state (no annotations), call this function with a \c count
  * of zero.
+ *
+ * AUB dumping has been removed, so the annotations are ignored.
  */
 drm_public void drm_intel_bufmgr_gem_set_aub_annotations(drm_intel_bo *bo,
 					 drm_intel_aub_annotation *annotations,
@@ -3563,7 +5090,7 @@ drm_public void *drm_intel_gem_bo_map__gtt(drm_intel_bo *bo)
 	if (bo_gem->is_userptr)
 		return NULL;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 	if (bo_gem->gtt_virtual == NULL) {
 		struct drm_i915_gem_mmap_gtt mmap_arg;
 		void *ptr;
@@ -3594,8 +5121,11 @@ drm_public void *drm_intel_gem_bo_map__gtt(drm_intel_bo *bo)
 		}
 
 		bo_gem->gtt_virtual = ptr;
+		if (ptr)
+			drm_intel_gem_bo_use_vma(bufmgr_gem, bo_gem,
+						 DRM_INTEL_GEM_VMA_GTT, false);
 	}
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 
 	return bo_gem->gtt_virtual;
 }
@@ -3613,7 +5143,7 @@ drm_public void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 		return bo_gem->user_virtual;
 	}
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 	if (!bo_gem->mem_virtual) {
 		struct drm_i915_gem_mmap mmap_arg;
 
@@ -3637,9 +5167,11 @@ drm_public void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 		} else {
 			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 			bo_gem->mem_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+			drm_intel_gem_bo_use_vma(bufmgr_gem, bo_gem,
+						 DRM_INTEL_GEM_VMA_CPU, false);
 		}
 	}
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 
 	return bo_gem->mem_virtual;
 }
@@ -3655,7 +5187,7 @@ drm_public void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo)
 	if (bo_gem->is_userptr)
 		return NULL;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 	if (!bo_gem->wc_virtual) {
 		struct drm_i915_gem_mmap mmap_arg;
 
@@ -3680,9 +5212,11 @@ drm_public void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo)
 		} else {
 			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 			bo_gem->wc_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+			drm_intel_gem_bo_use_vma(bufmgr_gem, bo_gem,
+						 DRM_INTEL_GEM_VMA_WC, false);
 		}
 	}
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 
 	return bo_gem->wc_virtual;
 }
@@ -3699,7 +5233,7 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	drm_intel_bufmgr_gem *bufmgr_gem;
 	struct drm_i915_gem_get_aperture aperture;
 	drm_i915_getparam_t gp;
-	int ret, tmp;
+	int ret, tmp, i;
 	bool exec2 = false;
 
 	pthread_mutex_lock(&bufmgr_list_mutex);
@@ -3715,7 +5249,12 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	bufmgr_gem->fd = fd;
 	atomic_set(&bufmgr_gem->refcount, 1);
 
-	if (pthread_mutex_init(&bufmgr_gem->lock, NULL) != 0) {
+	if (pthread_mutex_init(&bufmgr_gem->exec_lock, NULL) != 0 ||
+	    pthread_mutex_init(&bufmgr_gem->cache_lock, NULL) != 0 ||
+	    pthread_mutex_init(&bufmgr_gem->table_lock, NULL) != 0 ||
+	    pthread_mutex_init(&bufmgr_gem->vma_lock, NULL) != 0 ||
+	    pthread_mutex_init(&bufmgr_gem->timeline_lock, NULL) != 0 ||
+	    pthread_mutex_init(&bufmgr_gem->softpin_lock, NULL) != 0) {
 		free(bufmgr_gem);
 		bufmgr_gem = NULL;
 		goto exit;
@@ -3898,8 +5437,16 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 
 	init_cache_buckets(bufmgr_gem);
 
-	DRMINITLISTHEAD(&bufmgr_gem->vma_cache);
+	DRMINITLISTHEAD(&bufmgr_gem->magazines);
+	pthread_mutex_init(&bufmgr_gem->magazine_lock, NULL);
+	bufmgr_gem->has_magazines =
+		pthread_key_create(&bufmgr_gem->magazine_key,
+				   drm_intel_gem_bo_magazine_destroy) == 0;
+
+	for (i = 0; i < DRM_INTEL_GEM_VMA_TYPES; i++)
+		DRMINITLISTHEAD(&bufmgr_gem->vma_cache[i].lru);
 	bufmgr_gem->vma_max = -1; /* unlimited by default */
+	bufmgr_gem->vma_max_bytes = -1;
 
 	DRMLISTADD(&bufmgr_gem->managers, &bufmgr_list);
 
@@ -316,6 +316,8 @@ struct _drm_intel_bufmgr {
 struct _drm_intel_context {
 	unsigned int ctx_id;
 	struct _drm_intel_bufmgr *bufmgr;
+	/** Unlike ctx_id, never reused by the bufmgr; 0 is the default context. */
+	uint32_t serial;
 };
 
 #define ALIGN(value, alignment)	((value + alignment - 1) & ~(alignment - 1))
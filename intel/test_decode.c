@@ -83,42 +83,33 @@ dump_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 }
 
 static void
-compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
+check_decode(struct drm_intel_decode *ctx, const char *batch_filename,
+	     const char *ref_filename, const char *ref)
 {
 	FILE *out = NULL;
-	void *ptr, *ref_ptr, *batch_ptr;
+	char *ptr;
 #if HAVE_OPEN_MEMSTREAM
 	size_t size;
 #endif
-	size_t ref_size, batch_size;
-	const char *ref_suffix = "-ref.txt";
-	char *ref_filename;
-
-	ref_filename = malloc(strlen(batch_filename) + strlen(ref_suffix) + 1);
-	sprintf(ref_filename, "%s%s", batch_filename, ref_suffix);
-
-	/* Read the batch and reference. */
-	read_file(batch_filename, &batch_ptr, &batch_size);
-	read_file(ref_filename, &ref_ptr, &ref_size);
 
 	/* Set up our decode output in memory, because I don't want to
 	 * figure out how to output to a file in a safe and sane way
 	 * inside of an automake project's test infrastructure.
 	 */
 #if HAVE_OPEN_MEMSTREAM
-	out = open_memstream((char **)&ptr, &size);
+	out = open_memstream(&ptr, &size);
 #else
 	fprintf(stderr, "platform lacks open_memstream, skipping.\n");
 	exit(77);
 #endif
 
-	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
-					   batch_size / 4);
 	drm_intel_decode_set_output_file(ctx, out);
 
 	drm_intel_decode(ctx);
 
-	if (strcmp(ref_ptr, ptr) != 0) {
+	fclose(out);
+
+	if (strcmp(ref, ptr) != 0) {
 		fprintf(stderr, "Decode mismatch with reference `%s'.\n",
 			ref_filename);
 		fprintf(stderr, "You can dump the new output using:\n");
@@ -126,11 +117,97 @@ compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 		exit(1);
 	}
 
-	fclose(out);
-	free(ref_filename);
 	free(ptr);
 }
 
+struct packet_check {
+	FILE *out;
+	uint32_t next;
+	int bad;
+};
+
+static void
+check_packet(const struct drm_intel_decode_packet *packet, void *priv)
+{
+	struct packet_check *check = priv;
+
+	if (packet->offset != check->next || !packet->length ||
+	    packet->type != packet->data[0] >> 29)
+		check->bad = 1;
+
+	check->next += packet->length * 4;
+}
+
+static void DRM_INTEL_PRINTFLIKE(3, 0)
+check_field(uint32_t offset, uint32_t value, const char *format, va_list va,
+	    void *priv)
+{
+	struct packet_check *check = priv;
+
+	fprintf(check->out, "0x%08x:      0x%08x: %s", offset, value,
+		offset == check->next ? "" : "   ");
+	vfprintf(check->out, format, va);
+}
+
+/* Rebuilds the text output from the structured one. */
+static void
+check_decode_packets(struct drm_intel_decode *ctx, const char *batch_filename,
+		     const char *ref_filename, const char *ref)
+{
+	struct packet_check check = { NULL, HW_OFFSET, 0 };
+	char *ptr;
+#if HAVE_OPEN_MEMSTREAM
+	size_t size;
+
+	check.out = open_memstream(&ptr, &size);
+#endif
+
+	drm_intel_decode_set_packet_callback(ctx, check_packet, check_field,
+					     &check);
+	drm_intel_decode(ctx);
+	drm_intel_decode_set_packet_callback(ctx, NULL, NULL, NULL);
+
+	fclose(check.out);
+
+	if (check.bad || strcmp(ref, ptr) != 0) {
+		fprintf(stderr, "Packet decode mismatch with reference `%s'.\n",
+			ref_filename);
+		exit(1);
+	}
+
+	free(ptr);
+}
+
+static void
+compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
+{
+	void *ref_ptr, *batch_ptr;
+	size_t ref_size, batch_size;
+	const char *ref_suffix = "-ref.txt";
+	char *ref_filename;
+
+	ref_filename = malloc(strlen(batch_filename) + strlen(ref_suffix) + 1);
+	sprintf(ref_filename, "%s%s", batch_filename, ref_suffix);
+
+	/* Read the batch and reference. */
+	read_file(batch_filename, &batch_ptr, &batch_size);
+	read_file(ref_filename, &ref_ptr, &ref_size);
+
+	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
+					   batch_size / 4);
+
+	check_decode(ctx, batch_filename, ref_filename, ref_ptr);
+	check_decode_packets(ctx, batch_filename, ref_filename, ref_ptr);
+
+	/* Splitting the batch up between threads mustn't change the output,
+	 * so use chunks small enough to cut it in many places.
+	 */
+	drm_intel_decode_set_parallel(ctx, 4, 16);
+	check_decode(ctx, batch_filename, ref_filename, ref_ptr);
+
+	free(ref_filename);
+}
+
 static uint16_t
 infer_devid(const char *batch_filename)
 {
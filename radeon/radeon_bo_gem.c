@@ -34,7 +34,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include "libdrm_macros.h"
+#include "libdrm_lists.h"
 #include "xf86drm.h"
 #include "xf86atomic.h"
 #include "drm.h"
@@ -43,20 +46,209 @@
 #include "radeon_bo_int.h"
 #include "radeon_bo_gem.h"
 #include <fcntl.h>
+
+/* Cached bos are closed after this many seconds unused. */
+#define BO_CACHE_MAX_AGE        1
+#define BO_CACHE_MAX_SIZE       (64 * 1024 * 1024)
+
 struct radeon_bo_gem {
     struct radeon_bo_int    base;
     uint32_t                name;
     int                     map_count;
     atomic_t                reloc_in_cs;
     void                    *priv_ptr;
+    /* set for bos created by us and never shared, which can be cached */
+    int                     reusable;
+    int                     tiled;
+    drmMMListHead           head;
+    time_t                  free_time;
+};
+
+struct bo_gem_bucket {
+    drmMMListHead           head;
+    uint32_t                size;
 };
 
 struct bo_manager_gem {
     struct radeon_bo_manager    base;
+    /* reuse cache, only used after radeon_bo_manager_gem_enable_reuse */
+    int                         reuse;
+    pthread_mutex_t             cache_mutex;
+    struct bo_gem_bucket        cache_bucket[14 * 4];
+    int                         num_buckets;
+    time_t                      cache_time;
+    struct radeon_bo_gem_cache_stats stats;
 };
 
 static int bo_wait(struct radeon_bo_int *boi);
-    
+static int bo_set_tiling(struct radeon_bo_int *boi, uint32_t tiling_flags,
+                         uint32_t pitch);
+
+static void bo_gem_close(struct radeon_bo_gem *bo_gem)
+{
+    struct radeon_bo_int *boi = &bo_gem->base;
+    struct drm_gem_close args;
+
+    if (bo_gem->priv_ptr) {
+        drm_munmap(bo_gem->priv_ptr, boi->size);
+    }
+
+    /* Zero out args to make valgrind happy */
+    memset(&args, 0, sizeof(args));
+
+    /* close object */
+    args.handle = boi->handle;
+    drmIoctl(boi->bom->fd, DRM_IOCTL_GEM_CLOSE, &args);
+    memset(bo_gem, 0, sizeof(struct radeon_bo_gem));
+    free(bo_gem);
+}
+
+static void bo_gem_add_bucket(struct bo_manager_gem *bomg, uint32_t size)
+{
+    struct bo_gem_bucket *bucket = &bomg->cache_bucket[bomg->num_buckets++];
+
+    DRMINITLISTHEAD(&bucket->head);
+    bucket->size = size;
+}
+
+/* Same bucket sizes as intel and freedreno: a page up to 4 pages, then
+ * 4 sizes for each power of two up to BO_CACHE_MAX_SIZE. */
+static void bo_gem_init_buckets(struct bo_manager_gem *bomg)
+{
+    uint32_t size;
+
+    bo_gem_add_bucket(bomg, 4096);
+    bo_gem_add_bucket(bomg, 4096 * 2);
+    bo_gem_add_bucket(bomg, 4096 * 3);
+    for (size = 4 * 4096; size <= BO_CACHE_MAX_SIZE; size *= 2) {
+        bo_gem_add_bucket(bomg, size);
+        bo_gem_add_bucket(bomg, size + size * 1 / 4);
+        bo_gem_add_bucket(bomg, size + size * 2 / 4);
+        bo_gem_add_bucket(bomg, size + size * 3 / 4);
+    }
+}
+
+static struct bo_gem_bucket *bo_gem_bucket_for_size(struct bo_manager_gem *bomg,
+                                                    uint32_t size)
+{
+    int i;
+
+    for (i = 0; i < bomg->num_buckets; i++) {
+        if (bomg->cache_bucket[i].size >= size) {
+            return &bomg->cache_bucket[i];
+        }
+    }
+    return NULL;
+}
+
+static time_t bo_gem_time(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec;
+}
+
+/* Closes cached bos freed before time. Called with cache_mutex held. */
+static void bo_gem_cache_evict(struct bo_manager_gem *bomg, time_t time)
+{
+    struct radeon_bo_gem *bo_gem;
+    int i;
+
+    for (i = 0; i < bomg->num_buckets; i++) {
+        struct bo_gem_bucket *bucket = &bomg->cache_bucket[i];
+
+        /* the oldest bos are at the head */
+        while (!DRMLISTEMPTY(&bucket->head)) {
+            bo_gem = DRMLISTENTRY(struct radeon_bo_gem, bucket->head.next,
+                                  head);
+            if (bo_gem->free_time >= time) {
+                break;
+            }
+            DRMLISTDEL(&bo_gem->head);
+            bomg->stats.evicted++;
+            bomg->stats.cached_bos--;
+            bomg->stats.cached_bytes -= bo_gem->base.size;
+            bo_gem_close(bo_gem);
+        }
+    }
+}
+
+/* Puts back a bo taken by bo_gem_cache_take, keeping the bucket in free
+ * time order. Called with cache_mutex held. */
+static void bo_gem_cache_return(struct bo_manager_gem *bomg,
+                                struct bo_gem_bucket *bucket,
+                                struct radeon_bo_gem *bo_gem)
+{
+    struct radeon_bo_gem *next;
+
+    DRMLISTFOREACHENTRY(next, &bucket->head, head) {
+        if (next->free_time > bo_gem->free_time) {
+            break;
+        }
+    }
+    DRMLISTADDTAIL(&bo_gem->head, &next->head);
+    bomg->stats.cached_bos++;
+    bomg->stats.cached_bytes += bo_gem->base.size;
+}
+
+/**
+ * Takes the least recently freed bo of the bucket with the same domains and
+ * flags, and an alignment which is a multiple of the requested one. The
+ * older bos are the most likely to be idle, so if that one is still busy
+ * a new bo is created instead of waiting.
+ */
+static struct radeon_bo_gem *bo_gem_cache_take(struct bo_manager_gem *bomg,
+                                               struct bo_gem_bucket *bucket,
+                                               uint32_t alignment,
+                                               uint32_t domains,
+                                               uint32_t flags)
+{
+    struct radeon_bo_gem *bo_gem, *found = NULL;
+    struct drm_radeon_gem_busy args;
+    int busy;
+
+    pthread_mutex_lock(&bomg->cache_mutex);
+    DRMLISTFOREACHENTRY(bo_gem, &bucket->head, head) {
+        struct radeon_bo_int *boi = &bo_gem->base;
+
+        if (boi->domains != domains || boi->flags != flags ||
+            (alignment && (boi->alignment < alignment ||
+                           boi->alignment % alignment))) {
+            continue;
+        }
+        found = bo_gem;
+        break;
+    }
+    if (found == NULL) {
+        bomg->stats.misses++;
+        pthread_mutex_unlock(&bomg->cache_mutex);
+        return NULL;
+    }
+    DRMLISTDEL(&found->head);
+    bomg->stats.cached_bos--;
+    bomg->stats.cached_bytes -= found->base.size;
+    pthread_mutex_unlock(&bomg->cache_mutex);
+
+    /* ask the kernel without holding up other opens and unrefs */
+    memset(&args, 0, sizeof(args));
+    args.handle = found->base.handle;
+    busy = drmCommandWriteRead(bomg->base.fd, DRM_RADEON_GEM_BUSY,
+                               &args, sizeof(args));
+
+    pthread_mutex_lock(&bomg->cache_mutex);
+    if (busy) {
+        bo_gem_cache_return(bomg, bucket, found);
+        bomg->stats.busy++;
+        bomg->stats.misses++;
+        found = NULL;
+    } else {
+        bomg->stats.hits++;
+    }
+    pthread_mutex_unlock(&bomg->cache_mutex);
+    return found;
+}
+
 static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
                                  uint32_t handle,
                                  uint32_t size,
@@ -64,9 +256,37 @@ static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
                                  uint32_t domains,
                                  uint32_t flags)
 {
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+    struct bo_gem_bucket *bucket = NULL;
     struct radeon_bo_gem *bo;
     int r;
 
+    if (!handle && bomg->reuse) {
+        bucket = bo_gem_bucket_for_size(bomg, size);
+    }
+    if (bucket) {
+        size = bucket->size;
+        bo = bo_gem_cache_take(bomg, bucket, alignment, domains, flags);
+        if (bo && bo->tiled) {
+            /* a bo keeping its old tiling is of no use */
+            if (bo_set_tiling(&bo->base, 0, 0)) {
+                bo_gem_close(bo);
+                bo = NULL;
+            } else {
+                bo->tiled = 0;
+            }
+        }
+        if (bo) {
+            bo->base.ptr = NULL;
+            bo->base.space_accounted = 0;
+            bo->base.referenced_in_cs = 0;
+            atomic_set(&bo->reloc_in_cs, 0);
+            bo->map_count = 0;
+            radeon_bo_ref((struct radeon_bo*)bo);
+            return (struct radeon_bo*)bo;
+        }
+    }
+
     bo = (struct radeon_bo_gem*)calloc(1, sizeof(struct radeon_bo_gem));
     if (bo == NULL) {
         return NULL;
@@ -81,6 +301,7 @@ static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
     bo->base.ptr = NULL;
     atomic_set(&bo->reloc_in_cs, 0);
     bo->map_count = 0;
+    bo->reusable = bucket != NULL;
     if (handle) {
         struct drm_gem_open open_arg;
 
@@ -125,23 +346,32 @@ static void bo_ref(struct radeon_bo_int *boi)
 static struct radeon_bo *bo_unref(struct radeon_bo_int *boi)
 {
     struct radeon_bo_gem *bo_gem = (struct radeon_bo_gem*)boi;
-    struct drm_gem_close args;
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)boi->bom;
+    time_t time;
 
     if (boi->cref) {
         return (struct radeon_bo *)boi;
     }
-    if (bo_gem->priv_ptr) {
-        drm_munmap(bo_gem->priv_ptr, boi->size);
+    if (!bo_gem->reusable || !bomg->reuse) {
+        bo_gem_close(bo_gem);
+        return NULL;
     }
 
-    /* Zero out args to make valgrind happy */
-    memset(&args, 0, sizeof(args));
-
-    /* close object */
-    args.handle = boi->handle;
-    drmIoctl(boi->bom->fd, DRM_IOCTL_GEM_CLOSE, &args);
-    memset(bo_gem, 0, sizeof(struct radeon_bo_gem));
-    free(bo_gem);
+    /* Keep the bo, and its CPU mapping, for the next bo_open of the same
+     * size. The bo may still be in use by the GPU, so it is only reused
+     * once idle. */
+    time = bo_gem_time();
+    pthread_mutex_lock(&bomg->cache_mutex);
+    bo_gem->free_time = time;
+    DRMLISTADDTAIL(&bo_gem->head,
+                   &bo_gem_bucket_for_size(bomg, boi->size)->head);
+    bomg->stats.cached_bos++;
+    bomg->stats.cached_bytes += boi->size;
+    if (bomg->cache_time != time) {
+        bo_gem_cache_evict(bomg, time - BO_CACHE_MAX_AGE);
+        bomg->cache_time = time;
+    }
+    pthread_mutex_unlock(&bomg->cache_mutex);
     return NULL;
 }
 
@@ -243,6 +473,9 @@ static int bo_set_tiling(struct radeon_bo_int *boi, uint32_t tiling_flags,
                             DRM_RADEON_GEM_SET_TILING,
                             &args,
                             sizeof(args));
+    if (!r) {
+        ((struct radeon_bo_gem*)boi)->tiled = tiling_flags || pitch;
+    }
     return r;
 }
 
@@ -291,6 +524,8 @@ drm_public struct radeon_bo_manager *radeon_bo_manager_gem_ctor(int fd)
     }
     bomg->base.funcs = &bo_gem_funcs;
     bomg->base.fd = fd;
+    pthread_mutex_init(&bomg->cache_mutex, NULL);
+    bo_gem_init_buckets(bomg);
     return (struct radeon_bo_manager*)bomg;
 }
 
@@ -301,9 +536,38 @@ drm_public void radeon_bo_manager_gem_dtor(struct radeon_bo_manager *bom)
     if (bom == NULL) {
         return;
     }
+    radeon_bo_manager_gem_trim_cache(bom);
+    pthread_mutex_destroy(&bomg->cache_mutex);
     free(bomg);
 }
 
+drm_public void radeon_bo_manager_gem_enable_reuse(struct radeon_bo_manager *bom)
+{
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+
+    bomg->reuse = 1;
+}
+
+drm_public void radeon_bo_manager_gem_trim_cache(struct radeon_bo_manager *bom)
+{
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+
+    pthread_mutex_lock(&bomg->cache_mutex);
+    bo_gem_cache_evict(bomg, bo_gem_time() + 1);
+    pthread_mutex_unlock(&bomg->cache_mutex);
+}
+
+drm_public void
+radeon_bo_manager_gem_get_cache_stats(struct radeon_bo_manager *bom,
+                                      struct radeon_bo_gem_cache_stats *stats)
+{
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+
+    pthread_mutex_lock(&bomg->cache_mutex);
+    *stats = bomg->stats;
+    pthread_mutex_unlock(&bomg->cache_mutex);
+}
+
 drm_public uint32_t
 radeon_gem_name_bo(struct radeon_bo *bo)
 {
@@ -335,6 +599,8 @@ radeon_gem_get_kernel_name(struct radeon_bo *bo, uint32_t *name)
     if (r) {
         return r;
     }
+    /* other processes may use it after we are done */
+    bo_gem->reusable = 0;
     bo_gem->name = flink.name;
     *name = flink.name;
     return 0;
@@ -364,6 +630,9 @@ drm_public int radeon_gem_prime_share_bo(struct radeon_bo *bo, int *handle)
     int ret;
 
     ret = drmPrimeHandleToFD(bo_gem->base.bom->fd, bo->handle, DRM_CLOEXEC, handle);
+    if (!ret) {
+        bo_gem->reusable = 0;
+    }
     return ret;
 }
 
@@ -34,9 +34,30 @@
 
 #include "radeon_bo.h"
 
+struct radeon_bo_gem_cache_stats {
+    uint64_t    hits;           /* bos reused from the cache */
+    uint64_t    misses;         /* cacheable bos which had to be created */
+    uint64_t    busy;           /* misses because the bo found was busy */
+    uint64_t    evicted;        /* cached bos closed for age or by a trim */
+    uint32_t    cached_bos;
+    uint64_t    cached_bytes;
+};
+
 struct radeon_bo_manager *radeon_bo_manager_gem_ctor(int fd);
 void radeon_bo_manager_gem_dtor(struct radeon_bo_manager *bom);
 
+/**
+ * Makes radeon_bo_unref keep the bos it created, up to 64MB each, and
+ * radeon_bo_open reuse an idle one with the same domains and flags instead
+ * of creating a new bo. Sizes are rounded up to the cache buckets. Cached
+ * bos are closed after a second, or by radeon_bo_manager_gem_trim_cache.
+ * Bos which were flinked or exported as dma-buf are never cached.
+ */
+void radeon_bo_manager_gem_enable_reuse(struct radeon_bo_manager *bom);
+void radeon_bo_manager_gem_trim_cache(struct radeon_bo_manager *bom);
+void radeon_bo_manager_gem_get_cache_stats(struct radeon_bo_manager *bom,
+                                           struct radeon_bo_gem_cache_stats *stats);
+
 uint32_t radeon_gem_name_bo(struct radeon_bo *bo);
 void *radeon_gem_get_reloc_in_cs(struct radeon_bo *bo);
 int radeon_gem_set_domain(struct radeon_bo *bo, uint32_t read_domains, uint32_t write_domain);
@@ -52,10 +52,23 @@
 #include "bof.h"
 #endif
 
+/* Number of reloc arrays of destroyed CS kept for new ones. */
+#define CS_GEM_RELOC_POOL_SIZE 8
+
+struct cs_gem_relocs {
+    unsigned                    nrelocs;
+    uint32_t                    *relocs;
+    struct radeon_bo_int        **relocs_bo;
+    uint32_t                    *reloc_map;
+};
+
 struct radeon_cs_manager_gem {
     struct radeon_cs_manager    base;
     uint32_t                    device_id;
     unsigned                    nbof;
+    pthread_mutex_t             pool_mutex;
+    unsigned                    npool;
+    struct cs_gem_relocs        pool[CS_GEM_RELOC_POOL_SIZE];
 };
 
 #pragma pack(1)
@@ -76,8 +89,13 @@ struct cs_gem {
     unsigned                    nrelocs;
     uint32_t                    *relocs;
     struct radeon_bo_int        **relocs_bo;
+    /* open addressed map from handle to reloc index + 1, with
+     * RELOC_MAP_SIZE(nrelocs) entries */
+    uint32_t                    *reloc_map;
 };
 
+#define RELOC_MAP_SIZE(nrelocs) (2 * (nrelocs))
+
 static pthread_mutex_t id_mutex = PTHREAD_MUTEX_INITIALIZER;
 static uint32_t cs_id_source = 0;
 
@@ -93,6 +111,10 @@ static uint32_t get_first_zero(const uint32_t n)
 /**
  * Returns a free id for cs.
  * If there is no free id we return zero
+ *
+ * The ids are only kept for radeon_cs_get_id() and
+ * radeon_gem_get_reloc_in_cs() users, relocs are found through the map
+ * of each cs.
  **/
 static uint32_t generate_id(void)
 {
@@ -122,10 +144,85 @@ static void free_id(uint32_t id)
     pthread_mutex_unlock( &id_mutex );
 }
 
+/**
+ * Takes the largest reloc arrays from the manager's pool, or allocates
+ * room for a page of relocs if it is empty.
+ */
+static int cs_gem_relocs_get(struct radeon_cs_manager_gem *csm,
+                             struct cs_gem_relocs *r)
+{
+    unsigned i, best = 0;
+
+    pthread_mutex_lock(&csm->pool_mutex);
+    if (csm->npool) {
+        for (i = 1; i < csm->npool; i++) {
+            if (csm->pool[i].nrelocs > csm->pool[best].nrelocs)
+                best = i;
+        }
+        *r = csm->pool[best];
+        csm->pool[best] = csm->pool[--csm->npool];
+        pthread_mutex_unlock(&csm->pool_mutex);
+        return 0;
+    }
+    pthread_mutex_unlock(&csm->pool_mutex);
+
+    r->nrelocs = 4096 / (4 * 4);
+    r->relocs_bo = (struct radeon_bo_int**)calloc(1,
+                                              r->nrelocs*sizeof(void*));
+    if (r->relocs_bo == NULL) {
+        return -ENOMEM;
+    }
+    r->relocs = (uint32_t*)calloc(1, 4096);
+    if (r->relocs == NULL) {
+        free(r->relocs_bo);
+        return -ENOMEM;
+    }
+    r->reloc_map = (uint32_t*)calloc(RELOC_MAP_SIZE(r->nrelocs), 4);
+    if (r->reloc_map == NULL) {
+        free(r->relocs);
+        free(r->relocs_bo);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/**
+ * Gives reloc arrays back to the manager's pool, which keeps the largest
+ * ones.
+ */
+static void cs_gem_relocs_put(struct radeon_cs_manager_gem *csm,
+                              struct cs_gem_relocs *r)
+{
+    struct cs_gem_relocs tmp;
+    unsigned i, smallest = 0;
+
+    pthread_mutex_lock(&csm->pool_mutex);
+    if (csm->npool < CS_GEM_RELOC_POOL_SIZE) {
+        csm->pool[csm->npool++] = *r;
+        pthread_mutex_unlock(&csm->pool_mutex);
+        return;
+    }
+    for (i = 1; i < csm->npool; i++) {
+        if (csm->pool[i].nrelocs < csm->pool[smallest].nrelocs)
+            smallest = i;
+    }
+    tmp = *r;
+    if (csm->pool[smallest].nrelocs < r->nrelocs) {
+        tmp = csm->pool[smallest];
+        csm->pool[smallest] = *r;
+    }
+    pthread_mutex_unlock(&csm->pool_mutex);
+
+    free(tmp.relocs_bo);
+    free(tmp.relocs);
+    free(tmp.reloc_map);
+}
+
 static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
                                        uint32_t ndw)
 {
     struct cs_gem *csg;
+    struct cs_gem_relocs r;
 
     /* max cmd buffer size is 64Kb */
     if (ndw > (64 * 1024 / 4)) {
@@ -144,22 +241,16 @@ static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
     }
     csg->base.relocs_total_size = 0;
     csg->base.crelocs = 0;
-    csg->base.id = generate_id();
-    csg->nrelocs = 4096 / (4 * 4) ;
-    csg->relocs_bo = (struct radeon_bo_int**)calloc(1,
-                                                csg->nrelocs*sizeof(void*));
-    if (csg->relocs_bo == NULL) {
-        free(csg->base.packets);
-        free(csg);
-        return NULL;
-    }
-    csg->base.relocs = csg->relocs = (uint32_t*)calloc(1, 4096);
-    if (csg->relocs == NULL) {
-        free(csg->relocs_bo);
+    if (cs_gem_relocs_get((struct radeon_cs_manager_gem *)csm, &r)) {
         free(csg->base.packets);
         free(csg);
         return NULL;
     }
+    csg->base.id = generate_id();
+    csg->nrelocs = r.nrelocs;
+    csg->relocs_bo = r.relocs_bo;
+    csg->base.relocs = csg->relocs = r.relocs;
+    csg->reloc_map = r.reloc_map;
     csg->chunks[0].chunk_id = RADEON_CHUNK_ID_IB;
     csg->chunks[0].length_dw = 0;
     csg->chunks[0].chunk_data = (uint64_t)(uintptr_t)csg->base.packets;
@@ -169,6 +260,58 @@ static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
     return (struct radeon_cs_int*)csg;
 }
 
+/**
+ * Returns the slot of the reloc map holding handle, or the empty slot
+ * where it goes.
+ */
+static unsigned cs_gem_reloc_slot(struct cs_gem *csg, uint32_t handle)
+{
+    unsigned mask = RELOC_MAP_SIZE(csg->nrelocs) - 1;
+    unsigned slot = (handle * 0x9e3779b1u) & mask;
+
+    while (csg->reloc_map[slot]) {
+        if (csg->relocs[(csg->reloc_map[slot] - 1) * RELOC_SIZE] == handle)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * Doubles the reloc arrays and the map, so that a CS with n relocs only
+ * reallocates log(n) times.
+ */
+static int cs_gem_grow_relocs(struct cs_gem *csg)
+{
+    uint32_t *tmp, size, *map;
+    unsigned i;
+
+    size = ((csg->nrelocs * 2) * sizeof(struct radeon_bo*));
+    tmp = (uint32_t*)realloc(csg->relocs_bo, size);
+    if (tmp == NULL) {
+        return -ENOMEM;
+    }
+    csg->relocs_bo = (struct radeon_bo_int **)tmp;
+    size = ((csg->nrelocs * 2) * RELOC_SIZE * 4);
+    tmp = (uint32_t*)realloc(csg->relocs, size);
+    if (tmp == NULL) {
+        return -ENOMEM;
+    }
+    csg->base.relocs = csg->relocs = tmp;
+    csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
+    map = (uint32_t*)calloc(RELOC_MAP_SIZE(csg->nrelocs * 2), 4);
+    if (map == NULL) {
+        return -ENOMEM;
+    }
+    free(csg->reloc_map);
+    csg->reloc_map = map;
+    csg->nrelocs *= 2;
+    for (i = 0; i < csg->base.crelocs; i++) {
+        map[cs_gem_reloc_slot(csg, csg->relocs[i * RELOC_SIZE])] = i + 1;
+    }
+    return 0;
+}
+
 static int cs_gem_write_reloc(struct radeon_cs_int *cs,
                               struct radeon_bo *bo,
                               uint32_t read_domain,
@@ -179,7 +322,7 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     struct cs_gem *csg = (struct cs_gem*)cs;
     struct cs_reloc_gem *reloc;
     uint32_t idx;
-    unsigned i;
+    unsigned slot;
 
     assert(boi->space_accounted);
 
@@ -196,66 +339,47 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     if (write_domain == RADEON_GEM_DOMAIN_CPU) {
         return -EINVAL;
     }
-    /* use bit field hash function to determine
-       if this bo is for sure not in this cs.*/
-    if ((atomic_read((atomic_t *)radeon_gem_get_reloc_in_cs(bo)) & cs->id)) {
-        /* check if bo is already referenced.
-         * Scanning from end to begin reduces cycles with mesa because
-         * it often relocates same shared dma bo again. */
-        for(i = cs->crelocs; i != 0;) {
-            --i;
-            idx = i * RELOC_SIZE;
-            reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
-            if (reloc->handle == bo->handle) {
-                /* Check domains must be in read or write. As we check already
-                 * checked that in argument one of the read or write domain was
-                 * set we only need to check that if previous reloc as the read
-                 * domain set then the read_domain should also be set for this
-                 * new relocation.
-                 */
-                /* the DDX expects to read and write from same pixmap */
-                if (write_domain && (reloc->read_domain & write_domain)) {
-                    reloc->read_domain = 0;
-                    reloc->write_domain = write_domain;
-                } else if (read_domain & reloc->write_domain) {
-                    reloc->read_domain = 0;
-                } else {
-                    if (write_domain != reloc->write_domain)
-                        return -EINVAL;
-                    if (read_domain != reloc->read_domain)
-                        return -EINVAL;
-                }
-
-                reloc->read_domain |= read_domain;
-                reloc->write_domain |= write_domain;
-                /* update flags */
-                reloc->flags |= (flags & reloc->flags);
-                /* write relocation packet */
-                radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
-                radeon_cs_write_dword((struct radeon_cs *)cs, idx);
-                return 0;
-            }
+    /* check if bo is already referenced */
+    slot = cs_gem_reloc_slot(csg, bo->handle);
+    if (csg->reloc_map[slot]) {
+        idx = (csg->reloc_map[slot] - 1) * RELOC_SIZE;
+        reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
+        /* Check domains must be in read or write. As we check already
+         * checked that in argument one of the read or write domain was
+         * set we only need to check that if previous reloc as the read
+         * domain set then the read_domain should also be set for this
+         * new relocation.
+         */
+        /* the DDX expects to read and write from same pixmap */
+        if (write_domain && (reloc->read_domain & write_domain)) {
+            reloc->read_domain = 0;
+            reloc->write_domain = write_domain;
+        } else if (read_domain & reloc->write_domain) {
+            reloc->read_domain = 0;
+        } else {
+            if (write_domain != reloc->write_domain)
+                return -EINVAL;
+            if (read_domain != reloc->read_domain)
+                return -EINVAL;
         }
+
+        reloc->read_domain |= read_domain;
+        reloc->write_domain |= write_domain;
+        /* update flags */
+        reloc->flags |= (flags & reloc->flags);
+        /* write relocation packet */
+        radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
+        radeon_cs_write_dword((struct radeon_cs *)cs, idx);
+        return 0;
     }
     /* new relocation */
     if (csg->base.crelocs >= csg->nrelocs) {
-        /* allocate more memory (TODO: should use a slab allocator maybe) */
-        uint32_t *tmp, size;
-        size = ((csg->nrelocs + 1) * sizeof(struct radeon_bo*));
-        tmp = (uint32_t*)realloc(csg->relocs_bo, size);
-        if (tmp == NULL) {
-            return -ENOMEM;
-        }
-        csg->relocs_bo = (struct radeon_bo_int **)tmp;
-        size = ((csg->nrelocs + 1) * RELOC_SIZE * 4);
-        tmp = (uint32_t*)realloc(csg->relocs, size);
-        if (tmp == NULL) {
+        if (cs_gem_grow_relocs(csg)) {
             return -ENOMEM;
         }
-        cs->relocs = csg->relocs = tmp;
-        csg->nrelocs += 1;
-        csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
+        slot = cs_gem_reloc_slot(csg, bo->handle);
     }
+    csg->reloc_map[slot] = csg->base.crelocs + 1;
     csg->relocs_bo[csg->base.crelocs] = boi;
     idx = (csg->base.crelocs++) * RELOC_SIZE;
     reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
@@ -461,10 +585,17 @@ static int cs_gem_emit(struct radeon_cs_int *cs)
 static int cs_gem_destroy(struct radeon_cs_int *cs)
 {
     struct cs_gem *csg = (struct cs_gem*)cs;
+    struct cs_gem_relocs r;
 
     free_id(cs->id);
-    free(csg->relocs_bo);
-    free(cs->relocs);
+    if (cs->crelocs) {
+        memset(csg->reloc_map, 0, RELOC_MAP_SIZE(csg->nrelocs) * 4);
+    }
+    r.nrelocs = csg->nrelocs;
+    r.relocs = csg->relocs;
+    r.relocs_bo = csg->relocs_bo;
+    r.reloc_map = csg->reloc_map;
+    cs_gem_relocs_put((struct radeon_cs_manager_gem *)cs->csm, &r);
     free(cs->packets);
     free(cs);
     return 0;
@@ -485,6 +616,9 @@ static int cs_gem_erase(struct radeon_cs_int *cs)
             }
         }
     }
+    if (cs->crelocs) {
+        memset(csg->reloc_map, 0, RELOC_MAP_SIZE(csg->nrelocs) * 4);
+    }
     cs->relocs_total_size = 0;
     cs->cdw = 0;
     cs->section_ndw = 0;
@@ -546,11 +680,21 @@ drm_public struct radeon_cs_manager *radeon_cs_manager_gem_ctor(int fd)
     }
     csm->base.funcs = &radeon_cs_gem_funcs;
     csm->base.fd = fd;
+    pthread_mutex_init(&csm->pool_mutex, NULL);
     radeon_get_device_id(fd, &csm->device_id);
     return &csm->base;
 }
 
 drm_public void radeon_cs_manager_gem_dtor(struct radeon_cs_manager *csm)
 {
+    struct radeon_cs_manager_gem *csm_gem = (struct radeon_cs_manager_gem *)csm;
+    unsigned i;
+
+    for (i = 0; i < csm_gem->npool; i++) {
+        free(csm_gem->pool[i].relocs_bo);
+        free(csm_gem->pool[i].relocs);
+        free(csm_gem->pool[i].reloc_map);
+    }
+    pthread_mutex_destroy(&csm_gem->pool_mutex);
     free(csm);
 }
@@ -29,6 +29,8 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -111,6 +113,8 @@ struct radeon_hw_info {
     uint32_t                        macrotile_mode_array[16];
 };
 
+struct surface_cache;
+
 struct radeon_surface_manager {
     int                         fd;
     uint32_t                    device_id;
@@ -118,6 +122,7 @@ struct radeon_surface_manager {
     unsigned                    family;
     hw_init_surface_t           surface_init;
     hw_best_surface_t           surface_best;
+    struct surface_cache        *cache;
 };
 
 /* helper */
@@ -197,25 +202,11 @@ static void surf_minify(struct radeon_surface *surf,
 /* ===========================================================================
  * r600/r700 family
  */
-static int r6_init_hw_info(struct radeon_surface_manager *surf_man)
+/* Decodes RADEON_INFO_TILING_CONFIG, clearing allow_2d if it is invalid.
+ * The same goes for the later families. */
+static int r6_set_tiling_config(struct radeon_surface_manager *surf_man,
+                                uint32_t tiling_config)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
-
-    surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 14) {
-        surf_man->hw_info.allow_2d = 1;
-    }
-    drmFreeVersion(version);
-
     switch ((tiling_config & 0xe) >> 1) {
     case 0:
         surf_man->hw_info.num_pipes = 1;
@@ -263,6 +254,28 @@ static int r6_init_hw_info(struct radeon_surface_manager *surf_man)
     return 0;
 }
 
+static int r6_init_hw_info(struct radeon_surface_manager *surf_man)
+{
+    uint32_t tiling_config;
+    drmVersionPtr version;
+    int r;
+
+    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
+                         &tiling_config);
+    if (r) {
+        return r;
+    }
+
+    surf_man->hw_info.allow_2d = 0;
+    version = drmGetVersion(surf_man->fd);
+    if (version && version->version_minor >= 14) {
+        surf_man->hw_info.allow_2d = 1;
+    }
+    drmFreeVersion(version);
+
+    return r6_set_tiling_config(surf_man, tiling_config);
+}
+
 static int r6_surface_init_linear(struct radeon_surface_manager *surf_man,
                                   struct radeon_surface *surf,
                                   uint64_t offset, unsigned start_level)
@@ -482,25 +495,9 @@ static int r6_surface_best(struct radeon_surface_manager *surf_man,
 /* ===========================================================================
  * evergreen family
  */
-static int eg_init_hw_info(struct radeon_surface_manager *surf_man)
+static int eg_set_tiling_config(struct radeon_surface_manager *surf_man,
+                                uint32_t tiling_config)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
-
-    surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 16) {
-        surf_man->hw_info.allow_2d = 1;
-    }
-    drmFreeVersion(version);
-
     switch (tiling_config & 0xf) {
     case 0:
         surf_man->hw_info.num_pipes = 1;
@@ -567,6 +564,28 @@ static int eg_init_hw_info(struct radeon_surface_manager *surf_man)
     return 0;
 }
 
+static int eg_init_hw_info(struct radeon_surface_manager *surf_man)
+{
+    uint32_t tiling_config;
+    drmVersionPtr version;
+    int r;
+
+    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
+                         &tiling_config);
+    if (r) {
+        return r;
+    }
+
+    surf_man->hw_info.allow_2d = 0;
+    version = drmGetVersion(surf_man->fd);
+    if (version && version->version_minor >= 16) {
+        surf_man->hw_info.allow_2d = 1;
+    }
+    drmFreeVersion(version);
+
+    return eg_set_tiling_config(surf_man, tiling_config);
+}
+
 static void eg_surf_minify(struct radeon_surface *surf,
                            struct radeon_surface_level *surflevel,
                            unsigned bpe,
@@ -1196,27 +1215,9 @@ static void si_gb_tile_mode(uint32_t gb_tile_mode,
     }
 }
 
-static int si_init_hw_info(struct radeon_surface_manager *surf_man)
+static int si_set_tiling_config(struct radeon_surface_manager *surf_man,
+                                uint32_t tiling_config)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
-
-    surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 33) {
-        if (!radeon_get_value(surf_man->fd, RADEON_INFO_SI_TILE_MODE_ARRAY, surf_man->hw_info.tile_mode_array)) {
-            surf_man->hw_info.allow_2d = 1;
-        }
-    }
-    drmFreeVersion(version);
-
     switch (tiling_config & 0xf) {
     case 0:
         surf_man->hw_info.num_pipes = 1;
@@ -1283,6 +1284,30 @@ static int si_init_hw_info(struct radeon_surface_manager *surf_man)
     return 0;
 }
 
+static int si_init_hw_info(struct radeon_surface_manager *surf_man)
+{
+    uint32_t tiling_config;
+    drmVersionPtr version;
+    int r;
+
+    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
+                         &tiling_config);
+    if (r) {
+        return r;
+    }
+
+    surf_man->hw_info.allow_2d = 0;
+    version = drmGetVersion(surf_man->fd);
+    if (version && version->version_minor >= 33) {
+        if (!radeon_get_value(surf_man->fd, RADEON_INFO_SI_TILE_MODE_ARRAY, surf_man->hw_info.tile_mode_array)) {
+            surf_man->hw_info.allow_2d = 1;
+        }
+    }
+    drmFreeVersion(version);
+
+    return si_set_tiling_config(surf_man, tiling_config);
+}
+
 static int si_surface_sanity(struct radeon_surface_manager *surf_man,
                              struct radeon_surface *surf,
                              unsigned mode, unsigned *tile_mode, unsigned *stencil_tile_mode)
@@ -2025,28 +2050,9 @@ static void cik_get_2d_params(struct radeon_surface_manager *surf_man,
     }
 }
 
-static int cik_init_hw_info(struct radeon_surface_manager *surf_man)
+static int cik_set_tiling_config(struct radeon_surface_manager *surf_man,
+                                 uint32_t tiling_config)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
-
-    surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 35) {
-        if (!radeon_get_value(surf_man->fd, RADEON_INFO_SI_TILE_MODE_ARRAY, surf_man->hw_info.tile_mode_array) &&
-	    !radeon_get_value(surf_man->fd, RADEON_INFO_CIK_MACROTILE_MODE_ARRAY, surf_man->hw_info.macrotile_mode_array)) {
-            surf_man->hw_info.allow_2d = 1;
-        }
-    }
-    drmFreeVersion(version);
-
     switch (tiling_config & 0xf) {
     case 0:
         surf_man->hw_info.num_pipes = 1;
@@ -2113,6 +2119,31 @@ static int cik_init_hw_info(struct radeon_surface_manager *surf_man)
     return 0;
 }
 
+static int cik_init_hw_info(struct radeon_surface_manager *surf_man)
+{
+    uint32_t tiling_config;
+    drmVersionPtr version;
+    int r;
+
+    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
+                         &tiling_config);
+    if (r) {
+        return r;
+    }
+
+    surf_man->hw_info.allow_2d = 0;
+    version = drmGetVersion(surf_man->fd);
+    if (version && version->version_minor >= 35) {
+        if (!radeon_get_value(surf_man->fd, RADEON_INFO_SI_TILE_MODE_ARRAY, surf_man->hw_info.tile_mode_array) &&
+	    !radeon_get_value(surf_man->fd, RADEON_INFO_CIK_MACROTILE_MODE_ARRAY, surf_man->hw_info.macrotile_mode_array)) {
+            surf_man->hw_info.allow_2d = 1;
+        }
+    }
+    drmFreeVersion(version);
+
+    return cik_set_tiling_config(surf_man, tiling_config);
+}
+
 static int cik_surface_sanity(struct radeon_surface_manager *surf_man,
                               struct radeon_surface *surf,
                               unsigned mode, unsigned *tile_mode, unsigned *stencil_tile_mode)
@@ -2405,13 +2436,273 @@ static int cik_surface_best(struct radeon_surface_manager *surf_man,
 }
 
 
+/* ===========================================================================
+ * layout cache
+ */
+
+/* Every field of radeon_surface outside the per level arrays. They are the
+ * description of the surface and, since some are updated by the layout,
+ * also the result, together with the arrays. */
+struct surface_head {
+    uint32_t                    npix_x;
+    uint32_t                    npix_y;
+    uint32_t                    npix_z;
+    uint32_t                    blk_w;
+    uint32_t                    blk_h;
+    uint32_t                    blk_d;
+    uint32_t                    array_size;
+    uint32_t                    last_level;
+    uint32_t                    bpe;
+    uint32_t                    nsamples;
+    uint32_t                    flags;
+    uint32_t                    bankw;
+    uint32_t                    bankh;
+    uint32_t                    mtilea;
+    uint32_t                    tile_split;
+    uint32_t                    stencil_tile_split;
+    uint64_t                    bo_size;
+    uint64_t                    bo_alignment;
+    uint64_t                    stencil_offset;
+};
+
+struct surface_cache_entry {
+    struct surface_cache_entry  *next;
+    uint32_t                    hash;
+    struct surface_head         key;
+    struct surface_head         result;
+    uint32_t                    tiling_index[RADEON_SURF_MAX_LEVEL];
+    uint32_t                    stencil_tiling_index[RADEON_SURF_MAX_LEVEL];
+    /* nlevels levels, then nlevels stencil levels if the surface has them */
+    unsigned                    nlevels;
+    struct radeon_surface_level level[];
+};
+
+struct surface_cache {
+    pthread_mutex_t             mutex;
+    unsigned                    max_entries;
+    unsigned                    mask;
+    struct surface_cache_entry  **table;
+    struct radeon_surface_cache_stats stats;
+};
+
+static void surface_head_get(struct surface_head *head,
+                             const struct radeon_surface *surf)
+{
+    head->npix_x = surf->npix_x;
+    head->npix_y = surf->npix_y;
+    head->npix_z = surf->npix_z;
+    head->blk_w = surf->blk_w;
+    head->blk_h = surf->blk_h;
+    head->blk_d = surf->blk_d;
+    head->array_size = surf->array_size;
+    head->last_level = surf->last_level;
+    head->bpe = surf->bpe;
+    head->nsamples = surf->nsamples;
+    head->flags = surf->flags;
+    head->bankw = surf->bankw;
+    head->bankh = surf->bankh;
+    head->mtilea = surf->mtilea;
+    head->tile_split = surf->tile_split;
+    head->stencil_tile_split = surf->stencil_tile_split;
+    head->bo_size = surf->bo_size;
+    head->bo_alignment = surf->bo_alignment;
+    head->stencil_offset = surf->stencil_offset;
+}
+
+static void surface_head_set(struct radeon_surface *surf,
+                             const struct surface_head *head)
+{
+    surf->npix_x = head->npix_x;
+    surf->npix_y = head->npix_y;
+    surf->npix_z = head->npix_z;
+    surf->blk_w = head->blk_w;
+    surf->blk_h = head->blk_h;
+    surf->blk_d = head->blk_d;
+    surf->array_size = head->array_size;
+    surf->last_level = head->last_level;
+    surf->bpe = head->bpe;
+    surf->nsamples = head->nsamples;
+    surf->flags = head->flags;
+    surf->bankw = head->bankw;
+    surf->bankh = head->bankh;
+    surf->mtilea = head->mtilea;
+    surf->tile_split = head->tile_split;
+    surf->stencil_tile_split = head->stencil_tile_split;
+    surf->bo_size = head->bo_size;
+    surf->bo_alignment = head->bo_alignment;
+    surf->stencil_offset = head->stencil_offset;
+}
+
+static uint32_t surface_head_hash(const struct surface_head *head)
+{
+    const uint32_t *p = (const uint32_t *)head;
+    uint32_t hash = 2166136261u;
+    unsigned i;
+
+    for (i = 0; i < sizeof(*head) / 4; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    /* the low bits, which pick the bucket, only saw the low bits of each
+     * field so far */
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+/* Old headers had neither the stencil levels nor the tiling indices, so
+ * they are only touched when the flags say the caller has them, as the
+ * layout code does. */
+static int surface_has_stencil_levels(uint32_t flags)
+{
+    return (flags & RADEON_SURF_HAS_SBUFFER_MIPTREE) &&
+           (flags & RADEON_SURF_SBUFFER);
+}
+
+static void surface_cache_flush(struct surface_cache *cache)
+{
+    struct surface_cache_entry *entry, *next;
+    unsigned i;
+
+    for (i = 0; i <= cache->mask; i++) {
+        for (entry = cache->table[i]; entry; entry = next) {
+            next = entry->next;
+            free(entry);
+        }
+        cache->table[i] = NULL;
+    }
+    cache->stats.entries = 0;
+}
+
+static struct surface_cache_entry *
+surface_cache_find(struct surface_cache *cache, const struct surface_head *key,
+                   uint32_t hash)
+{
+    struct surface_cache_entry *entry;
+
+    for (entry = cache->table[hash & cache->mask]; entry; entry = entry->next) {
+        if (entry->hash == hash && !memcmp(&entry->key, key, sizeof(*key))) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Copies the layout of the surface described by key, if known, to surf.
+ */
+static int surface_cache_lookup(struct surface_cache *cache,
+                                const struct surface_head *key, uint32_t hash,
+                                struct radeon_surface *surf)
+{
+    struct surface_cache_entry *entry;
+    unsigned n;
+
+    pthread_mutex_lock(&cache->mutex);
+    entry = surface_cache_find(cache, key, hash);
+    if (entry == NULL) {
+        cache->stats.misses++;
+        pthread_mutex_unlock(&cache->mutex);
+        return 0;
+    }
+    cache->stats.hits++;
+    n = entry->nlevels;
+    surface_head_set(surf, &entry->result);
+    memcpy(surf->level, entry->level, n * sizeof(surf->level[0]));
+    if (surface_has_stencil_levels(entry->result.flags)) {
+        memcpy(surf->stencil_level, entry->level + n,
+               n * sizeof(surf->stencil_level[0]));
+    }
+    if (entry->result.flags & RADEON_SURF_HAS_TILE_MODE_INDEX) {
+        memcpy(surf->tiling_index, entry->tiling_index, n * 4);
+        memcpy(surf->stencil_tiling_index, entry->stencil_tiling_index, n * 4);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return 1;
+}
+
+static void surface_cache_insert(struct surface_cache *cache,
+                                 const struct surface_head *key, uint32_t hash,
+                                 const struct radeon_surface *surf)
+{
+    struct surface_cache_entry *entry;
+    unsigned n, nlevels;
+
+    if (surf->last_level >= RADEON_SURF_MAX_LEVEL) {
+        return;
+    }
+    n = surf->last_level + 1;
+    nlevels = surface_has_stencil_levels(surf->flags) ? 2 * n : n;
+    entry = malloc(sizeof(*entry) + nlevels * sizeof(entry->level[0]));
+    if (entry == NULL) {
+        return;
+    }
+    entry->hash = hash;
+    entry->key = *key;
+    surface_head_get(&entry->result, surf);
+    entry->nlevels = n;
+    memcpy(entry->level, surf->level, n * sizeof(surf->level[0]));
+    if (nlevels > n) {
+        memcpy(entry->level + n, surf->stencil_level,
+               n * sizeof(surf->stencil_level[0]));
+    }
+    if (surf->flags & RADEON_SURF_HAS_TILE_MODE_INDEX) {
+        memcpy(entry->tiling_index, surf->tiling_index, n * 4);
+        memcpy(entry->stencil_tiling_index, surf->stencil_tiling_index, n * 4);
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    if (surface_cache_find(cache, key, hash)) {
+        /* another thread laid it out too */
+        pthread_mutex_unlock(&cache->mutex);
+        free(entry);
+        return;
+    }
+    if (cache->stats.entries >= cache->max_entries) {
+        surface_cache_flush(cache);
+    }
+    entry->next = cache->table[hash & cache->mask];
+    cache->table[hash & cache->mask] = entry;
+    cache->stats.entries++;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+static void surface_cache_free(struct surface_cache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    surface_cache_flush(cache);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->table);
+    free(cache);
+}
+
 /* ===========================================================================
  * public API
  */
+static void radeon_surface_set_hooks(struct radeon_surface_manager *surf_man)
+{
+    if (surf_man->family <= CHIP_RV740) {
+        surf_man->surface_init = &r6_surface_init;
+        surf_man->surface_best = &r6_surface_best;
+    } else if (surf_man->family <= CHIP_ARUBA) {
+        surf_man->surface_init = &eg_surface_init;
+        surf_man->surface_best = &eg_surface_best;
+    } else if (surf_man->family < CHIP_BONAIRE) {
+        surf_man->surface_init = &si_surface_init;
+        surf_man->surface_best = &si_surface_best;
+    } else {
+        surf_man->surface_init = &cik_surface_init;
+        surf_man->surface_best = &cik_surface_best;
+    }
+}
+
 drm_public struct radeon_surface_manager *
 radeon_surface_manager_new(int fd)
 {
     struct radeon_surface_manager *surf_man;
+    int r;
 
     surf_man = calloc(1, sizeof(struct radeon_surface_manager));
     if (surf_man == NULL) {
@@ -2426,30 +2717,64 @@ radeon_surface_manager_new(int fd)
     }
 
     if (surf_man->family <= CHIP_RV740) {
-        if (r6_init_hw_info(surf_man)) {
-            goto out_err;
-        }
-        surf_man->surface_init = &r6_surface_init;
-        surf_man->surface_best = &r6_surface_best;
+        r = r6_init_hw_info(surf_man);
     } else if (surf_man->family <= CHIP_ARUBA) {
-        if (eg_init_hw_info(surf_man)) {
-            goto out_err;
-        }
-        surf_man->surface_init = &eg_surface_init;
-        surf_man->surface_best = &eg_surface_best;
+        r = eg_init_hw_info(surf_man);
     } else if (surf_man->family < CHIP_BONAIRE) {
-        if (si_init_hw_info(surf_man)) {
-            goto out_err;
-        }
-        surf_man->surface_init = &si_surface_init;
-        surf_man->surface_best = &si_surface_best;
+        r = si_init_hw_info(surf_man);
     } else {
-        if (cik_init_hw_info(surf_man)) {
-            goto out_err;
-        }
-        surf_man->surface_init = &cik_surface_init;
-        surf_man->surface_best = &cik_surface_best;
+        r = cik_init_hw_info(surf_man);
     }
+    if (r) {
+        goto out_err;
+    }
+    radeon_surface_set_hooks(surf_man);
+
+    return surf_man;
+out_err:
+    free(surf_man);
+    return NULL;
+}
+
+drm_public struct radeon_surface_manager *
+radeon_surface_manager_new_from_config(const struct radeon_surface_hw_config *config)
+{
+    struct radeon_surface_manager *surf_man;
+    int r;
+
+    if (config == NULL) {
+        return NULL;
+    }
+    surf_man = calloc(1, sizeof(struct radeon_surface_manager));
+    if (surf_man == NULL) {
+        return NULL;
+    }
+    surf_man->fd = -1;
+    surf_man->device_id = config->device_id;
+    if (radeon_get_family(surf_man)) {
+        goto out_err;
+    }
+
+    /* as with a kernel recent enough for 2D tiling on every family */
+    surf_man->hw_info.allow_2d = 1;
+    memcpy(surf_man->hw_info.tile_mode_array, config->tile_mode_array,
+           sizeof(surf_man->hw_info.tile_mode_array));
+    memcpy(surf_man->hw_info.macrotile_mode_array,
+           config->macrotile_mode_array,
+           sizeof(surf_man->hw_info.macrotile_mode_array));
+    if (surf_man->family <= CHIP_RV740) {
+        r = r6_set_tiling_config(surf_man, config->tiling_config);
+    } else if (surf_man->family <= CHIP_ARUBA) {
+        r = eg_set_tiling_config(surf_man, config->tiling_config);
+    } else if (surf_man->family < CHIP_BONAIRE) {
+        r = si_set_tiling_config(surf_man, config->tiling_config);
+    } else {
+        r = cik_set_tiling_config(surf_man, config->tiling_config);
+    }
+    if (r) {
+        goto out_err;
+    }
+    radeon_surface_set_hooks(surf_man);
 
     return surf_man;
 out_err:
@@ -2460,9 +2785,60 @@ out_err:
 drm_public void
 radeon_surface_manager_free(struct radeon_surface_manager *surf_man)
 {
+    if (surf_man) {
+        surface_cache_free(surf_man->cache);
+    }
     free(surf_man);
 }
 
+drm_public int
+radeon_surface_manager_enable_cache(struct radeon_surface_manager *surf_man,
+                                    unsigned max_entries)
+{
+    struct surface_cache *cache;
+    unsigned size;
+
+    if (surf_man == NULL) {
+        return -EINVAL;
+    }
+    surface_cache_free(surf_man->cache);
+    surf_man->cache = NULL;
+    if (!max_entries) {
+        return 0;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return -ENOMEM;
+    }
+    /* about two buckets per entry */
+    for (size = 16; size < 2 * max_entries && size < (1u << 20); size *= 2);
+    cache->table = calloc(size, sizeof(cache->table[0]));
+    if (cache->table == NULL) {
+        free(cache);
+        return -ENOMEM;
+    }
+    cache->mask = size - 1;
+    cache->max_entries = max_entries;
+    pthread_mutex_init(&cache->mutex, NULL);
+    surf_man->cache = cache;
+    return 0;
+}
+
+drm_public void
+radeon_surface_manager_get_cache_stats(struct radeon_surface_manager *surf_man,
+                                       struct radeon_surface_cache_stats *stats)
+{
+    struct surface_cache *cache = surf_man->cache;
+
+    memset(stats, 0, sizeof(*stats));
+    if (cache) {
+        pthread_mutex_lock(&cache->mutex);
+        *stats = cache->stats;
+        pthread_mutex_unlock(&cache->mutex);
+    }
+}
+
 static int radeon_surface_sanity(struct radeon_surface_manager *surf_man,
                                  struct radeon_surface *surf,
                                  unsigned type,
@@ -2535,9 +2911,22 @@ drm_public int
 radeon_surface_init(struct radeon_surface_manager *surf_man,
                     struct radeon_surface *surf)
 {
+    struct surface_cache *cache;
+    struct surface_head key;
     unsigned mode, type;
+    uint32_t hash = 0;
     int r;
 
+    /* a single level is laid out faster than it is looked up */
+    cache = surf_man && surf && surf->last_level ? surf_man->cache : NULL;
+    if (cache) {
+        surface_head_get(&key, surf);
+        hash = surface_head_hash(&key);
+        if (surface_cache_lookup(cache, &key, hash, surf)) {
+            return 0;
+        }
+    }
+
     type = RADEON_SURF_GET(surf->flags, TYPE);
     mode = RADEON_SURF_GET(surf->flags, MODE);
 
@@ -2545,9 +2934,14 @@ radeon_surface_init(struct radeon_surface_manager *surf_man,
     if (r) {
         return r;
     }
-    return surf_man->surface_init(surf_man, surf);
+    r = surf_man->surface_init(surf_man, surf);
+    if (!r && cache) {
+        surface_cache_insert(cache, &key, hash, surf);
+    }
+    return r;
 }
 
+/* Not cached, as it is cheaper than looking it up. */
 drm_public int
 radeon_surface_best(struct radeon_surface_manager *surf_man,
                     struct radeon_surface *surf)
@@ -2564,3 +2958,23 @@ radeon_surface_best(struct radeon_surface_manager *surf_man,
     }
     return surf_man->surface_best(surf_man, surf);
 }
+
+drm_public int
+radeon_surface_init_batch(struct radeon_surface_manager *surf_man,
+                          struct radeon_surface *surfs, unsigned count,
+                          int *results)
+{
+    unsigned i;
+    int r, ret = 0;
+
+    for (i = 0; i < count; i++) {
+        r = radeon_surface_init(surf_man, &surfs[i]);
+        if (results) {
+            results[i] = r;
+        }
+        if (r && !ret) {
+            ret = r;
+        }
+    }
+    return ret;
+}
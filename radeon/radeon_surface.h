@@ -139,11 +139,53 @@ struct radeon_surface {
     uint32_t                    stencil_tiling_index[RADEON_SURF_MAX_LEVEL];
 };
 
+/* What radeon_surface_manager_new reads from the kernel, to lay out surfaces
+ * without a device.
+ */
+struct radeon_surface_hw_config {
+    /* PCI device id, which gives the family */
+    uint32_t                    device_id;
+    /* RADEON_INFO_TILING_CONFIG */
+    uint32_t                    tiling_config;
+    /* RADEON_INFO_SI_TILE_MODE_ARRAY, apply to si and cik */
+    uint32_t                    tile_mode_array[32];
+    /* RADEON_INFO_CIK_MACROTILE_MODE_ARRAY, apply to cik */
+    uint32_t                    macrotile_mode_array[16];
+};
+
 struct radeon_surface_manager *radeon_surface_manager_new(int fd);
+struct radeon_surface_manager *
+radeon_surface_manager_new_from_config(const struct radeon_surface_hw_config *config);
 void radeon_surface_manager_free(struct radeon_surface_manager *surf_man);
+
 int radeon_surface_init(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
 int radeon_surface_best(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
+/* Calls radeon_surface_init on each of the count surfaces and, if results
+ * isn't NULL, stores what it returned in results. Returns the error of the
+ * first surface which couldn't be laid out, or 0.
+ */
+int radeon_surface_init_batch(struct radeon_surface_manager *surf_man,
+                              struct radeon_surface *surfs, unsigned count,
+                              int *results);
+
+struct radeon_surface_cache_stats {
+    uint64_t                    hits;
+    uint64_t                    misses;
+    uint32_t                    entries;
+};
+
+/* Makes radeon_surface_init remember the layouts of up to max_entries
+ * mipmapped surfaces and copy them to later surfaces with the same
+ * description, which is every field outside the level arrays, instead of
+ * computing them again. The arrays are copied up to last_level. The cache
+ * is emptied when full; a max_entries of 0 removes it. Returns 0 or a
+ * negative errno.
+ */
+int radeon_surface_manager_enable_cache(struct radeon_surface_manager *surf_man,
+                                        unsigned max_entries);
+void radeon_surface_manager_get_cache_stats(struct radeon_surface_manager *surf_man,
+                                            struct radeon_surface_cache_stats *stats);
 
 #endif
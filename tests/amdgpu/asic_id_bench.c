@@ -0,0 +1,202 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Startup cost of the marketing name lookup done by every
+ * amdgpu_device_initialize, with the text amdgpu.ids and with the binary
+ * table generated from it. amdgpu_asic_id.c is built into this program, so
+ * no device is needed. Every device listed in the text file, and one that
+ * is not, must get the same name from both, and a text file which does not
+ * match the binary table must make the lookup fall back.
+ *
+ * Usage: amdgpu_asic_id_bench <amdgpu.ids> <amdgpu.ids.bin>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+#define MAX_IDS		4096
+#define ITERATIONS	2000
+
+struct asic_id {
+	uint32_t did;
+	uint32_t rid;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int read_ids(const char *path, struct asic_id *ids)
+{
+	char line[256];
+	int n = 0, version = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	while (n < MAX_IDS && fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (!version++)
+			continue;
+		if (sscanf(line, "%x,%x", &ids[n].did, &ids[n].rid) == 2)
+			n++;
+	}
+
+	fclose(fp);
+	return n;
+}
+
+static void set_id(struct amdgpu_device *dev, const struct asic_id *id)
+{
+	free(dev->marketing_name);
+	dev->marketing_name = NULL;
+	dev->info.asic_id = id->did;
+	dev->info.pci_rev_id = id->rid;
+}
+
+static int check(const char *text, const char *bin,
+		 const struct asic_id *ids, int count)
+{
+	struct amdgpu_device dev;
+	char *name;
+	int i, r;
+
+	memset(&dev, 0, sizeof(dev));
+	for (i = 0; i <= count; i++) {
+		struct asic_id missing = { 0xffff, 0xff };
+		const struct asic_id *id = i < count ? &ids[i] : &missing;
+
+		set_id(&dev, id);
+		amdgpu_parse_asic_ids_text(&dev, text);
+		name = dev.marketing_name;
+		dev.marketing_name = NULL;
+
+		r = amdgpu_find_asic_id_bin(&dev, text, bin);
+		if ((r && r != -ENOENT) || !name != !dev.marketing_name ||
+		    (name && strcmp(name, dev.marketing_name))) {
+			fprintf(stderr, "%04x:%02x: text \"%s\", binary \"%s\" (%d)\n",
+				id->did, id->rid, name ? name : "",
+				dev.marketing_name ? dev.marketing_name : "", r);
+			free(name);
+			return 1;
+		}
+		free(name);
+	}
+
+	free(dev.marketing_name);
+	return 0;
+}
+
+static int check_stale(const char *bin)
+{
+	char path[] = "/tmp/amdgpu.ids.XXXXXX";
+	struct amdgpu_device dev;
+	int fd, r;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	r = write(fd, "1.0.0\n", 6) == 6 ? 0 : 1;
+	close(fd);
+
+	memset(&dev, 0, sizeof(dev));
+	if (!r && amdgpu_find_asic_id_bin(&dev, path, bin) != -EAGAIN) {
+		fprintf(stderr, "stale binary table was used\n");
+		r = 1;
+	}
+
+	unlink(path);
+	free(dev.marketing_name);
+	return r;
+}
+
+static void bench(const char *text, const char *bin, const struct asic_id *id)
+{
+	struct amdgpu_device dev;
+	uint64_t start, text_ns, bin_ns;
+	int i;
+
+	memset(&dev, 0, sizeof(dev));
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		set_id(&dev, id);
+		amdgpu_parse_asic_ids_text(&dev, text);
+	}
+	text_ns = (now_ns() - start) / ITERATIONS;
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		set_id(&dev, id);
+		amdgpu_find_asic_id_bin(&dev, text, bin);
+	}
+	bin_ns = (now_ns() - start) / ITERATIONS;
+
+	printf("%04x:%02x: text %8.2f us, binary %6.2f us per lookup\n",
+	       id->did, id->rid, text_ns / 1000.0, bin_ns / 1000.0);
+	free(dev.marketing_name);
+}
+
+int main(int argc, char **argv)
+{
+	static struct asic_id ids[MAX_IDS];
+	struct asic_id missing = { 0xffff, 0xff };
+	int count;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <amdgpu.ids> <amdgpu.ids.bin>\n",
+			argv[0]);
+		return 1;
+	}
+
+	count = read_ids(argv[1], ids);
+	if (count <= 0) {
+		fprintf(stderr, "%s: no ASIC IDs\n", argv[1]);
+		return 1;
+	}
+
+	if (check(argv[1], argv[2], ids, count) || check_stale(argv[2]))
+		return 1;
+
+	/* First, last and missing entries of the text file. */
+	bench(argv[1], argv[2], &ids[0]);
+	bench(argv[1], argv[2], &ids[count - 1]);
+	bench(argv[1], argv[2], &missing);
+
+	return 0;
+}
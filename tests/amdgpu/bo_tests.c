@@ -46,6 +46,7 @@ static void amdgpu_bo_map_unmap(void);
 static void amdgpu_memory_alloc(void);
 static void amdgpu_mem_fail_alloc(void);
 static void amdgpu_bo_find_by_cpu_mapping(void);
+static void amdgpu_bo_cache(void);
 
 CU_TestInfo bo_tests[] = {
 	{ "Export/Import",  amdgpu_bo_export_import },
@@ -54,6 +55,7 @@ CU_TestInfo bo_tests[] = {
 	{ "Memory alloc Test",  amdgpu_memory_alloc },
 	{ "Memory fail alloc Test",  amdgpu_mem_fail_alloc },
 	{ "Find bo by CPU mapping",  amdgpu_bo_find_by_cpu_mapping },
+	{ "BO reuse cache",  amdgpu_bo_cache },
 	CU_TEST_INFO_NULL,
 };
 
@@ -315,3 +317,62 @@ static void amdgpu_bo_find_by_cpu_mapping(void)
 				     bo_mc_address, 4096);
 	CU_ASSERT_EQUAL(r, 0);
 }
+
+static void amdgpu_bo_cache(void)
+{
+	struct amdgpu_bo_alloc_request req = {0};
+	struct amdgpu_bo_cache_stats stats;
+	amdgpu_bo_handle bo, bo2;
+	uint32_t handle;
+	uint64_t hits;
+	int r;
+
+	r = amdgpu_bo_cache_enable(device_handle, 1000, 16 * 1024 * 1024);
+	CU_ASSERT_EQUAL(r, 0);
+
+	r = amdgpu_bo_cache_query_stats(device_handle, &stats);
+	CU_ASSERT_EQUAL(r, 0);
+	hits = stats.hits;
+
+	req.alloc_size = 5000;
+	req.phys_alignment = 4096;
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+
+	r = amdgpu_bo_alloc(device_handle, &req, &bo);
+	CU_ASSERT_EQUAL(r, 0);
+	CU_ASSERT_EQUAL(bo->alloc_size, 8192);
+	handle = bo->handle;
+
+	r = amdgpu_bo_free(bo);
+	CU_ASSERT_EQUAL(r, 0);
+
+	/* A different heap must not get the cached buffer. */
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_VRAM;
+	r = amdgpu_bo_alloc(device_handle, &req, &bo2);
+	CU_ASSERT_EQUAL(r, 0);
+	CU_ASSERT_NOT_EQUAL(bo2->handle, handle);
+
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	r = amdgpu_bo_alloc(device_handle, &req, &bo);
+	CU_ASSERT_EQUAL(r, 0);
+	CU_ASSERT_EQUAL(bo->handle, handle);
+
+	r = amdgpu_bo_cache_query_stats(device_handle, &stats);
+	CU_ASSERT_EQUAL(r, 0);
+	CU_ASSERT_EQUAL(stats.hits, hits + 1);
+
+	r = amdgpu_bo_free(bo);
+	CU_ASSERT_EQUAL(r, 0);
+	r = amdgpu_bo_free(bo2);
+	CU_ASSERT_EQUAL(r, 0);
+
+	r = amdgpu_bo_cache_trim(device_handle, 0);
+	CU_ASSERT_EQUAL(r, 0);
+	r = amdgpu_bo_cache_query_stats(device_handle, &stats);
+	CU_ASSERT_EQUAL(r, 0);
+	CU_ASSERT_EQUAL(stats.cached_count, 0);
+	CU_ASSERT_EQUAL(stats.cached_bytes, 0);
+
+	r = amdgpu_bo_cache_enable(device_handle, 0, 0);
+	CU_ASSERT_EQUAL(r, 0);
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Multi-threaded stress benchmark for the BO handle table. Reader threads
+ * look up random keys while a writer keeps removing, re-inserting and
+ * growing the table, the way amdgpu_bo_import and amdgpu_bo_free use it.
+ * Removed entries are poisoned after handle_table_synchronize, so a reader
+ * that sees a poisoned entry means the lockless read side is broken.
+ * Lockless lookups are compared with lookups under a mutex shared with the
+ * writer, which is what every import used to do.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "handle_table.h"
+
+#define NUM_KEYS	65536
+#define MAX_THREADS	16
+#define RUN_NS		500000000ull
+#define POISON		0xdeadbeefu
+
+struct entry {
+	uint32_t key;
+};
+
+struct bench {
+	struct handle_table table;
+	pthread_mutex_t mutex;
+	bool locked;
+	volatile bool stop;
+	unsigned long lookups[MAX_THREADS];
+	unsigned long errors[MAX_THREADS];
+	unsigned long writes;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t next_rand(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+struct reader_args {
+	struct bench *bench;
+	unsigned index;
+};
+
+static void *reader(void *data)
+{
+	struct reader_args *args = data;
+	struct bench *b = args->bench;
+	uint32_t state = 0x12345u + args->index * 7919;
+	unsigned long lookups = 0, errors = 0;
+
+	while (!b->stop) {
+		uint32_t key = next_rand(&state) % NUM_KEYS;
+		struct entry *e;
+
+		if (b->locked) {
+			pthread_mutex_lock(&b->mutex);
+			e = handle_table_lookup(&b->table, key);
+			if (e && e->key != key)
+				errors++;
+			pthread_mutex_unlock(&b->mutex);
+		} else {
+			int idx = handle_table_read_lock(&b->table);
+
+			e = handle_table_lookup(&b->table, key);
+			if (e && e->key != key)
+				errors++;
+			handle_table_read_unlock(&b->table, idx);
+		}
+		lookups++;
+	}
+
+	b->lookups[args->index] = lookups;
+	b->errors[args->index] = errors;
+	return NULL;
+}
+
+static void *writer(void *data)
+{
+	struct bench *b = data;
+	uint32_t state = 0xcafeu;
+	uint32_t grow_key = NUM_KEYS;
+
+	while (!b->stop) {
+		uint32_t key = next_rand(&state) % NUM_KEYS;
+		struct entry *old, *new = malloc(sizeof(*new));
+
+		if (!new)
+			break;
+		new->key = key;
+
+		pthread_mutex_lock(&b->mutex);
+		old = handle_table_lookup(&b->table, key);
+		handle_table_remove(&b->table, key);
+		if (!b->locked)
+			handle_table_synchronize(&b->table);
+		if (old) {
+			old->key = POISON;
+			free(old);
+		}
+		handle_table_insert(&b->table, key, new);
+
+		/* Keep growing the table so readers see array swaps. */
+		if (b->writes % 64 == 0) {
+			struct entry *g = malloc(sizeof(*g));
+
+			if (g) {
+				g->key = grow_key;
+				if (handle_table_insert(&b->table, grow_key++, g))
+					free(g);
+			}
+		}
+		pthread_mutex_unlock(&b->mutex);
+		b->writes++;
+	}
+
+	return NULL;
+}
+
+static int run(unsigned num_readers, bool locked)
+{
+	struct reader_args args[MAX_THREADS];
+	pthread_t threads[MAX_THREADS], writer_thread;
+	struct bench *b = calloc(1, sizeof(*b));
+	unsigned long lookups = 0, errors = 0;
+	uint32_t i, max_key;
+	uint64_t start;
+
+	if (!b)
+		return 1;
+
+	pthread_mutex_init(&b->mutex, NULL);
+	handle_table_init(&b->table);
+	b->locked = locked;
+	for (i = 0; i < NUM_KEYS; i++) {
+		struct entry *e = malloc(sizeof(*e));
+
+		if (!e)
+			return 1;
+		e->key = i;
+		handle_table_insert(&b->table, i, e);
+	}
+
+	start = now_ns();
+	for (i = 0; i < num_readers; i++) {
+		args[i].bench = b;
+		args[i].index = i;
+		pthread_create(&threads[i], NULL, reader, &args[i]);
+	}
+	pthread_create(&writer_thread, NULL, writer, b);
+
+	while (now_ns() - start < RUN_NS) {
+		struct timespec ts = { 0, 10000000 };
+
+		nanosleep(&ts, NULL);
+	}
+	b->stop = true;
+
+	for (i = 0; i < num_readers; i++) {
+		pthread_join(threads[i], NULL);
+		lookups += b->lookups[i];
+		errors += b->errors[i];
+	}
+	pthread_join(writer_thread, NULL);
+
+	printf("%2u readers, %-8s: %7.2f Mlookups/s, %7.3f Mwrites/s%s\n",
+	       num_readers, locked ? "mutex" : "lockless",
+	       lookups * 1000.0 / RUN_NS, b->writes * 1000.0 / RUN_NS,
+	       errors ? ", STALE ENTRIES SEEN" : "");
+
+	max_key = handle_table_max_key(&b->table);
+	for (i = 0; i < max_key; i++)
+		free(handle_table_lookup(&b->table, i));
+	handle_table_fini(&b->table);
+	pthread_mutex_destroy(&b->mutex);
+	free(b);
+
+	return errors ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned readers[] = { 1, 2, 4, 8 };
+	unsigned i;
+	int ret = 0;
+
+	for (i = 0; i < sizeof(readers) / sizeof(readers[0]); i++) {
+		ret |= run(readers[i], true);
+		ret |= run(readers[i], false);
+	}
+
+	return ret;
+}
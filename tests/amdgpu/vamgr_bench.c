@@ -0,0 +1,171 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Alloc/free churn benchmark for the VA range manager. The manager has no
+ * kernel dependency, so amdgpu_vamgr.c is built into this program and
+ * driven through amdgpu_va_range_alloc/free with a device that only has
+ * its VA managers initialized. After the churn all live ranges are checked
+ * for overlaps, and freeing them must give back a single hole.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+#define VA_START	(1ull << 20)
+#define VA_END		(1ull << 47)
+#define VA_ALIGNMENT	4096
+
+struct live_range {
+	amdgpu_va_handle handle;
+	uint64_t address;
+	uint64_t size;
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+	const struct live_range *ra = a, *rb = b;
+
+	if (ra->address != rb->address)
+		return ra->address < rb->address ? -1 : 1;
+	return 0;
+}
+
+static int check_ranges(struct live_range *ranges, unsigned count)
+{
+	unsigned i, n = 0;
+
+	for (i = 0; i < count; i++)
+		if (ranges[i].handle)
+			ranges[n++] = ranges[i];
+
+	qsort(ranges, n, sizeof(*ranges), compare_ranges);
+	for (i = 1; i < n; i++) {
+		if (ranges[i - 1].address + ranges[i - 1].size > ranges[i].address) {
+			fprintf(stderr, "overlap: 0x%" PRIx64 "+0x%" PRIx64
+				" and 0x%" PRIx64 "\n", ranges[i - 1].address,
+				ranges[i - 1].size, ranges[i].address);
+			return -1;
+		}
+	}
+
+	return n;
+}
+
+static int run(unsigned live, unsigned iterations)
+{
+	struct amdgpu_device dev;
+	struct live_range *ranges;
+	struct amdgpu_bo_va_hole *hole;
+	uint64_t start, elapsed;
+	unsigned i, failed = 0;
+	int n, ret = 0;
+
+	memset(&dev, 0, sizeof(dev));
+	amdgpu_vamgr_init(&dev.vamgr, VA_START, VA_END, VA_ALIGNMENT);
+	amdgpu_vamgr_init(&dev.vamgr_32, VA_ALIGNMENT, VA_START, VA_ALIGNMENT);
+
+	ranges = calloc(live, sizeof(*ranges));
+	if (!ranges)
+		return 1;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		struct live_range *r = &ranges[rng() % live];
+		uint64_t bits = rng();
+		uint64_t size = (1 + (bits & 0xff)) << (12 + ((bits >> 8) % 10));
+		uint64_t alignment = (bits >> 16) & 1 ? 1ull << (12 + (bits >> 17) % 10) : 0;
+		uint64_t flags = (bits >> 32) % 8 == 0 ? AMDGPU_VA_RANGE_REPLAYABLE : 0;
+
+		if (r->handle) {
+			amdgpu_va_range_free(r->handle);
+			r->handle = NULL;
+		}
+
+		if (amdgpu_va_range_alloc(&dev, amdgpu_gpu_va_range_general,
+					  size, alignment, 0, &r->address,
+					  &r->handle, flags)) {
+			r->handle = NULL;
+			failed++;
+			continue;
+		}
+		r->size = r->handle->size;
+	}
+	elapsed = now_ns() - start;
+
+	printf("%6u live ranges: %8.1f ns per free+alloc (%u failed)\n",
+	       live, (double)elapsed / iterations, failed);
+
+	n = check_ranges(ranges, live);
+	if (n < 0)
+		ret = 1;
+	for (i = 0; n > 0 && i < (unsigned)n; i++)
+		amdgpu_va_range_free(ranges[i].handle);
+
+	hole = dev.vamgr.va_holes;
+	if (!ret && (!hole || hole->left || hole->right ||
+		     hole->offset != VA_START || hole->size != VA_END - VA_START)) {
+		fprintf(stderr, "free space did not coalesce back\n");
+		ret = 1;
+	}
+
+	amdgpu_vamgr_deinit(&dev.vamgr);
+	amdgpu_vamgr_deinit(&dev.vamgr_32);
+	free(ranges);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+
+	ret |= run(1000, 200000);
+	ret |= run(10000, 200000);
+	ret |= run(50000, 200000);
+
+	return ret;
+}
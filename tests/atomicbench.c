@@ -0,0 +1,219 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Microbenchmark for drmModeAtomicCommit() on large synthetic requests, and
+ * for committing the same requests pre-encoded with drmModeAtomicEncode()
+ * while patching one property value per commit, as a page flip would.
+ *
+ * The DRM_IOCTL_MODE_ATOMIC call is served by a stand-in drmIoctl() defined
+ * here, which interposes the one exported by libdrm. It checks that the
+ * request reaching the kernel is sorted and free of duplicates, so no DRM
+ * device is needed.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+static int check_request = 1;
+
+static int check_atomic(const struct drm_mode_atomic *atomic)
+{
+	const uint32_t *objs = (const uint32_t *)(uintptr_t)atomic->objs_ptr;
+	const uint32_t *count_props = (const uint32_t *)(uintptr_t)atomic->count_props_ptr;
+	const uint32_t *props = (const uint32_t *)(uintptr_t)atomic->props_ptr;
+	const uint64_t *values = (const uint64_t *)(uintptr_t)atomic->prop_values_ptr;
+	uint32_t i, j, k = 0;
+
+	for (i = 0; i < atomic->count_objs; i++) {
+		if (i > 0 && objs[i] <= objs[i - 1])
+			return -1;
+		for (j = 0; j < count_props[i]; j++, k++) {
+			if (j > 0 && props[k] <= props[k - 1])
+				return -1;
+			/* The generator below always sets the last value to
+			 * the property id, see build_request(). */
+			if (values[k] != props[k])
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+drm_public int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	if (request != DRM_IOCTL_MODE_ATOMIC) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	if (check_request && check_atomic(arg)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Build a request touching @num_objs objects with @num_props properties
+ * each, added in a scrambled order and with every fourth property set twice.
+ * The final value of each property equals its id.
+ */
+static drmModeAtomicReqPtr build_request(uint32_t num_objs, uint32_t num_props)
+{
+	drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+	uint32_t total = num_objs * num_props;
+	uint32_t i;
+
+	if (!req)
+		return NULL;
+
+	for (i = 0; i < total; i++) {
+		uint32_t n = (i * 7919) % total;
+		uint32_t obj = 1 + n / num_props;
+		uint32_t prop = 1 + n % num_props;
+
+		if (prop % 4 == 0 &&
+		    drmModeAtomicAddProperty(req, obj, prop, ~0ull) < 0)
+			goto fail;
+		if (drmModeAtomicAddProperty(req, obj, prop, prop) < 0)
+			goto fail;
+	}
+
+	return req;
+
+fail:
+	drmModeAtomicFree(req);
+	return NULL;
+}
+
+static int run(uint32_t num_objs, uint32_t num_props, unsigned iterations)
+{
+	drmModeAtomicReqPtr req = build_request(num_objs, num_props);
+	drmModeAtomicEncodedPtr encoded;
+	uint64_t start, elapsed;
+	unsigned i;
+	int slot, ret;
+
+	if (!req) {
+		fprintf(stderr, "failed to build request\n");
+		return 1;
+	}
+
+	/* The first commit validates the encoding, the timed ones do not. */
+	check_request = 1;
+	ret = drmModeAtomicCommit(-1, req, 0, NULL);
+	if (ret) {
+		fprintf(stderr, "%u objs x %u props: bad request (%d)\n",
+			num_objs, num_props, ret);
+		drmModeAtomicFree(req);
+		return 1;
+	}
+
+	check_request = 0;
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		drmModeAtomicCommit(-1, req, 0, NULL);
+	elapsed = now_ns() - start;
+
+	printf("%5u objs x %3u props (%6d items): %10.1f ns/commit",
+	       num_objs, num_props, drmModeAtomicGetCursor(req),
+	       (double)elapsed / iterations);
+
+	encoded = drmModeAtomicEncode(req);
+	drmModeAtomicFree(req);
+	if (!encoded) {
+		fprintf(stderr, "\nfailed to encode request\n");
+		return 1;
+	}
+
+	slot = drmModeAtomicEncodedLookup(encoded, num_objs, num_props);
+	if (slot < 0 ||
+	    drmModeAtomicEncodedLookup(encoded, num_objs + 1, 1) != -ENOENT) {
+		fprintf(stderr, "\nbad encoded lookup (%d)\n", slot);
+		drmModeAtomicEncodedFree(encoded);
+		return 1;
+	}
+
+	check_request = 1;
+	ret = drmModeAtomicEncodedSetValue(encoded, slot, num_props);
+	if (!ret)
+		ret = drmModeAtomicEncodedCommit(-1, encoded, 0, NULL);
+	if (ret) {
+		fprintf(stderr, "\nbad encoded request (%d)\n", ret);
+		drmModeAtomicEncodedFree(encoded);
+		return 1;
+	}
+
+	check_request = 0;
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		drmModeAtomicEncodedSetValue(encoded, slot, i);
+		drmModeAtomicEncodedCommit(-1, encoded, 0, NULL);
+	}
+	elapsed = now_ns() - start;
+
+	printf(", encoded %8.1f ns/commit\n", (double)elapsed / iterations);
+
+	drmModeAtomicEncodedFree(encoded);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct {
+		uint32_t objs, props;
+		unsigned iterations;
+	} configs[] = {
+		{   4,  16, 100000 },
+		{  16,  32,  20000 },
+		{  64,  32,   5000 },
+		{ 256,  64,    500 },
+		{ 1024, 64,    100 },
+	};
+	unsigned i;
+	int ret = 0;
+
+	for (i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+		ret |= run(configs[i].objs, configs[i].props,
+			   configs[i].iterations);
+
+	return ret;
+}
@@ -0,0 +1,468 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Cost of drmGetDevices2 and of drmDevicesCacheGetDevices on a machine with
+ * many GPUs. The program interposes the libc calls libdrm uses to look at
+ * DRM_DIR_NAME and /sys, and points them at a fake tree of PCI GPUs built in
+ * /tmp, so no device is needed. After every change to the tree the cached
+ * devices must be the same as the ones drmGetDevices2 returns.
+ */
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+
+#define MAX_GPUS	64
+#define ITERATIONS	200
+
+static char fake_root[64];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * The wrappers below are drm_public so that libdrm, built with hidden
+ * visibility like this program, binds to them instead of to libc.
+ */
+static const char *redirect(const char *path, char *buf)
+{
+	if (!fake_root[0] || !path)
+		return path;
+
+	if (strncmp(path, "/sys/", 5) && strcmp(path, DRM_DIR_NAME) &&
+	    strncmp(path, DRM_DIR_NAME "/", sizeof(DRM_DIR_NAME)))
+		return path;
+
+	if (snprintf(buf, PATH_MAX, "%s%s", fake_root, path) >= PATH_MAX)
+		return path;
+	return buf;
+}
+
+static void *real(const char *name)
+{
+	void *sym = dlsym(RTLD_NEXT, name);
+
+	if (!sym) {
+		fprintf(stderr, "%s: %s\n", name, dlerror());
+		abort();
+	}
+	return sym;
+}
+
+/* The fake nodes are empty files; make them look like DRM char devices. */
+drm_public int stat(const char *path, struct stat *sbuf)
+{
+	static int (*real_stat)(const char *, struct stat *);
+	char buf[PATH_MAX];
+	const char *name;
+	unsigned int min;
+	int ret;
+
+	if (!real_stat)
+		real_stat = real("stat");
+
+	ret = real_stat(redirect(path, buf), sbuf);
+	if (ret || strncmp(path, DRM_DIR_NAME "/", sizeof(DRM_DIR_NAME)))
+		return ret;
+
+	name = path + sizeof(DRM_DIR_NAME);
+	if (sscanf(name, "card%u", &min) == 1 ||
+	    sscanf(name, "renderD%u", &min) == 1) {
+		sbuf->st_mode = S_IFCHR | 0666;
+		sbuf->st_rdev = makedev(226, min);
+	}
+	return 0;
+}
+
+drm_public DIR *opendir(const char *path)
+{
+	static DIR *(*real_opendir)(const char *);
+	char buf[PATH_MAX];
+
+	if (!real_opendir)
+		real_opendir = real("opendir");
+	return real_opendir(redirect(path, buf));
+}
+
+drm_public ssize_t readlink(const char *path, char *link, size_t size)
+{
+	static ssize_t (*real_readlink)(const char *, char *, size_t);
+	char buf[PATH_MAX];
+
+	if (!real_readlink)
+		real_readlink = real("readlink");
+	return real_readlink(redirect(path, buf), link, size);
+}
+
+drm_public char *realpath(const char *path, char *resolved)
+{
+	static char *(*real_realpath)(const char *, char *);
+	char buf[PATH_MAX];
+
+	if (!real_realpath)
+		real_realpath = real("realpath");
+	return real_realpath(redirect(path, buf), resolved);
+}
+
+drm_public FILE *fopen(const char *path, const char *mode)
+{
+	static FILE *(*real_fopen)(const char *, const char *);
+	char buf[PATH_MAX];
+
+	if (!real_fopen)
+		real_fopen = real("fopen");
+	return real_fopen(redirect(path, buf), mode);
+}
+
+static int create_file(const char *path, const char *value)
+{
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return -1;
+	fputs(value, fp);
+	return fclose(fp);
+}
+
+static int write_file(const char *dir, const char *name, const char *value)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	return create_file(path, value);
+}
+
+static int make_link(const char *target, const char *fmt, unsigned int arg)
+{
+	char path[PATH_MAX], name[64];
+
+	snprintf(name, sizeof(name), fmt, arg);
+	snprintf(path, sizeof(path), "%s%s", fake_root, name);
+	return symlink(target, path);
+}
+
+/* Node files of GPU n, with n from 0 to MAX_GPUS - 1. */
+static void node_paths(unsigned int n, char *card, char *render)
+{
+	snprintf(card, PATH_MAX, "%s%s/card%u", fake_root, DRM_DIR_NAME, n);
+	snprintf(render, PATH_MAX, "%s%s/renderD%u", fake_root, DRM_DIR_NAME,
+		 128 + n);
+}
+
+static int add_nodes(unsigned int n)
+{
+	char card[PATH_MAX], render[PATH_MAX];
+
+	node_paths(n, card, render);
+	return create_file(card, "") || create_file(render, "") ? -1 : 0;
+}
+
+static void remove_nodes(unsigned int n)
+{
+	char card[PATH_MAX], render[PATH_MAX];
+
+	node_paths(n, card, render);
+	unlink(card);
+	unlink(render);
+}
+
+static int add_gpu(unsigned int n)
+{
+	char pci[128], dir[PATH_MAX], value[64], target[64];
+	unsigned int minors[2] = { n, 128 + n };
+	int i;
+
+	snprintf(pci, sizeof(pci), "%s/sys/devices/pci0000:00/0000:%02x:00.0",
+		 fake_root, n + 1);
+	if (mkdir(pci, 0755))
+		return -1;
+
+	snprintf(value, sizeof(value), "PCI_SLOT_NAME=0000:%02x:00.0\n", n + 1);
+	if (write_file(pci, "uevent", value) ||
+	    write_file(pci, "vendor", "0x1002\n") ||
+	    write_file(pci, "subsystem_vendor", "0x1002\n") ||
+	    write_file(pci, "subsystem_device", "0x0b0c\n") ||
+	    write_file(pci, "revision", "0xc1\n"))
+		return -1;
+	snprintf(value, sizeof(value), "0x%04x\n", 0x7300 + n);
+	if (write_file(pci, "device", value))
+		return -1;
+
+	snprintf(dir, sizeof(dir), "%s/subsystem", pci);
+	if (symlink("../../../bus/pci", dir))
+		return -1;
+
+	snprintf(dir, sizeof(dir), "%s/drm", pci);
+	if (mkdir(dir, 0755))
+		return -1;
+
+	snprintf(target, sizeof(target), "../../../0000:%02x:00.0", n + 1);
+	for (i = 0; i < 2; i++) {
+		snprintf(dir, sizeof(dir), "%s/drm/%s%u", pci,
+			 i ? "renderD" : "card", minors[i]);
+		if (mkdir(dir, 0755))
+			return -1;
+		strcat(dir, "/device");
+		if (symlink(target, dir))
+			return -1;
+
+		snprintf(dir, sizeof(dir),
+			 "../../devices/pci0000:00/0000:%02x:00.0/drm/%s%u",
+			 n + 1, i ? "renderD" : "card", minors[i]);
+		if (make_link(dir, "/sys/dev/char/226:%u", minors[i]))
+			return -1;
+	}
+
+	return add_nodes(n);
+}
+
+static int make_tree(void)
+{
+	static const char *dirs[] = {
+		"/dev", DRM_DIR_NAME, "/sys", "/sys/bus", "/sys/bus/pci",
+		"/sys/dev", "/sys/dev/char", "/sys/devices",
+		"/sys/devices/pci0000:00",
+	};
+	char path[PATH_MAX];
+	unsigned int i;
+
+	strcpy(fake_root, "/tmp/drm-devices.XXXXXX");
+	if (!mkdtemp(fake_root))
+		return -1;
+
+	for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+		snprintf(path, sizeof(path), "%s%s", fake_root, dirs[i]);
+		if (mkdir(path, 0755))
+			return -1;
+	}
+
+	for (i = 0; i < MAX_GPUS; i++) {
+		if (add_gpu(i))
+			return -1;
+	}
+
+	return 0;
+}
+
+static bool device_equal(drmDevicePtr a, drmDevicePtr b)
+{
+	int i;
+
+	if (a->available_nodes != b->available_nodes ||
+	    a->bustype != b->bustype || a->bustype != DRM_BUS_PCI ||
+	    memcmp(a->businfo.pci, b->businfo.pci, sizeof(drmPciBusInfo)) ||
+	    memcmp(a->deviceinfo.pci, b->deviceinfo.pci,
+		   sizeof(drmPciDeviceInfo)))
+		return false;
+
+	for (i = 0; i < DRM_NODE_MAX; i++) {
+		if ((a->available_nodes & (1 << i)) &&
+		    strcmp(a->nodes[i], b->nodes[i]))
+			return false;
+	}
+	return true;
+}
+
+static int check(drmDevicesCachePtr cache, uint32_t flags, int expected)
+{
+	drmDevicePtr devices[MAX_GPUS], cached[MAX_GPUS];
+	int count, cached_count, i, ret = 0;
+
+	count = drmGetDevices2(flags, devices, MAX_GPUS);
+	cached_count = drmDevicesCacheGetDevices(cache, flags, cached, MAX_GPUS);
+	if (count != expected || cached_count != count) {
+		fprintf(stderr, "expected %d devices, got %d and %d cached\n",
+			expected, count, cached_count);
+		ret = 1;
+	}
+
+	for (i = 0; !ret && i < count; i++) {
+		if (!device_equal(devices[i], cached[i])) {
+			fprintf(stderr, "cached device %d differs\n", i);
+			ret = 1;
+		}
+	}
+
+	if (!ret && drmDevicesCacheGetDevices(cache, flags, NULL, 0) != count) {
+		fprintf(stderr, "wrong cached device count\n");
+		ret = 1;
+	}
+
+	drmFreeDevices(devices, count > 0 ? count : 0);
+	drmFreeDevices(cached, cached_count > 0 ? cached_count : 0);
+	return ret;
+}
+
+static int check_changes(void)
+{
+	drmDevicesCachePtr cache = drmDevicesCacheCreate();
+	int ret;
+
+	if (!cache)
+		return 1;
+
+	ret = check(cache, 0, MAX_GPUS);
+	ret |= check(cache, DRM_DEVICE_GET_PCI_REVISION, MAX_GPUS);
+
+	remove_nodes(3);
+	ret |= check(cache, DRM_DEVICE_GET_PCI_REVISION, MAX_GPUS - 1);
+
+	/* A recreated node must be parsed again. */
+	remove_nodes(5);
+	add_nodes(3);
+	ret |= check(cache, DRM_DEVICE_GET_PCI_REVISION, MAX_GPUS - 1);
+
+	add_nodes(5);
+	ret |= check(cache, 0, MAX_GPUS);
+
+	drmDevicesCacheDestroy(cache);
+	return ret;
+}
+
+/* Keep only the first num_gpus GPUs in DRM_DIR_NAME. */
+static void set_gpus(unsigned int num_gpus)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_GPUS; i++) {
+		remove_nodes(i);
+		if (i < num_gpus)
+			add_nodes(i);
+	}
+}
+
+static void touch_dir(void)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s%s/by-path", fake_root, DRM_DIR_NAME);
+	mkdir(path, 0755);
+	rmdir(path);
+}
+
+static double per_call_us(uint64_t start)
+{
+	return (now_ns() - start) / 1000.0 / ITERATIONS;
+}
+
+static void bench(unsigned int num_gpus)
+{
+	drmDevicesCachePtr cache = drmDevicesCacheCreate();
+	drmDevicePtr devices[MAX_GPUS];
+	double uncached, cached, changed, rescan;
+	uint64_t start;
+	int i, count;
+
+	if (!cache)
+		return;
+
+	set_gpus(num_gpus);
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		count = drmGetDevices2(0, devices, MAX_GPUS);
+		drmFreeDevices(devices, count);
+	}
+	uncached = per_call_us(start);
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		count = drmDevicesCacheGetDevices(cache, 0, devices, MAX_GPUS);
+		drmFreeDevices(devices, count);
+	}
+	cached = per_call_us(start);
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		touch_dir();
+		count = drmDevicesCacheGetDevices(cache, 0, devices, MAX_GPUS);
+		drmFreeDevices(devices, count);
+	}
+	changed = per_call_us(start);
+
+	start = now_ns();
+	for (i = 0; i < ITERATIONS; i++) {
+		drmDevicesCacheInvalidate(cache);
+		count = drmDevicesCacheGetDevices(cache, 0, devices, MAX_GPUS);
+		drmFreeDevices(devices, count);
+	}
+	rescan = per_call_us(start);
+
+	printf("%2u GPUs: drmGetDevices2 %8.2f us, cached %6.2f us, "
+	       "changed dir %7.2f us, invalidated %8.2f us\n",
+	       num_gpus, uncached, cached, changed, rescan);
+
+	drmDevicesCacheDestroy(cache);
+}
+
+static void remove_tree(void)
+{
+	char cmd[PATH_MAX + 16];
+
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", fake_root);
+	fake_root[0] = '\0';
+	if (system(cmd))
+		fprintf(stderr, "failed to remove the fake tree\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int num_gpus[] = { 1, 4, 16, MAX_GPUS };
+	unsigned int i;
+	int ret;
+
+	if (make_tree()) {
+		perror("creating the fake sysfs tree");
+		if (fake_root[0])
+			remove_tree();
+		return 1;
+	}
+
+	ret = check_changes();
+	if (!ret) {
+		for (i = 0; i < sizeof(num_gpus) / sizeof(num_gpus[0]); i++)
+			bench(num_gpus[i]);
+	}
+
+	remove_tree();
+	return ret;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright © 2026 libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Exercise drmReadEvents() and drmHandleEvents() against a non-blocking
+ * pipe standing in for a DRM fd. Every event written is 32 bytes, the same
+ * size the kernel uses, so reads of whole events never split one.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#define DRM_EVENT_UNKNOWN 0x7fffffff
+
+#define CHECK(expr)							\
+	do {								\
+		if (!(expr)) {						\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+				__FILE__, __LINE__, #expr);		\
+			return 1;					\
+		}							\
+	} while (0)
+
+static void write_vblank(int fd, uint32_t type, uint32_t crtc_id,
+			 uint32_t sequence, uint32_t tv_sec, uint32_t tv_usec,
+			 uint64_t user_data)
+{
+	struct drm_event_vblank e;
+
+	memset(&e, 0, sizeof(e));
+	e.base.type = type;
+	e.base.length = sizeof(e);
+	e.user_data = user_data;
+	e.tv_sec = tv_sec;
+	e.tv_usec = tv_usec;
+	e.sequence = sequence;
+	e.crtc_id = crtc_id;
+	if (write(fd, &e, sizeof(e)) != sizeof(e))
+		perror("write");
+}
+
+static void write_sequence(int fd, uint64_t sequence, int64_t time_ns,
+			   uint64_t user_data)
+{
+	struct drm_event_crtc_sequence e;
+
+	memset(&e, 0, sizeof(e));
+	e.base.type = DRM_EVENT_CRTC_SEQUENCE;
+	e.base.length = sizeof(e);
+	e.user_data = user_data;
+	e.time_ns = time_ns;
+	e.sequence = sequence;
+	if (write(fd, &e, sizeof(e)) != sizeof(e))
+		perror("write");
+}
+
+static void write_unknown(int fd)
+{
+	struct drm_event_vblank e;
+
+	memset(&e, 0xa5, sizeof(e));
+	e.base.type = DRM_EVENT_UNKNOWN;
+	e.base.length = sizeof(e);
+	if (write(fd, &e, sizeof(e)) != sizeof(e))
+		perror("write");
+}
+
+static int test_read_events(int rfd, int wfd)
+{
+	/* Room for two events only, so draining takes several reads. */
+	struct drm_event_vblank buffer[2];
+	drmEvent events[8];
+	int ret;
+
+	memset(events, 0, sizeof(events));
+
+	write_vblank(wfd, DRM_EVENT_VBLANK, 1, 10, 3, 500, 0x100);
+	write_unknown(wfd);
+	write_vblank(wfd, DRM_EVENT_FLIP_COMPLETE, 2, 11, 4, 7, 0x200);
+	write_sequence(wfd, 0x100000000ull, 5000000123ll, 0x300);
+	write_vblank(wfd, DRM_EVENT_VBLANK, 3, 12, 6, 0, 0x400);
+
+	/* The unknown event is skipped and doesn't count against the cap. */
+	ret = drmReadEvents(rfd, events, 3, buffer, sizeof(buffer));
+	CHECK(ret == 3);
+
+	CHECK(events[0].type == DRM_EVENT_VBLANK);
+	CHECK(events[0].crtc_id == 1);
+	CHECK(events[0].sequence == 10);
+	CHECK(events[0].time_ns == 3000500000ull);
+	CHECK(events[0].user_data == 0x100);
+
+	CHECK(events[1].type == DRM_EVENT_FLIP_COMPLETE);
+	CHECK(events[1].crtc_id == 2);
+	CHECK(events[1].sequence == 11);
+	CHECK(events[1].time_ns == 4000007000ull);
+	CHECK(events[1].user_data == 0x200);
+
+	CHECK(events[2].type == DRM_EVENT_CRTC_SEQUENCE);
+	CHECK(events[2].crtc_id == 0);
+	CHECK(events[2].sequence == 0x100000000ull);
+	CHECK(events[2].time_ns == 5000000123ull);
+	CHECK(events[2].user_data == 0x300);
+
+	/* Whatever was past the cap is still queued. */
+	ret = drmReadEvents(rfd, events, 8, buffer, sizeof(buffer));
+	CHECK(ret == 1);
+	CHECK(events[0].type == DRM_EVENT_VBLANK);
+	CHECK(events[0].crtc_id == 3);
+	CHECK(events[0].sequence == 12);
+	CHECK(events[0].time_ns == 6000000000ull);
+	CHECK(events[0].user_data == 0x400);
+
+	/* An empty queue on a non-blocking fd is not an error. */
+	ret = drmReadEvents(rfd, events, 8, buffer, sizeof(buffer));
+	CHECK(ret == 0);
+
+	errno = 0;
+	ret = drmReadEvents(rfd, events, 8, buffer, sizeof(buffer[0]) - 1);
+	CHECK(ret == -1 && errno == EINVAL);
+
+	return 0;
+}
+
+struct handled {
+	unsigned int vblank, flip, sequence;
+	unsigned int last_crtc_id;
+	uint64_t last_sequence, last_ns, last_user_data;
+};
+
+static struct handled handled;
+
+static void vblank_handler(int fd, unsigned int sequence, unsigned int tv_sec,
+			   unsigned int tv_usec, void *user_data)
+{
+	handled.vblank++;
+	handled.last_sequence = sequence;
+	handled.last_ns = tv_sec * 1000000000ull + tv_usec * 1000ull;
+	handled.last_user_data = (uintptr_t)user_data;
+}
+
+static void page_flip_handler2(int fd, unsigned int sequence,
+			       unsigned int tv_sec, unsigned int tv_usec,
+			       unsigned int crtc_id, void *user_data)
+{
+	handled.flip++;
+	handled.last_crtc_id = crtc_id;
+	handled.last_sequence = sequence;
+	handled.last_ns = tv_sec * 1000000000ull + tv_usec * 1000ull;
+	handled.last_user_data = (uintptr_t)user_data;
+}
+
+static void sequence_handler(int fd, uint64_t sequence, uint64_t ns,
+			     uint64_t user_data)
+{
+	handled.sequence++;
+	handled.last_sequence = sequence;
+	handled.last_ns = ns;
+	handled.last_user_data = user_data;
+}
+
+static int test_handle_events(int rfd, int wfd)
+{
+	struct drm_event_vblank buffer[2];
+	drmEventContext evctx;
+	int ret;
+
+	memset(&evctx, 0, sizeof(evctx));
+	evctx.version = DRM_EVENT_CONTEXT_VERSION;
+	evctx.vblank_handler = vblank_handler;
+	evctx.page_flip_handler2 = page_flip_handler2;
+	evctx.sequence_handler = sequence_handler;
+
+	write_vblank(wfd, DRM_EVENT_VBLANK, 1, 20, 1, 1, 0x10);
+	write_unknown(wfd);
+	write_vblank(wfd, DRM_EVENT_FLIP_COMPLETE, 5, 21, 2, 2, 0x20);
+	write_sequence(wfd, 22, 3000000003ll, 0x30);
+
+	ret = drmHandleEvents(rfd, &evctx, buffer, sizeof(buffer), 2);
+	CHECK(ret == 2);
+	CHECK(handled.vblank == 1);
+	CHECK(handled.flip == 1);
+	CHECK(handled.sequence == 0);
+	CHECK(handled.last_crtc_id == 5);
+	CHECK(handled.last_sequence == 21);
+	CHECK(handled.last_ns == 2000002000ull);
+	CHECK(handled.last_user_data == 0x20);
+
+	ret = drmHandleEvents(rfd, &evctx, buffer, sizeof(buffer), 2);
+	CHECK(ret == 1);
+	CHECK(handled.sequence == 1);
+	CHECK(handled.last_sequence == 22);
+	CHECK(handled.last_ns == 3000000003ull);
+	CHECK(handled.last_user_data == 0x30);
+
+	ret = drmHandleEvents(rfd, &evctx, buffer, sizeof(buffer), 2);
+	CHECK(ret == 0);
+
+	errno = 0;
+	ret = drmHandleEvents(rfd, NULL, buffer, sizeof(buffer), 2);
+	CHECK(ret == -1 && errno == EINVAL);
+
+	return 0;
+}
+
+int main(void)
+{
+	int fds[2];
+	int ret;
+
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+	ret = test_read_events(fds[0], fds[1]);
+	if (ret == 0)
+		ret = test_handle_events(fds[0], fds[1]);
+
+	close(fds[0]);
+	close(fds[1]);
+
+	return ret;
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Cost of allocating and freeing bos through the GEM bo manager, with and
+ * without its reuse cache. The radeon ioctls are answered by the drmIoctl
+ * below, so no device is needed. Each frame allocates a few hundred bos of
+ * common sizes in VRAM and GTT and frees them at its end; the bos of a
+ * frame stay busy until the next one is done, as if the GPU was a frame
+ * behind. Every bo handed out must be idle, not in use, untiled, also when
+ * untiling fails, and in the requested domain. Flinked bos must not be cached, cached bos must be
+ * closed after a while and by a trim. The fake ioctls cost nothing, unlike
+ * a real GEM_CREATE which has to allocate and clear memory, so the share
+ * of bos created is the figure to look at.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+#include "radeon_drm.h"
+#include "radeon_bo.h"
+#include "radeon_bo_gem.h"
+
+#define BOS_PER_FRAME	256
+#define FRAMES		400
+#define MAX_HANDLES	(2 * BOS_PER_FRAME * FRAMES)
+
+struct fake_bo {
+	uint32_t domain;
+	uint32_t size;
+	uint32_t tiling;
+	int busy_until;
+	bool open;
+	bool in_use;
+};
+
+static struct fake_bo fake[MAX_HANDLES];
+static uint32_t next_handle;
+static unsigned long live_handles, creates, errors;
+static int frame;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Stand-in for the kernel, see above. */
+drm_public int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	switch (request) {
+	case DRM_IOCTL_RADEON_GEM_CREATE: {
+		struct drm_radeon_gem_create *create = arg;
+
+		if (next_handle + 1 >= MAX_HANDLES)
+			return -1;
+		create->handle = ++next_handle;
+		fake[create->handle].domain = create->initial_domain;
+		fake[create->handle].size = create->size;
+		fake[create->handle].busy_until = -1;
+		fake[create->handle].open = true;
+		live_handles++;
+		creates++;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_CLOSE: {
+		struct drm_gem_close *close = arg;
+
+		if (!fake[close->handle].open || fake[close->handle].in_use)
+			errors++;
+		fake[close->handle].open = false;
+		live_handles--;
+		return 0;
+	}
+	case DRM_IOCTL_RADEON_GEM_BUSY: {
+		struct drm_radeon_gem_busy *busy = arg;
+
+		if (fake[busy->handle].busy_until >= frame) {
+			errno = EBUSY;
+			return -1;
+		}
+		return 0;
+	}
+	case DRM_IOCTL_RADEON_GEM_SET_TILING: {
+		struct drm_radeon_gem_set_tiling *tiling = arg;
+
+		/* Some bos can't be untiled, they mustn't be reused. */
+		if (!tiling->tiling_flags && tiling->handle % 5 == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		fake[tiling->handle].tiling = tiling->tiling_flags;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_FLINK: {
+		struct drm_gem_flink *flink = arg;
+
+		flink->name = flink->handle;
+		return 0;
+	}
+	default:
+		return -1;
+	}
+}
+
+static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
+				 uint32_t size, uint32_t domain)
+{
+	struct radeon_bo *bo;
+	struct fake_bo *f;
+
+	bo = radeon_bo_open(bom, 0, size, 4096, domain, 0);
+	if (!bo)
+		return NULL;
+
+	f = &fake[bo->handle];
+	if (!f->open || f->in_use || f->busy_until >= frame ||
+	    f->domain != domain || f->size < size || f->tiling)
+		errors++;
+	f->in_use = true;
+	return bo;
+}
+
+static void bo_unref(struct radeon_bo *bo)
+{
+	fake[bo->handle].in_use = false;
+	fake[bo->handle].busy_until = frame + 1;
+	radeon_bo_unref(bo);
+}
+
+static void run(struct radeon_bo_manager *bom, bool reuse)
+{
+	static const uint32_t sizes[] = {
+		4096, 8192, 16384, 65536, 262144, 1 << 20, 4 << 20, 6000,
+	};
+	struct radeon_bo_gem_cache_stats stats;
+	struct radeon_bo *bos[BOS_PER_FRAME];
+	unsigned long start_creates = creates;
+	uint64_t start, elapsed;
+	int i;
+
+	start = now_ns();
+	for (frame = 0; frame < FRAMES; frame++) {
+		for (i = 0; i < BOS_PER_FRAME; i++) {
+			uint32_t size = sizes[(i * 7 + frame) % 8];
+			uint32_t domain = i % 3 ? RADEON_GEM_DOMAIN_VRAM :
+						  RADEON_GEM_DOMAIN_GTT;
+
+			bos[i] = bo_open(bom, size, domain);
+			if (bos[i] && i % 16 == 0)
+				radeon_bo_set_tiling(bos[i], 1, 256);
+		}
+		for (i = 0; i < BOS_PER_FRAME; i++) {
+			if (bos[i])
+				bo_unref(bos[i]);
+		}
+	}
+	elapsed = now_ns() - start;
+
+	radeon_bo_manager_gem_get_cache_stats(bom, &stats);
+	printf("%s: %6.2f us per bo, %5.1f%% created, %lu hits, %lu busy, "
+	       "%u cached\n", reuse ? "reuse   " : "no reuse",
+	       elapsed / 1000.0 / FRAMES / BOS_PER_FRAME,
+	       100.0 * (creates - start_creates) / FRAMES / BOS_PER_FRAME,
+	       (unsigned long)stats.hits, (unsigned long)stats.busy,
+	       stats.cached_bos);
+
+	if (reuse && (!stats.hits || !stats.busy))
+		errors++;
+}
+
+static int check_cache(struct radeon_bo_manager *bom)
+{
+	struct radeon_bo_gem_cache_stats stats;
+	struct radeon_bo *bo;
+	uint32_t name, handle;
+	unsigned long live;
+
+	/* Shared bos are closed on their last unref. */
+	frame = FRAMES + 10;
+	bo = bo_open(bom, 4096, RADEON_GEM_DOMAIN_GTT);
+	handle = bo->handle;
+	radeon_gem_get_kernel_name(bo, &name);
+	bo_unref(bo);
+	if (fake[handle].open) {
+		fprintf(stderr, "flinked bo was cached\n");
+		return 1;
+	}
+
+	/* Cached bos are closed once they are older than a second. */
+	radeon_bo_manager_gem_get_cache_stats(bom, &stats);
+	live = live_handles;
+	sleep(2);
+	bo = bo_open(bom, 128 << 10, RADEON_GEM_DOMAIN_VRAM);
+	bo_unref(bo);
+	if (live_handles >= live || live_handles != 1 + 1) {
+		fprintf(stderr, "%lu of %lu cached bos left after 2s\n",
+			live_handles, live);
+		return 1;
+	}
+
+	radeon_bo_manager_gem_trim_cache(bom);
+	radeon_bo_manager_gem_get_cache_stats(bom, &stats);
+	if (live_handles != 1 || stats.cached_bos || stats.cached_bytes) {
+		fprintf(stderr, "%lu bos open after trim\n", live_handles);
+		return 1;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	struct radeon_bo_manager *bom;
+	struct radeon_bo *keep;
+	int ret;
+
+	bom = radeon_bo_manager_gem_ctor(-1);
+	run(bom, false);
+	radeon_bo_manager_gem_dtor(bom);
+
+	bom = radeon_bo_manager_gem_ctor(-1);
+	radeon_bo_manager_gem_enable_reuse(bom);
+	run(bom, true);
+	/* A bo still referenced is not affected by the trim. */
+	keep = bo_open(bom, 4096, RADEON_GEM_DOMAIN_VRAM);
+	ret = check_cache(bom);
+	bo_unref(keep);
+	radeon_bo_manager_gem_dtor(bom);
+
+	if (ret || errors || live_handles) {
+		fprintf(stderr, "%lu bad bos, %lu handles left open\n",
+			errors, live_handles);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Cost of emitting relocations through radeon_cs_write_reloc with the GEM
+ * CS manager. The radeon ioctls are answered by the drmIoctl below, so no
+ * device is needed. Every command stream relocates thousands of buffers,
+ * once each or, as a driver does with its vertex and constant buffers,
+ * some of them several times. Command streams are either reused, erasing
+ * them after each submission, or created for each submission. Last, more
+ * command streams are kept alive than there are CS ids, as a process with
+ * many contexts would.
+ * The fake CS ioctl checks that no buffer is listed twice and that every
+ * relocation in the IB points at the buffer it was emitted for.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+#include "radeon_drm.h"
+#include "radeon_bo.h"
+#include "radeon_bo_int.h"
+#include "radeon_cs.h"
+#include "radeon_bo_gem.h"
+#include "radeon_cs_gem.h"
+
+#define NUM_BOS		4096
+#define REPEAT		8
+#define ROUNDS		200
+#define LIVE_CS		40
+#define RELOC_DW	2
+
+static uint32_t next_handle;
+static unsigned long live_handles;
+static unsigned long bad_cs;
+
+/* Handle of each relocation in the IB, in emission order. */
+static uint32_t expected[NUM_BOS * 2];
+static unsigned expected_count;
+static uint8_t seen[NUM_BOS + 1];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void check_cs(struct drm_radeon_cs *cs)
+{
+	uint64_t *chunks = (uint64_t *)(uintptr_t)cs->chunks;
+	struct drm_radeon_cs_chunk *ib = (void *)(uintptr_t)chunks[0];
+	struct drm_radeon_cs_chunk *relocs = (void *)(uintptr_t)chunks[1];
+	const uint32_t *packets = (const uint32_t *)(uintptr_t)ib->chunk_data;
+	const uint32_t *reloc = (const uint32_t *)(uintptr_t)relocs->chunk_data;
+	unsigned i, n = 0, nrelocs = relocs->length_dw / 4;
+
+	memset(seen, 0, sizeof(seen));
+	for (i = 0; i < nrelocs; i++) {
+		if (reloc[i * 4] > NUM_BOS || seen[reloc[i * 4]]++)
+			bad_cs++;
+	}
+
+	for (i = 0; i + 1 < ib->length_dw; i += 2) {
+		if (packets[i] == 0x80000000)
+			break;
+		if (packets[i] != 0xc0001000 || packets[i + 1] % 4 ||
+		    packets[i + 1] / 4 >= nrelocs || n >= expected_count ||
+		    reloc[packets[i + 1]] != expected[n++])
+			bad_cs++;
+	}
+	if (n != expected_count)
+		bad_cs++;
+}
+
+/* Stand-in for the kernel, see above. */
+drm_public int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	switch (request) {
+	case DRM_IOCTL_RADEON_INFO: {
+		struct drm_radeon_info *info = arg;
+
+		if (info->request != RADEON_INFO_DEVICE_ID)
+			return -1;
+		*(uint32_t *)(uintptr_t)info->value = 0x6719;
+		return 0;
+	}
+	case DRM_IOCTL_RADEON_GEM_CREATE: {
+		struct drm_radeon_gem_create *create = arg;
+
+		create->handle = ++next_handle;
+		live_handles++;
+		return 0;
+	}
+	case DRM_IOCTL_GEM_CLOSE:
+		live_handles--;
+		return 0;
+	case DRM_IOCTL_RADEON_CS:
+		check_cs(arg);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static void emit(struct radeon_cs *cs, struct radeon_bo **bos, bool repeat)
+{
+	unsigned i, j;
+
+	expected_count = 0;
+	radeon_cs_begin(cs, 2 * NUM_BOS * RELOC_DW, __FILE__, __func__,
+			__LINE__);
+	for (i = 0; i < NUM_BOS; i++) {
+		/* Every REPEAT buffers, go back to as many earlier ones. */
+		for (j = repeat && i && !(i % REPEAT) ? REPEAT : 0; j > 0; j--) {
+			struct radeon_bo *bo = bos[(i * 7 + j * 131) % i];
+
+			radeon_cs_write_reloc(cs, bo, 0,
+					      RADEON_GEM_DOMAIN_VRAM, 0);
+			expected[expected_count++] = bo->handle;
+		}
+		((struct radeon_bo_int *)bos[i])->space_accounted =
+			RADEON_GEM_DOMAIN_VRAM;
+		radeon_cs_write_reloc(cs, bos[i], 0, RADEON_GEM_DOMAIN_VRAM, 0);
+		expected[expected_count++] = bos[i]->handle;
+	}
+	while (cs->cdw < cs->section_ndw)
+		radeon_cs_write_dword(cs, 0x80000000);
+	radeon_cs_end(cs, __FILE__, __func__, __LINE__);
+	radeon_cs_emit(cs);
+}
+
+static void run(struct radeon_cs_manager *csm, struct radeon_bo **bos,
+		bool reuse, bool repeat)
+{
+	struct radeon_cs *cs = NULL;
+	uint64_t start, elapsed;
+	int round;
+
+	start = now_ns();
+	for (round = 0; round < ROUNDS; round++) {
+		if (!cs)
+			cs = radeon_cs_create(csm, 1024);
+		emit(cs, bos, repeat);
+		radeon_cs_erase(cs);
+		if (!reuse) {
+			radeon_cs_destroy(cs);
+			cs = NULL;
+		}
+	}
+	elapsed = now_ns() - start;
+	if (cs)
+		radeon_cs_destroy(cs);
+
+	printf("%s CS, %s relocs: %8.1f us/CS, %6.1f ns/reloc\n",
+	       reuse ? "reused" : "new   ", repeat ? "repeated" : "unique  ",
+	       elapsed / 1000.0 / ROUNDS,
+	       (double)elapsed / ROUNDS / expected_count);
+}
+
+static void run_live(struct radeon_cs_manager *csm, struct radeon_bo **bos)
+{
+	struct radeon_cs *cs[LIVE_CS];
+	uint64_t start, elapsed;
+	int i;
+
+	for (i = 0; i < LIVE_CS; i++)
+		cs[i] = radeon_cs_create(csm, 1024);
+
+	start = now_ns();
+	for (i = 0; i < ROUNDS; i++) {
+		emit(cs[i % LIVE_CS], bos, true);
+		radeon_cs_erase(cs[i % LIVE_CS]);
+	}
+	elapsed = now_ns() - start;
+
+	for (i = 0; i < LIVE_CS; i++)
+		radeon_cs_destroy(cs[i]);
+
+	printf("%d live CS, repeated relocs: %8.1f us/CS, %6.1f ns/reloc\n",
+	       LIVE_CS, elapsed / 1000.0 / ROUNDS,
+	       (double)elapsed / ROUNDS / expected_count);
+}
+
+int main(void)
+{
+	struct radeon_bo_manager *bom;
+	struct radeon_cs_manager *csm;
+	struct radeon_bo *bos[NUM_BOS];
+	unsigned i;
+	int repeat, reuse;
+
+	bom = radeon_bo_manager_gem_ctor(-1);
+	csm = radeon_cs_manager_gem_ctor(-1);
+	for (i = 0; i < NUM_BOS; i++)
+		bos[i] = radeon_bo_open(bom, 0, 4096, 4096,
+					RADEON_GEM_DOMAIN_VRAM, 0);
+
+	for (repeat = 0; repeat < 2; repeat++) {
+		for (reuse = 1; reuse >= 0; reuse--)
+			run(csm, bos, reuse, repeat);
+	}
+	run_live(csm, bos);
+
+	for (i = 0; i < NUM_BOS; i++)
+		radeon_bo_unref(bos[i]);
+	radeon_cs_manager_gem_dtor(csm);
+	radeon_bo_manager_gem_dtor(bom);
+
+	if (bad_cs || live_handles) {
+		fprintf(stderr, "%lu bad CS, %lu handles left open\n",
+			bad_cs, live_handles);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,417 @@
+/*
+ * Copyright © 2026 The libdrm contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Cost of radeon_surface_best and radeon_surface_init with and without the
+ * layout cache of the surface manager. The managers are created for one
+ * chip of each family the surface code handles, with the tiling
+ * configuration answered by the drmIoctl below, so no device is needed.
+ * Common sizes, formats and tiling modes of textures, render targets and
+ * depth buffers are each laid out many times, as by an application
+ * creating the same few hundred textures over and over. Every layout from
+ * the cache must be identical to the computed one, also with a cache too
+ * small for all of them. Last, the same layouts must come out of a manager
+ * made from the tiling configuration alone, without any ioctl.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+#include "radeon_drm.h"
+#include "radeon_surface.h"
+
+#define MAX_SURFACES	4096
+#define ROUNDS		20
+
+/* SI/CIK GB_TILE_MODE and CIK GB_MACROTILE_MODE fields */
+#define PIPE_CONFIG(x)		((x) << 6)
+#define TILE_SPLIT(x)		((x) << 11)
+#define BANK_WIDTH(x)		((x) << 14)
+#define BANK_HEIGHT(x)		((x) << 16)
+#define MACRO_TILE_ASPECT(x)	((x) << 18)
+#define NUM_BANKS(x)		((x) << 20)
+#define SAMPLE_SPLIT(x)		((x) << 25)
+#define P8_32x32_8x16		10
+#define P4_16x16		5
+#define MT_BANK_WIDTH(x)	((x) << 0)
+#define MT_BANK_HEIGHT(x)	((x) << 2)
+#define MT_ASPECT(x)		((x) << 4)
+#define MT_NUM_BANKS(x)		((x) << 6)
+
+#define SI_2D(split, bh, aspect) \
+	(PIPE_CONFIG(P8_32x32_8x16) | TILE_SPLIT(split) | BANK_WIDTH(0) | \
+	 BANK_HEIGHT(bh) | MACRO_TILE_ASPECT(aspect) | NUM_BANKS(3))
+#define CIK_2D(split, sample_split) \
+	(PIPE_CONFIG(P4_16x16) | TILE_SPLIT(split) | SAMPLE_SPLIT(sample_split))
+#define CIK_MT(bh, aspect) \
+	(MT_BANK_WIDTH(0) | MT_BANK_HEIGHT(bh) | MT_ASPECT(aspect) | \
+	 MT_NUM_BANKS(3))
+
+struct chip {
+	const char *name;
+	uint32_t device_id;
+	uint32_t tiling_config;
+	uint32_t tile_mode_array[32];
+	uint32_t macrotile_mode_array[16];
+};
+
+/* Close to what the kernel reports for these chips. */
+static const struct chip chips[] = {
+	{ "RV770", 0x9440, 0x0000003c },
+	{ "CYPRESS", 0x6898, 0x00002023 },
+	{
+		"TAHITI", 0x6798, 0x00002023,
+		{
+			[0] = SI_2D(0, 2, 1), [1] = SI_2D(1, 2, 1),
+			[2] = SI_2D(2, 2, 1), [3] = SI_2D(2, 2, 1),
+			[10] = SI_2D(2, 2, 1), [11] = SI_2D(2, 2, 1),
+			[12] = SI_2D(2, 1, 1), [14] = SI_2D(2, 2, 1),
+			[15] = SI_2D(2, 2, 1), [16] = SI_2D(2, 1, 1),
+			[17] = SI_2D(2, 0, 0),
+		},
+	},
+	{
+		"BONAIRE", 0x6640, 0x00002022,
+		{
+			[0] = CIK_2D(0, 0), [1] = CIK_2D(1, 0),
+			[2] = CIK_2D(2, 0), [3] = CIK_2D(3, 0),
+			[4] = CIK_2D(6, 0), [10] = CIK_2D(0, 0),
+			[14] = CIK_2D(0, 1),
+		},
+		{
+			CIK_MT(3, 2), CIK_MT(2, 2), CIK_MT(1, 2), CIK_MT(1, 1),
+			CIK_MT(0, 1), CIK_MT(0, 0), CIK_MT(0, 0), CIK_MT(0, 0),
+		},
+	},
+};
+
+static const struct chip *chip;
+static unsigned long offline_ioctls;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Stand-in for the kernel, see above. */
+drm_public int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	if (!chip) {
+		offline_ioctls++;
+		return -1;
+	}
+
+	switch (request) {
+	case DRM_IOCTL_VERSION: {
+		drm_version_t *version = arg;
+
+		/* asked for the string lengths first, then for the strings */
+		version->version_major = 2;
+		version->version_minor = 50;
+		version->name_len = version->date_len = version->desc_len = 6;
+		if (version->name) {
+			memcpy(version->name, "radeon", 6);
+			memcpy(version->date, "radeon", 6);
+			memcpy(version->desc, "radeon", 6);
+		}
+		return 0;
+	}
+	case DRM_IOCTL_RADEON_INFO: {
+		struct drm_radeon_info *info = arg;
+		void *value = (void *)(uintptr_t)info->value;
+
+		switch (info->request) {
+		case RADEON_INFO_DEVICE_ID:
+			*(uint32_t *)value = chip->device_id;
+			return 0;
+		case RADEON_INFO_TILING_CONFIG:
+			*(uint32_t *)value = chip->tiling_config;
+			return 0;
+		case RADEON_INFO_SI_TILE_MODE_ARRAY:
+			memcpy(value, chip->tile_mode_array,
+			       sizeof(chip->tile_mode_array));
+			return 0;
+		case RADEON_INFO_CIK_MACROTILE_MODE_ARRAY:
+			memcpy(value, chip->macrotile_mode_array,
+			       sizeof(chip->macrotile_mode_array));
+			return 0;
+		}
+		return -1;
+	}
+	default:
+		return -1;
+	}
+}
+
+static unsigned log2_levels(unsigned x)
+{
+	unsigned levels = 0;
+
+	while (x >>= 1)
+		levels++;
+	return levels;
+}
+
+/* Fills descs with textures, render targets and depth buffers. */
+static int describe(struct radeon_surface *descs)
+{
+	static const unsigned sizes[][2] = {
+		{ 1, 1 }, { 16, 16 }, { 64, 64 }, { 256, 256 }, { 512, 512 },
+		{ 1024, 1024 }, { 2048, 2048 }, { 4096, 4096 }, { 128, 32 },
+		{ 800, 600 }, { 1280, 720 }, { 1920, 1080 }, { 2560, 1440 },
+	};
+	static const unsigned bpes[] = { 1, 2, 4, 8, 16 };
+	static const unsigned modes[] = {
+		RADEON_SURF_MODE_LINEAR_ALIGNED, RADEON_SURF_MODE_1D,
+		RADEON_SURF_MODE_2D,
+	};
+	unsigned s, b, m, mip, n = 0;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (m = 0; m < 3; m++) {
+			for (b = 0; b < 5; b++) {
+				for (mip = 0; mip < 2; mip++) {
+					struct radeon_surface *surf = &descs[n++];
+
+					memset(surf, 0, sizeof(*surf));
+					surf->npix_x = sizes[s][0];
+					surf->npix_y = sizes[s][1];
+					surf->npix_z = 1;
+					surf->blk_w = surf->blk_h = surf->blk_d = 1;
+					surf->array_size = 1;
+					surf->bpe = bpes[b];
+					surf->nsamples = 1;
+					if (mip)
+						surf->last_level =
+							log2_levels(sizes[s][0] | sizes[s][1]);
+					surf->flags =
+						RADEON_SURF_SET(RADEON_SURF_TYPE_2D, TYPE) |
+						RADEON_SURF_SET(modes[m], MODE) |
+						RADEON_SURF_HAS_TILE_MODE_INDEX;
+				}
+			}
+
+			/* scanout and depth/stencil buffers */
+			descs[n] = descs[n - 6];
+			descs[n].flags |= RADEON_SURF_SCANOUT;
+			n++;
+			descs[n] = descs[n - 7];
+			descs[n].flags |= RADEON_SURF_ZBUFFER |
+					  RADEON_SURF_SBUFFER |
+					  RADEON_SURF_HAS_SBUFFER_MIPTREE;
+			n++;
+		}
+	}
+
+	/* cube maps and texture arrays, from the 2D tiled 32 bpp textures of
+	 * the square sizes */
+	for (s = 0; s < 8; s++) {
+		descs[n] = descs[s * 3 * 12 + 2 * 12 + 5];
+		descs[n].flags = RADEON_SURF_CLR(descs[n].flags, TYPE) |
+				 RADEON_SURF_SET(RADEON_SURF_TYPE_CUBEMAP, TYPE);
+		n++;
+		descs[n] = descs[s * 3 * 12 + 2 * 12 + 4];
+		descs[n].array_size = 6;
+		descs[n].flags = RADEON_SURF_CLR(descs[n].flags, TYPE) |
+				 RADEON_SURF_SET(RADEON_SURF_TYPE_2D_ARRAY, TYPE);
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * Lays out every description rounds times, best then init as mesa does.
+ * Only the description is copied when the layouts are not kept, so that
+ * the copy doesn't take more time than the layout.
+ */
+static uint64_t layout(struct radeon_surface_manager *surf_man,
+		       const struct radeon_surface *descs, int count,
+		       struct radeon_surface *out, int *ret, int rounds)
+{
+	static struct radeon_surface surf;
+	uint64_t start = now_ns();
+	int i, round;
+
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < count; i++) {
+			if (out)
+				surf = descs[i];
+			else
+				memcpy(&surf, &descs[i],
+				       offsetof(struct radeon_surface, level));
+			ret[i] = radeon_surface_best(surf_man, &surf);
+			if (!ret[i])
+				ret[i] = radeon_surface_init(surf_man, &surf);
+			if (out)
+				out[i] = surf;
+		}
+	}
+	return now_ns() - start;
+}
+
+/*
+ * Lays the descriptions out again with a manager made from the chip
+ * configuration instead of a device, in one batch, which must give the
+ * layouts of the manager made from the device.
+ */
+static int check_offline(const struct chip *c,
+			 const struct radeon_surface *descs, int count,
+			 const struct radeon_surface *expected,
+			 const int *expected_ret)
+{
+	static struct radeon_surface got[MAX_SURFACES];
+	static int best_ret[MAX_SURFACES], got_ret[MAX_SURFACES];
+	struct radeon_surface_hw_config config;
+	struct radeon_surface_manager *surf_man;
+	int i;
+
+	memset(&config, 0, sizeof(config));
+	config.device_id = c->device_id;
+	config.tiling_config = c->tiling_config;
+	memcpy(config.tile_mode_array, c->tile_mode_array,
+	       sizeof(config.tile_mode_array));
+	memcpy(config.macrotile_mode_array, c->macrotile_mode_array,
+	       sizeof(config.macrotile_mode_array));
+
+	/* no ioctl may be needed */
+	chip = NULL;
+	surf_man = radeon_surface_manager_new_from_config(&config);
+	if (!surf_man) {
+		fprintf(stderr, "%s: no offline surface manager\n", c->name);
+		return 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		got[i] = descs[i];
+		best_ret[i] = radeon_surface_best(surf_man, &got[i]);
+	}
+	radeon_surface_init_batch(surf_man, got, count, got_ret);
+	radeon_surface_manager_free(surf_man);
+
+	for (i = 0; i < count; i++) {
+		if (best_ret[i]) {
+			if (best_ret[i] != expected_ret[i])
+				break;
+		} else if (got_ret[i] != expected_ret[i] ||
+			   memcmp(&got[i], &expected[i], sizeof(got[i]))) {
+			break;
+		}
+	}
+	if (i < count) {
+		fprintf(stderr, "%s: surface %d differs offline\n", c->name, i);
+		return 1;
+	}
+	if (offline_ioctls) {
+		fprintf(stderr, "%s: %lu ioctls offline\n", c->name,
+			offline_ioctls);
+		return 1;
+	}
+	return 0;
+}
+
+static int bench(const struct chip *c, struct radeon_surface *descs, int count)
+{
+	static struct radeon_surface expected[MAX_SURFACES], got[MAX_SURFACES];
+	static int expected_ret[MAX_SURFACES], got_ret[MAX_SURFACES];
+	struct radeon_surface_cache_stats stats;
+	struct radeon_surface_manager *surf_man;
+	uint64_t plain_ns, cached_ns;
+	int i, valid = 0;
+
+	chip = c;
+	surf_man = radeon_surface_manager_new(-1);
+	if (!surf_man) {
+		fprintf(stderr, "%s: no surface manager\n", c->name);
+		return 1;
+	}
+
+	layout(surf_man, descs, count, expected, expected_ret, 1);
+	plain_ns = layout(surf_man, descs, count, NULL, got_ret, ROUNDS);
+
+	/* a cache too small for all the layouts */
+	radeon_surface_manager_enable_cache(surf_man, count / 4);
+	layout(surf_man, descs, count, got, got_ret, 3);
+	radeon_surface_manager_get_cache_stats(surf_man, &stats);
+	if (stats.entries > (unsigned)count / 4) {
+		fprintf(stderr, "%s: %u layouts cached, limit %d\n", c->name,
+			stats.entries, count / 4);
+		radeon_surface_manager_free(surf_man);
+		return 1;
+	}
+	for (i = 0; i < count; i++) {
+		if (got_ret[i] != expected_ret[i] ||
+		    memcmp(&got[i], &expected[i], sizeof(got[i])))
+			goto fail;
+	}
+
+	radeon_surface_manager_enable_cache(surf_man, 2 * count);
+	layout(surf_man, descs, count, got, got_ret, 1);
+	cached_ns = layout(surf_man, descs, count, NULL, got_ret, ROUNDS);
+	layout(surf_man, descs, count, got, got_ret, 1);
+	for (i = 0; i < count; i++) {
+		if (got_ret[i] != expected_ret[i] ||
+		    memcmp(&got[i], &expected[i], sizeof(got[i])))
+			goto fail;
+		valid += !got_ret[i];
+	}
+	radeon_surface_manager_get_cache_stats(surf_man, &stats);
+
+	printf("%-8s %4d surfaces (%4d valid): %6.2f us computed, "
+	       "%6.2f us cached, %5.1f%% hits\n", c->name, count, valid,
+	       plain_ns / 1000.0 / ROUNDS / count,
+	       cached_ns / 1000.0 / ROUNDS / count,
+	       100.0 * stats.hits / (stats.hits + stats.misses));
+
+	radeon_surface_manager_free(surf_man);
+	return check_offline(c, descs, count, expected, expected_ret);
+
+fail:
+	fprintf(stderr, "%s: surface %d differs with the cache\n", c->name, i);
+	radeon_surface_manager_free(surf_man);
+	return 1;
+}
+
+int main(void)
+{
+	static struct radeon_surface descs[MAX_SURFACES];
+	unsigned i;
+	int count, ret = 0;
+
+	count = describe(descs);
+	for (i = 0; i < sizeof(chips) / sizeof(chips[0]); i++)
+		ret |= bench(&chips[i], descs, count);
+
+	return ret;
+}
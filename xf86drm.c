@@ -4367,25 +4367,85 @@ process_device(drmDevicePtr *device, const char *d_name,
    }
 }
 
+/*
+ * The kernel drm core has a number of places that assume maximum of
+ * 3x64 devices nodes. That's 64 for each of primary, control and
+ * render nodes. Rounded it up to 256 for simplicity.
+ */
+#define MAX_DRM_NODES 256
+
+static size_t drmDeviceBusInfoSize(int bustype)
+{
+    switch (bustype) {
+    case DRM_BUS_PCI:
+        return sizeof(drmPciBusInfo);
+    case DRM_BUS_USB:
+        return sizeof(drmUsbBusInfo);
+    case DRM_BUS_PLATFORM:
+        return sizeof(drmPlatformBusInfo);
+    case DRM_BUS_HOST1X:
+        return sizeof(drmHost1xBusInfo);
+    default:
+        return 0;
+    }
+}
+
+/* FNV-1a over the bytes drmDevicesEqual() compares. */
+static uint32_t drmDeviceHashBusInfo(drmDevicePtr device, size_t size)
+{
+    const unsigned char *data = (const unsigned char *)device->businfo.pci;
+    uint32_t hash = 2166136261u ^ (uint32_t)device->bustype;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
 /* Consider devices located on the same bus as duplicate and fold the respective
- * entries into a single one.
+ * entries into a single one. Devices are looked up in a hash of their bus info,
+ * so this stays linear in the number of nodes.
  *
  * Note: this leaves "gaps" in the array, while preserving the length.
  */
 static void drmFoldDuplicatedDevices(drmDevicePtr local_devices[], int count)
 {
+    int16_t table[2 * MAX_DRM_NODES];
+    const unsigned mask = ARRAY_SIZE(table) - 1;
     int node_type, i, j;
+    unsigned slot;
+    size_t size;
+
+    memset(table, 0xff, sizeof(table));
 
     for (i = 0; i < count; i++) {
-        for (j = i + 1; j < count; j++) {
-            if (drmDevicesEqual(local_devices[i], local_devices[j])) {
-                local_devices[i]->available_nodes |= local_devices[j]->available_nodes;
-                node_type = log2_int(local_devices[j]->available_nodes);
-                memcpy(local_devices[i]->nodes[node_type],
-                       local_devices[j]->nodes[node_type], drmGetMaxNodeName());
-                drmFreeDevice(&local_devices[j]);
-            }
+        if (!local_devices[i])
+            continue;
+
+        size = drmDeviceBusInfoSize(local_devices[i]->bustype);
+        if (!size)
+            continue;
+
+        slot = drmDeviceHashBusInfo(local_devices[i], size) & mask;
+        while ((j = table[slot]) >= 0) {
+            if (drmDevicesEqual(local_devices[j], local_devices[i]))
+                break;
+            slot = (slot + 1) & mask;
         }
+
+        if (j < 0) {
+            table[slot] = i;
+            continue;
+        }
+
+        local_devices[j]->available_nodes |= local_devices[i]->available_nodes;
+        node_type = log2_int(local_devices[i]->available_nodes);
+        memcpy(local_devices[j]->nodes[node_type],
+               local_devices[i]->nodes[node_type], drmGetMaxNodeName());
+        drmFreeDevice(&local_devices[i]);
     }
 }
 
@@ -4411,13 +4471,6 @@ drm_device_has_rdev(drmDevicePtr device, dev_t find_rdev)
     return false;
 }
 
-/*
- * The kernel drm core has a number of places that assume maximum of
- * 3x64 devices nodes. That's 64 for each of primary, control and
- * render nodes. Rounded it up to 256 for simplicity.
- */
-#define MAX_DRM_NODES 256
-
 /**
  * Get information about the opened drm device
  *
@@ -4570,6 +4623,36 @@ drm_public int drmGetDevice(int fd, drmDevicePtr *device)
     return drmGetDevice2(fd, DRM_DEVICE_GET_PCI_REVISION, device);
 }
 
+/*
+ * Fold the per-node devices and hand them out the way drmGetDevices2()
+ * documents it, freeing whatever does not fit into \p devices.
+ */
+static int drmStoreDevices(drmDevicePtr local_devices[], int node_count,
+                           drmDevicePtr devices[], int max_devices)
+{
+    int i, device_count;
+
+    drmFoldDuplicatedDevices(local_devices, node_count);
+
+    device_count = 0;
+    for (i = 0; i < node_count; i++) {
+        if (!local_devices[i])
+            continue;
+
+        if ((devices != NULL) && (device_count < max_devices))
+            devices[device_count] = local_devices[i];
+        else
+            drmFreeDevice(&local_devices[i]);
+
+        device_count++;
+    }
+
+    if (devices != NULL)
+        return MIN2(device_count, max_devices);
+
+    return device_count;
+}
+
 /**
  * Get drm devices on the system
  *
@@ -4593,7 +4676,7 @@ drm_public int drmGetDevices2(uint32_t flags, drmDevicePtr devices[],
     drmDevicePtr device;
     DIR *sysdir;
     struct dirent *dent;
-    int ret, i, node_count, device_count;
+    int ret, i, node_count;
 
     if (drm_device_validate_flags(flags))
         return -EINVAL;
@@ -4619,32 +4702,303 @@ drm_public int drmGetDevices2(uint32_t flags, drmDevicePtr devices[],
     }
     node_count = i;
 
-    drmFoldDuplicatedDevices(local_devices, node_count);
+    closedir(sysdir);
 
-    device_count = 0;
-    for (i = 0; i < node_count; i++) {
-        if (!local_devices[i])
+    return drmStoreDevices(local_devices, node_count, devices, max_devices);
+}
+
+/**
+ * Get drm devices on the system
+ *
+ * \param devices the array of devices with drmDevicePtr elements
+ *                can be NULL to get the device number first
+ * \param max_devices the maximum number of devices for the array
+ *
+ * \return on error - negative error code,
+ *         if devices is NULL - total number of devices available on the system,
+ *         alternatively the number of devices stored in devices[], which is
+ *         capped by the max_devices.
+ */
+drm_public int drmGetDevices(drmDevicePtr devices[], int max_devices)
+{
+    return drmGetDevices2(DRM_DEVICE_GET_PCI_REVISION, devices, max_devices);
+}
+
+static size_t drmDeviceInfoSize(int bustype)
+{
+    switch (bustype) {
+    case DRM_BUS_PCI:
+        return sizeof(drmPciDeviceInfo);
+    case DRM_BUS_USB:
+        return sizeof(drmUsbDeviceInfo);
+    case DRM_BUS_PLATFORM:
+        return sizeof(drmPlatformDeviceInfo);
+    case DRM_BUS_HOST1X:
+        return sizeof(drmHost1xDeviceInfo);
+    default:
+        return 0;
+    }
+}
+
+static int drmCopyCompatible(char **src, char ***dst)
+{
+    unsigned int count, i;
+
+    for (count = 0; src[count]; count++)
+        ;
+
+    *dst = calloc(count + 1, sizeof(char *));
+    if (!*dst)
+        return -ENOMEM;
+
+    for (i = 0; i < count; i++) {
+        (*dst)[i] = strdup(src[i]);
+        if (!(*dst)[i]) {
+            while (i--)
+                free((*dst)[i]);
+            free(*dst);
+            *dst = NULL;
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+/* Deep copy of a device, optionally without its device info. */
+static drmDevicePtr drmDeviceDup(drmDevicePtr src, bool fetch_deviceinfo)
+{
+    size_t bus_size, device_size;
+    drmDevicePtr dev;
+    int node_type, i, ret = 0;
+    char *ptr;
+
+    bus_size = drmDeviceBusInfoSize(src->bustype);
+    device_size = 0;
+    if (fetch_deviceinfo && src->deviceinfo.pci)
+        device_size = drmDeviceInfoSize(src->bustype);
+
+    node_type = log2_int(src->available_nodes);
+    dev = drmDeviceAlloc(node_type, src->nodes[node_type], bus_size,
+                         device_size, &ptr);
+    if (!dev)
+        return NULL;
+
+    dev->available_nodes = src->available_nodes;
+    for (i = 0; i < DRM_NODE_MAX; i++) {
+        if (src->available_nodes & (1 << i))
+            memcpy(dev->nodes[i], src->nodes[i], drmGetMaxNodeName());
+    }
+
+    dev->bustype = src->bustype;
+    dev->businfo.pci = (drmPciBusInfoPtr)ptr;
+    memcpy(ptr, src->businfo.pci, bus_size);
+
+    if (!device_size)
+        return dev;
+
+    ptr += bus_size;
+    dev->deviceinfo.pci = (drmPciDeviceInfoPtr)ptr;
+    memcpy(ptr, src->deviceinfo.pci, device_size);
+
+    switch (dev->bustype) {
+    case DRM_BUS_PLATFORM:
+        ret = drmCopyCompatible(src->deviceinfo.platform->compatible,
+                                &dev->deviceinfo.platform->compatible);
+        break;
+    case DRM_BUS_HOST1X:
+        ret = drmCopyCompatible(src->deviceinfo.host1x->compatible,
+                                &dev->deviceinfo.host1x->compatible);
+        break;
+    }
+
+    if (ret) {
+        free(dev);
+        return NULL;
+    }
+
+    return dev;
+}
+
+struct drm_devices_cache_entry {
+    dev_t rdev;
+    ino_t ino;
+    struct timespec ctime;
+    drmDevicePtr device;
+};
+
+struct _drmDevicesCache {
+    bool valid;
+    uint32_t flags;
+    dev_t dir_dev;
+    ino_t dir_ino;
+    struct timespec dir_mtime;
+    int count;
+    struct drm_devices_cache_entry entries[MAX_DRM_NODES];
+};
+
+/**
+ * Create a cache for drmDevicesCacheGetDevices()
+ *
+ * The cache is owned by the caller, who is also responsible for serializing
+ * its use between threads.
+ *
+ * \return the new cache on success, NULL on allocation failure.
+ */
+drm_public drmDevicesCachePtr drmDevicesCacheCreate(void)
+{
+    return calloc(1, sizeof(struct _drmDevicesCache));
+}
+
+/**
+ * Drop everything the cache knows, so that the next
+ * drmDevicesCacheGetDevices() parses all nodes again.
+ *
+ * \param cache the cache, as returned by drmDevicesCacheCreate()
+ */
+drm_public void drmDevicesCacheInvalidate(drmDevicesCachePtr cache)
+{
+    int i;
+
+    if (!cache)
+        return;
+
+    for (i = 0; i < cache->count; i++)
+        drmFreeDevice(&cache->entries[i].device);
+
+    cache->count = 0;
+    cache->valid = false;
+}
+
+drm_public void drmDevicesCacheDestroy(drmDevicesCachePtr cache)
+{
+    drmDevicesCacheInvalidate(cache);
+    free(cache);
+}
+
+static bool drm_timespec_equal(const struct timespec *a,
+                               const struct timespec *b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/*
+ * Find the parsed device of a node that is still the same device node as
+ * when it was parsed, and take it out of the cache. Nodes mostly come back
+ * in the same readdir order, so \p hint is tried first.
+ */
+static drmDevicePtr
+drm_devices_cache_take(drmDevicesCachePtr cache, const char *node,
+                       const struct stat *sbuf, int hint)
+{
+    struct drm_devices_cache_entry *entry;
+    drmDevicePtr device;
+    int i, n;
+
+    for (n = 0; n < cache->count; n++) {
+        i = (hint + n) % cache->count;
+        entry = &cache->entries[i];
+        device = entry->device;
+
+        if (!device || entry->rdev != sbuf->st_rdev ||
+            entry->ino != sbuf->st_ino ||
+            !drm_timespec_equal(&entry->ctime, &sbuf->st_ctim) ||
+            strcmp(device->nodes[log2_int(device->available_nodes)], node))
             continue;
 
-        if ((devices != NULL) && (device_count < max_devices))
-            devices[device_count] = local_devices[i];
-        else
-            drmFreeDevice(&local_devices[i]);
+        entry->device = NULL;
+        return device;
+    }
 
-        device_count++;
+    return NULL;
+}
+
+/*
+ * Bring the per-node devices up to date with DRM_DIR_NAME. Nothing is read
+ * while the directory is unchanged, and once it changed only the nodes which
+ * were added or recreated are parsed again.
+ */
+static int drm_devices_cache_refresh(drmDevicesCachePtr cache, uint32_t flags)
+{
+    struct drm_devices_cache_entry entries[MAX_DRM_NODES];
+    char node[PATH_MAX + 1];
+    struct stat dir_sbuf, sbuf;
+    struct dirent *dent;
+    drmDevicePtr device;
+    DIR *sysdir;
+    int count;
+
+    if (stat(DRM_DIR_NAME, &dir_sbuf))
+        return -errno;
+
+    if (cache->valid && cache->flags == flags &&
+        cache->dir_dev == dir_sbuf.st_dev &&
+        cache->dir_ino == dir_sbuf.st_ino &&
+        drm_timespec_equal(&cache->dir_mtime, &dir_sbuf.st_mtim))
+        return 0;
+
+    /* The revision field depends on the flags the nodes were parsed with. */
+    if (cache->flags != flags)
+        drmDevicesCacheInvalidate(cache);
+
+    sysdir = opendir(DRM_DIR_NAME);
+    if (!sysdir)
+        return -errno;
+
+    count = 0;
+    while ((dent = readdir(sysdir))) {
+        if (drmGetNodeType(dent->d_name) < 0)
+            continue;
+
+        snprintf(node, PATH_MAX, "%s/%s", DRM_DIR_NAME, dent->d_name);
+        if (stat(node, &sbuf) || !S_ISCHR(sbuf.st_mode))
+            continue;
+
+        device = drm_devices_cache_take(cache, node, &sbuf, count);
+        if (!device &&
+            process_device(&device, dent->d_name, -1, true, flags))
+            continue;
+
+        if (count >= MAX_DRM_NODES) {
+            fprintf(stderr, "More than %d drm nodes detected. "
+                    "Please report a bug - that should not happen.\n"
+                    "Skipping extra nodes\n", MAX_DRM_NODES);
+            drmFreeDevice(&device);
+            break;
+        }
+
+        entries[count].rdev = sbuf.st_rdev;
+        entries[count].ino = sbuf.st_ino;
+        entries[count].ctime = sbuf.st_ctim;
+        entries[count].device = device;
+        count++;
     }
 
     closedir(sysdir);
 
-    if (devices != NULL)
-        return MIN2(device_count, max_devices);
+    /* Whatever was not taken is gone from the directory. */
+    drmDevicesCacheInvalidate(cache);
 
-    return device_count;
+    memcpy(cache->entries, entries, count * sizeof(entries[0]));
+    cache->count = count;
+    cache->flags = flags;
+    cache->dir_dev = dir_sbuf.st_dev;
+    cache->dir_ino = dir_sbuf.st_ino;
+    cache->dir_mtime = dir_sbuf.st_mtim;
+    cache->valid = true;
+
+    return 0;
 }
 
 /**
- * Get drm devices on the system
+ * Get drm devices on the system, reusing what \p cache knows about them
+ *
+ * Behaves like drmGetDevices2(), but the nodes are only parsed again once
+ * DRM_DIR_NAME changed, and then only the nodes that were added or recreated.
+ * Use drmDevicesCacheInvalidate() to force a full rescan.
  *
+ * \param cache the cache, as returned by drmDevicesCacheCreate()
+ * \param flags feature/behaviour bitmask
  * \param devices the array of devices with drmDevicePtr elements
  *                can be NULL to get the device number first
  * \param max_devices the maximum number of devices for the array
@@ -4652,11 +5006,34 @@ drm_public int drmGetDevices2(uint32_t flags, drmDevicePtr devices[],
  * \return on error - negative error code,
  *         if devices is NULL - total number of devices available on the system,
  *         alternatively the number of devices stored in devices[], which is
- *         capped by the max_devices.
+ *         capped by the max_devices. The devices are owned by the caller and
+ *         must be freed with drmFreeDevices().
  */
-drm_public int drmGetDevices(drmDevicePtr devices[], int max_devices)
+drm_public int drmDevicesCacheGetDevices(drmDevicesCachePtr cache,
+                                         uint32_t flags,
+                                         drmDevicePtr devices[],
+                                         int max_devices)
 {
-    return drmGetDevices2(DRM_DEVICE_GET_PCI_REVISION, devices, max_devices);
+    drmDevicePtr local_devices[MAX_DRM_NODES];
+    int ret, i;
+
+    if (!cache || drm_device_validate_flags(flags))
+        return -EINVAL;
+
+    ret = drm_devices_cache_refresh(cache, flags);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < cache->count; i++) {
+        local_devices[i] = drmDeviceDup(cache->entries[i].device,
+                                        devices != NULL);
+        if (!local_devices[i]) {
+            drmFreeDevices(local_devices, i);
+            return -ENOMEM;
+        }
+    }
+
+    return drmStoreDevices(local_devices, cache->count, devices, max_devices);
 }
 
 drm_public char *drmGetDeviceNameFromFd2(int fd)
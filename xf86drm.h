@@ -805,6 +805,33 @@ typedef struct _drmEventContext {
 
 extern int drmHandleEvent(int fd, drmEventContextPtr evctx);
 
+/*
+ * Drain pending events in as few reads as possible, using a caller
+ * provided buffer of at least sizeof(struct drm_event_vblank) bytes.
+ * Events are decoded in place, so the buffer must be aligned for
+ * struct drm_event_vblank, e.g. declared as an array of it or of uint64_t.
+ * At most max_events events are consumed, which lets event loops bound
+ * the work done per wakeup; whatever is left stays queued in the kernel.
+ * drmHandleEvents() dispatches to the handlers in evctx, drmReadEvents()
+ * decodes into the events array instead. Both return the number of
+ * events consumed, 0 if the queue is empty on a non-blocking fd, or -1
+ * with errno set if reading failed.
+ * Event types libdrm does not know about are skipped and not counted.
+ */
+typedef struct _drmEvent {
+	uint32_t type;		/* DRM_EVENT_VBLANK, _FLIP_COMPLETE or _CRTC_SEQUENCE */
+	uint32_t crtc_id;	/* 0 for CRTC_SEQUENCE and on older kernels */
+	uint64_t sequence;
+	uint64_t time_ns;
+	uint64_t user_data;
+} drmEvent, *drmEventPtr;
+
+extern int drmHandleEvents(int fd, drmEventContextPtr evctx,
+			   void *buffer, size_t size,
+			   unsigned int max_events);
+extern int drmReadEvents(int fd, drmEventPtr events, unsigned int max_events,
+			 void *buffer, size_t size);
+
 extern char *drmGetDeviceNameFromFd(int fd);
 
 /* Improved version of drmGetDeviceNameFromFd which attributes for any type of
@@ -915,6 +942,13 @@ extern void drmFreeDevices(drmDevicePtr devices[], int count);
 extern int drmGetDevice2(int fd, uint32_t flags, drmDevicePtr *device);
 extern int drmGetDevices2(uint32_t flags, drmDevicePtr devices[], int max_devices);
 
+typedef struct _drmDevicesCache *drmDevicesCachePtr;
+extern drmDevicesCachePtr drmDevicesCacheCreate(void);
+extern void drmDevicesCacheDestroy(drmDevicesCachePtr cache);
+extern void drmDevicesCacheInvalidate(drmDevicesCachePtr cache);
+extern int drmDevicesCacheGetDevices(drmDevicesCachePtr cache, uint32_t flags,
+                                     drmDevicePtr devices[], int max_devices);
+
 extern int drmDevicesEqual(drmDevicePtr a, drmDevicePtr b);
 
 extern int drmSyncobjCreate(int fd, uint32_t flags, uint32_t *handle);
@@ -54,6 +54,7 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 
 #define memclear(s) memset(&s, 0, sizeof(s))
 
@@ -888,14 +889,67 @@ drm_public int drmModeCrtcSetGamma(int fd, uint32_t crtc_id, uint32_t size,
 	return DRM_IOCTL(fd, DRM_IOCTL_MODE_SETGAMMA, &l);
 }
 
+/*
+ * Hand a single event to the matching handler of @evctx. Returns 1 for the
+ * event types libdrm knows about, 0 for the ones it ignores.
+ */
+static int drm_dispatch_event(int fd, drmEventContextPtr evctx,
+			      struct drm_event *e)
+{
+	struct drm_event_vblank *vblank;
+	struct drm_event_crtc_sequence *seq;
+	void *user_data;
+
+	switch (e->type) {
+	case DRM_EVENT_VBLANK:
+		if (evctx->version < 1 ||
+		    evctx->vblank_handler == NULL)
+			break;
+		vblank = (struct drm_event_vblank *) e;
+		evctx->vblank_handler(fd,
+				      vblank->sequence,
+				      vblank->tv_sec,
+				      vblank->tv_usec,
+				      U642VOID (vblank->user_data));
+		break;
+	case DRM_EVENT_FLIP_COMPLETE:
+		vblank = (struct drm_event_vblank *) e;
+		user_data = U642VOID (vblank->user_data);
+
+		if (evctx->version >= 3 && evctx->page_flip_handler2)
+			evctx->page_flip_handler2(fd,
+						 vblank->sequence,
+						 vblank->tv_sec,
+						 vblank->tv_usec,
+						 vblank->crtc_id,
+						 user_data);
+		else if (evctx->version >= 2 && evctx->page_flip_handler)
+			evctx->page_flip_handler(fd,
+						 vblank->sequence,
+						 vblank->tv_sec,
+						 vblank->tv_usec,
+						 user_data);
+		break;
+	case DRM_EVENT_CRTC_SEQUENCE:
+		seq = (struct drm_event_crtc_sequence *) e;
+		if (evctx->version >= 4 && evctx->sequence_handler)
+			evctx->sequence_handler(fd,
+						seq->sequence,
+						seq->time_ns,
+						seq->user_data);
+		break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
 drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
 {
 	char buffer[1024];
 	int len, i;
 	struct drm_event *e;
-	struct drm_event_vblank *vblank;
-	struct drm_event_crtc_sequence *seq;
-	void *user_data;
 
 	/* The DRM read semantics guarantees that we always get only
 	 * complete events. */
@@ -909,51 +963,156 @@ drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
 	i = 0;
 	while (i < len) {
 		e = (struct drm_event *)(buffer + i);
-		switch (e->type) {
-		case DRM_EVENT_VBLANK:
-			if (evctx->version < 1 ||
-			    evctx->vblank_handler == NULL)
+		drm_dispatch_event(fd, evctx, e);
+		i += e->length;
+	}
+
+	return 0;
+}
+
+/*
+ * All the event types libdrm decodes are this size, so reading at most
+ * max_events times this many bytes never yields more known events than the
+ * caller asked for.
+ */
+#define DRM_EVENT_KNOWN_SIZE sizeof(struct drm_event_vblank)
+
+typedef int (*drm_event_consumer)(struct drm_event *e, void *closure);
+
+/*
+ * Read and consume events until the kernel queue is drained or max_events
+ * known events have been consumed. A read that leaves room for another
+ * event means the queue was empty; only after a read that filled the
+ * buffer do we poll before reading again, so a blocking fd is never left
+ * waiting. Returns the number of known events consumed, or -1 if the first
+ * read fails.
+ */
+static int drm_drain_events(int fd, char *buffer, size_t size,
+			    unsigned int max_events,
+			    drm_event_consumer consume, void *closure)
+{
+	unsigned int count = 0;
+	bool first = true;
+
+	if (size < DRM_EVENT_KNOWN_SIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (count < max_events) {
+		size_t want = (max_events - count) * DRM_EVENT_KNOWN_SIZE;
+		ssize_t len, i;
+
+		if (want > size)
+			want = size;
+
+		if (!first) {
+			struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+			if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
 				break;
-			vblank = (struct drm_event_vblank *) e;
-			evctx->vblank_handler(fd,
-					      vblank->sequence,
-					      vblank->tv_sec,
-					      vblank->tv_usec,
-					      U642VOID (vblank->user_data));
-			break;
-		case DRM_EVENT_FLIP_COMPLETE:
-			vblank = (struct drm_event_vblank *) e;
-			user_data = U642VOID (vblank->user_data);
-
-			if (evctx->version >= 3 && evctx->page_flip_handler2)
-				evctx->page_flip_handler2(fd,
-							 vblank->sequence,
-							 vblank->tv_sec,
-							 vblank->tv_usec,
-							 vblank->crtc_id,
-							 user_data);
-			else if (evctx->version >= 2 && evctx->page_flip_handler)
-				evctx->page_flip_handler(fd,
-							 vblank->sequence,
-							 vblank->tv_sec,
-							 vblank->tv_usec,
-							 user_data);
-			break;
-		case DRM_EVENT_CRTC_SEQUENCE:
-			seq = (struct drm_event_crtc_sequence *) e;
-			if (evctx->version >= 4 && evctx->sequence_handler)
-				evctx->sequence_handler(fd,
-							seq->sequence,
-							seq->time_ns,
-							seq->user_data);
+		}
+
+		len = read(fd, buffer, want);
+		if (len < 0) {
+			if (first && errno != EAGAIN)
+				return -1;
 			break;
-		default:
+		}
+		if (len < (ssize_t)sizeof(struct drm_event))
 			break;
+
+		for (i = 0; i + (ssize_t)sizeof(struct drm_event) <= len;) {
+			struct drm_event *e = (struct drm_event *)(buffer + i);
+
+			if (e->length < sizeof(*e) || i + e->length > len)
+				break;
+			count += consume(e, closure);
+			i += e->length;
 		}
-		i += e->length;
+
+		if ((size_t)len + DRM_EVENT_KNOWN_SIZE <= want)
+			break;
+		first = false;
 	}
 
-	return 0;
+	return count;
+}
+
+struct drm_handle_events_closure {
+	int fd;
+	drmEventContextPtr evctx;
+};
+
+static int drm_handle_events_consume(struct drm_event *e, void *closure)
+{
+	struct drm_handle_events_closure *c = closure;
+
+	return drm_dispatch_event(c->fd, c->evctx, e);
+}
+
+drm_public int drmHandleEvents(int fd, drmEventContextPtr evctx,
+			       void *buffer, size_t size,
+			       unsigned int max_events)
+{
+	struct drm_handle_events_closure c = { fd, evctx };
+
+	if (!evctx || !buffer) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return drm_drain_events(fd, buffer, size, max_events,
+				drm_handle_events_consume, &c);
+}
+
+static int drm_read_events_consume(struct drm_event *e, void *closure)
+{
+	drmEventPtr *next = closure;
+	drmEventPtr out = *next;
+	struct drm_event_vblank *vblank;
+	struct drm_event_crtc_sequence *seq;
+
+	switch (e->type) {
+	case DRM_EVENT_VBLANK:
+	case DRM_EVENT_FLIP_COMPLETE:
+		vblank = (struct drm_event_vblank *) e;
+		out->type = e->type;
+		out->crtc_id = vblank->crtc_id;
+		out->sequence = vblank->sequence;
+		out->time_ns = (uint64_t)vblank->tv_sec * 1000000000ull +
+			       (uint64_t)vblank->tv_usec * 1000ull;
+		out->user_data = vblank->user_data;
+		break;
+	case DRM_EVENT_CRTC_SEQUENCE:
+		seq = (struct drm_event_crtc_sequence *) e;
+		out->type = e->type;
+		out->crtc_id = 0;
+		out->sequence = seq->sequence;
+		out->time_ns = seq->time_ns;
+		out->user_data = seq->user_data;
+		break;
+	default:
+		return 0;
+	}
+
+	*next = out + 1;
+	return 1;
+}
+
+drm_public int drmReadEvents(int fd, drmEventPtr events,
+			     unsigned int max_events,
+			     void *buffer, size_t size)
+{
+	drmEventPtr next = events;
+
+	if (!events || !buffer) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return drm_drain_events(fd, buffer, size, max_events,
+				drm_read_events_consume, &next);
 }
 
 drm_public int drmModePageFlip(int fd, uint32_t crtc_id, uint32_t fb_id,
@@ -1222,6 +1381,15 @@ struct _drmModeAtomicReq {
 	uint32_t cursor;
 	uint32_t size_items;
 	drmModeAtomicReqItemPtr items;
+
+	/*
+	 * Scratch arena used by drmModeAtomicCommit() to sort the request and
+	 * build the ioctl arrays. It is carved out of a single allocation and
+	 * kept around between commits, so committing a request of a size that
+	 * has already been seen does not allocate.
+	 */
+	uint32_t size_scratch;
+	void *scratch;
 };
 
 drm_public drmModeAtomicReqPtr drmModeAtomicAlloc(void)
@@ -1235,6 +1403,8 @@ drm_public drmModeAtomicReqPtr drmModeAtomicAlloc(void)
 	req->items = NULL;
 	req->cursor = 0;
 	req->size_items = 0;
+	req->size_scratch = 0;
+	req->scratch = NULL;
 
 	return req;
 }
@@ -1252,6 +1422,8 @@ drm_public drmModeAtomicReqPtr drmModeAtomicDuplicate(drmModeAtomicReqPtr old)
 
 	new->cursor = old->cursor;
 	new->size_items = old->size_items;
+	new->size_scratch = 0;
+	new->scratch = NULL;
 
 	if (old->size_items) {
 		new->items = drmMalloc(old->size_items * sizeof(*new->items));
@@ -1350,125 +1522,325 @@ drm_public void drmModeAtomicFree(drmModeAtomicReqPtr req)
 
 	if (req->items)
 		drmFree(req->items);
+	drmFree(req->scratch);
 	drmFree(req);
 }
 
-static int sort_req_list(const void *misc, const void *other)
+static inline uint64_t atomic_item_key(const drmModeAtomicReqItem *item)
+{
+	return (uint64_t)item->object_id << 32 | item->property_id;
+}
+
+/*
+ * Sort @count items by object ID, then by property ID, using a stable LSD
+ * radix sort over the bytes of the combined key. Byte positions which are
+ * the same for every item are skipped, which for the usual small object and
+ * property IDs leaves only a few passes. Being stable, entries for the same
+ * property stay in the order they were added. Returns whichever of @items
+ * and @tmp holds the sorted result.
+ */
+static drmModeAtomicReqItemPtr
+atomic_sort_items(drmModeAtomicReqItemPtr items, drmModeAtomicReqItemPtr tmp,
+		  uint32_t count)
 {
-	const drmModeAtomicReqItem *first = misc;
-	const drmModeAtomicReqItem *second = other;
+	uint32_t hist[8][256];
+	uint32_t i, b;
 
-	if (first->object_id < second->object_id)
-		return -1;
-	else if (first->object_id > second->object_id)
-		return 1;
-	else
-		return second->property_id - first->property_id;
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < count; i++) {
+		uint64_t key = atomic_item_key(&items[i]);
+
+		for (b = 0; b < 8; b++)
+			hist[b][(key >> (b * 8)) & 0xff]++;
+	}
+
+	for (b = 0; b < 8; b++) {
+		uint32_t shift = b * 8;
+		uint32_t offset = 0;
+		drmModeAtomicReqItemPtr swap;
+
+		if (hist[b][(atomic_item_key(&items[0]) >> shift) & 0xff] == count)
+			continue;
+
+		for (i = 0; i < 256; i++) {
+			uint32_t n = hist[b][i];
+
+			hist[b][i] = offset;
+			offset += n;
+		}
+
+		for (i = 0; i < count; i++) {
+			uint32_t d = (atomic_item_key(&items[i]) >> shift) & 0xff;
+
+			tmp[hist[b][d]++] = items[i];
+		}
+
+		swap = items;
+		items = tmp;
+		tmp = swap;
+	}
+
+	return items;
 }
 
-drm_public int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
-                                   uint32_t flags, void *user_data)
+/*
+ * Size of the commit scratch arena for @count items: two item arrays for
+ * the sort, the 64-bit values array and three 32-bit arrays (objs,
+ * count_props, props). The 8-byte aligned arrays are placed first.
+ */
+static size_t atomic_scratch_size(uint32_t count)
 {
-	drmModeAtomicReqPtr sorted;
-	struct drm_mode_atomic atomic;
-	uint32_t *objs_ptr = NULL;
-	uint32_t *count_props_ptr = NULL;
-	uint32_t *props_ptr = NULL;
-	uint64_t *prop_values_ptr = NULL;
-	uint32_t last_obj_id = 0;
-	uint32_t i;
-	int obj_idx = -1;
-	int ret = -1;
+	return (size_t)count * (2 * sizeof(drmModeAtomicReqItem) +
+				sizeof(uint64_t) + 3 * sizeof(uint32_t));
+}
 
-	if (!req)
-		return -EINVAL;
+static int atomic_reserve_scratch(drmModeAtomicReqPtr req)
+{
+	void *scratch;
 
-	if (req->cursor == 0)
+	if (req->cursor <= req->size_scratch)
 		return 0;
 
-	sorted = drmModeAtomicDuplicate(req);
-	if (sorted == NULL)
+	/* size_items grows in page sized steps, so this amortizes too. */
+	scratch = drmMalloc(atomic_scratch_size(req->size_items));
+	if (!scratch)
 		return -ENOMEM;
 
-	memclear(atomic);
+	drmFree(req->scratch);
+	req->scratch = scratch;
+	req->size_scratch = req->size_items;
+
+	return 0;
+}
+
+/* The arrays handed to DRM_IOCTL_MODE_ATOMIC. */
+struct atomic_encoding {
+	uint32_t count_objs;
+	uint32_t count_props;
+	uint32_t *objs;
+	uint32_t *count_props_ptr;
+	uint32_t *props;
+	uint64_t *values;
+};
+
+/*
+ * Encode @req into the kernel layout, with the arrays pointing into the
+ * request's scratch arena. They stay valid until the request is modified.
+ */
+static int atomic_encode(drmModeAtomicReqPtr req, struct atomic_encoding *enc)
+{
+	drmModeAtomicReqItemPtr sorted;
+	drmModeAtomicReqItemPtr tmp;
+	uint32_t i;
+	int obj_idx = -1;
+
+	if (atomic_reserve_scratch(req))
+		return -ENOMEM;
+
+	sorted = req->scratch;
+	tmp = &sorted[req->size_scratch];
+	enc->values = (uint64_t *)&tmp[req->size_scratch];
+	enc->objs = (uint32_t *)&enc->values[req->size_scratch];
+	enc->count_props_ptr = &enc->objs[req->size_scratch];
+	enc->props = &enc->count_props_ptr[req->size_scratch];
+	enc->count_props = 0;
 
 	/* Sort the list by object ID, then by property ID. */
-	qsort(sorted->items, sorted->cursor, sizeof(*sorted->items),
-	      sort_req_list);
-
-	/* Now the list is sorted, eliminate duplicate property sets. */
-	for (i = 0; i < sorted->cursor; i++) {
-		if (sorted->items[i].object_id != last_obj_id) {
-			atomic.count_objs++;
-			last_obj_id = sorted->items[i].object_id;
-		}
+	memcpy(sorted, req->items, req->cursor * sizeof(*sorted));
+	sorted = atomic_sort_items(sorted, tmp, req->cursor);
 
-		if (i == sorted->cursor - 1)
+	/*
+	 * Now the list is sorted, emit one entry per (object, property) pair,
+	 * using the value of the last entry in each run of duplicates.
+	 */
+	for (i = 0; i < req->cursor; i++) {
+		if (i + 1 < req->cursor &&
+		    sorted[i].object_id == sorted[i + 1].object_id &&
+		    sorted[i].property_id == sorted[i + 1].property_id)
 			continue;
 
-		if (sorted->items[i].object_id != sorted->items[i + 1].object_id ||
-		    sorted->items[i].property_id != sorted->items[i + 1].property_id)
-			continue;
+		if (obj_idx < 0 || enc->objs[obj_idx] != sorted[i].object_id) {
+			obj_idx++;
+			enc->objs[obj_idx] = sorted[i].object_id;
+			enc->count_props_ptr[obj_idx] = 0;
+		}
 
-		memmove(&sorted->items[i], &sorted->items[i + 1],
-			(sorted->cursor - i - 1) * sizeof(*sorted->items));
-		sorted->cursor--;
+		enc->count_props_ptr[obj_idx]++;
+		enc->props[enc->count_props] = sorted[i].property_id;
+		enc->values[enc->count_props] = sorted[i].value;
+		enc->count_props++;
 	}
+	enc->count_objs = obj_idx + 1;
+
+	return 0;
+}
+
+static int atomic_commit_encoding(int fd, const struct atomic_encoding *enc,
+				  uint32_t flags, void *user_data)
+{
+	struct drm_mode_atomic atomic;
+
+	memclear(atomic);
+	atomic.flags = flags;
+	atomic.count_objs = enc->count_objs;
+	atomic.objs_ptr = VOID2U64(enc->objs);
+	atomic.count_props_ptr = VOID2U64(enc->count_props_ptr);
+	atomic.props_ptr = VOID2U64(enc->props);
+	atomic.prop_values_ptr = VOID2U64(enc->values);
+	atomic.user_data = VOID2U64(user_data);
+
+	return DRM_IOCTL(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+}
+
+drm_public int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
+                                   uint32_t flags, void *user_data)
+{
+	struct atomic_encoding enc;
 
-	objs_ptr = drmMalloc(atomic.count_objs * sizeof objs_ptr[0]);
-	if (!objs_ptr) {
+	if (!req)
+		return -EINVAL;
+
+	if (req->cursor == 0)
+		return 0;
+
+	if (atomic_encode(req, &enc)) {
 		errno = ENOMEM;
-		goto out;
+		return -ENOMEM;
 	}
 
-	count_props_ptr = drmMalloc(atomic.count_objs * sizeof count_props_ptr[0]);
-	if (!count_props_ptr) {
-		errno = ENOMEM;
-		goto out;
+	return atomic_commit_encoding(fd, &enc, flags, user_data);
+}
+
+/*
+ * A request frozen in the layout DRM_IOCTL_MODE_ATOMIC expects. Only the
+ * property values can change afterwards, so committing it needs neither
+ * sorting nor allocations. first_prop[] holds the index into props[] of
+ * each object's first property and is only used for lookups.
+ */
+struct _drmModeAtomicEncoded {
+	struct atomic_encoding enc;
+	uint32_t *first_prop;
+};
+
+drm_public drmModeAtomicEncodedPtr
+drmModeAtomicEncode(drmModeAtomicReqPtr req)
+{
+	drmModeAtomicEncodedPtr encoded;
+	struct atomic_encoding enc;
+	uint32_t i, first = 0;
+	char *p;
+
+	if (!req || req->cursor == 0) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	props_ptr = drmMalloc(sorted->cursor * sizeof props_ptr[0]);
-	if (!props_ptr) {
+	if (atomic_encode(req, &enc)) {
 		errno = ENOMEM;
-		goto out;
+		return NULL;
 	}
 
-	prop_values_ptr = drmMalloc(sorted->cursor * sizeof prop_values_ptr[0]);
-	if (!prop_values_ptr) {
+	encoded = drmMalloc(sizeof(*encoded) +
+			    enc.count_props * sizeof(uint64_t) +
+			    enc.count_objs * 3 * sizeof(uint32_t) +
+			    enc.count_props * sizeof(uint32_t));
+	if (!encoded) {
 		errno = ENOMEM;
-		goto out;
+		return NULL;
 	}
 
-	for (i = 0, last_obj_id = 0; i < sorted->cursor; i++) {
-		if (sorted->items[i].object_id != last_obj_id) {
-			obj_idx++;
-			objs_ptr[obj_idx] = sorted->items[i].object_id;
-			last_obj_id = objs_ptr[obj_idx];
-		}
+	p = (char *)(encoded + 1);
+	encoded->enc.count_objs = enc.count_objs;
+	encoded->enc.count_props = enc.count_props;
+	encoded->enc.values = (uint64_t *)p;
+	p += enc.count_props * sizeof(uint64_t);
+	encoded->enc.objs = (uint32_t *)p;
+	encoded->enc.count_props_ptr = &encoded->enc.objs[enc.count_objs];
+	encoded->first_prop = &encoded->enc.count_props_ptr[enc.count_objs];
+	encoded->enc.props = &encoded->first_prop[enc.count_objs];
+
+	memcpy(encoded->enc.values, enc.values,
+	       enc.count_props * sizeof(*enc.values));
+	memcpy(encoded->enc.objs, enc.objs, enc.count_objs * sizeof(*enc.objs));
+	memcpy(encoded->enc.count_props_ptr, enc.count_props_ptr,
+	       enc.count_objs * sizeof(*enc.count_props_ptr));
+	memcpy(encoded->enc.props, enc.props,
+	       enc.count_props * sizeof(*enc.props));
+
+	for (i = 0; i < enc.count_objs; i++) {
+		encoded->first_prop[i] = first;
+		first += enc.count_props_ptr[i];
+	}
 
-		count_props_ptr[obj_idx]++;
-		props_ptr[i] = sorted->items[i].property_id;
-		prop_values_ptr[i] = sorted->items[i].value;
+	return encoded;
+}
 
+drm_public void drmModeAtomicEncodedFree(drmModeAtomicEncodedPtr encoded)
+{
+	drmFree(encoded);
+}
+
+static int atomic_find_u32(const uint32_t *array, uint32_t count, uint32_t key)
+{
+	uint32_t lo = 0, hi = count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (array[mid] == key)
+			return mid;
+		if (array[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	atomic.flags = flags;
-	atomic.objs_ptr = VOID2U64(objs_ptr);
-	atomic.count_props_ptr = VOID2U64(count_props_ptr);
-	atomic.props_ptr = VOID2U64(props_ptr);
-	atomic.prop_values_ptr = VOID2U64(prop_values_ptr);
-	atomic.user_data = VOID2U64(user_data);
+	return -1;
+}
+
+drm_public int drmModeAtomicEncodedLookup(drmModeAtomicEncodedPtr encoded,
+                                          uint32_t object_id,
+                                          uint32_t property_id)
+{
+	int obj, prop;
+	uint32_t first;
 
-	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+	if (!encoded)
+		return -EINVAL;
 
-out:
-	drmFree(objs_ptr);
-	drmFree(count_props_ptr);
-	drmFree(props_ptr);
-	drmFree(prop_values_ptr);
-	drmModeAtomicFree(sorted);
+	obj = atomic_find_u32(encoded->enc.objs, encoded->enc.count_objs,
+			      object_id);
+	if (obj < 0)
+		return -ENOENT;
 
-	return ret;
+	first = encoded->first_prop[obj];
+	prop = atomic_find_u32(&encoded->enc.props[first],
+			       encoded->enc.count_props_ptr[obj], property_id);
+	if (prop < 0)
+		return -ENOENT;
+
+	return first + prop;
+}
+
+drm_public int drmModeAtomicEncodedSetValue(drmModeAtomicEncodedPtr encoded,
+                                            int slot, uint64_t value)
+{
+	if (!encoded || slot < 0 || (uint32_t)slot >= encoded->enc.count_props)
+		return -EINVAL;
+
+	encoded->enc.values[slot] = value;
+
+	return 0;
+}
+
+drm_public int drmModeAtomicEncodedCommit(int fd,
+                                          drmModeAtomicEncodedPtr encoded,
+                                          uint32_t flags, void *user_data)
+{
+	if (!encoded)
+		return -EINVAL;
+
+	return atomic_commit_encoding(fd, &encoded->enc, flags, user_data);
 }
 
 drm_public int
@@ -442,6 +442,27 @@ extern int drmModeAtomicCommit(int fd,
 			       uint32_t flags,
 			       void *user_data);
 
+/*
+ * Pre-encoded atomic requests, for commits which repeat the same set of
+ * properties (e.g. steady-state page flips). drmModeAtomicEncode() freezes
+ * a request into the form handed to the kernel, after which only property
+ * values may be changed, addressed by the slot drmModeAtomicEncodedLookup()
+ * returns. Committing an encoded request neither sorts nor allocates.
+ */
+typedef struct _drmModeAtomicEncoded drmModeAtomicEncoded, *drmModeAtomicEncodedPtr;
+
+extern drmModeAtomicEncodedPtr drmModeAtomicEncode(drmModeAtomicReqPtr req);
+extern void drmModeAtomicEncodedFree(drmModeAtomicEncodedPtr encoded);
+extern int drmModeAtomicEncodedLookup(drmModeAtomicEncodedPtr encoded,
+				      uint32_t object_id,
+				      uint32_t property_id);
+extern int drmModeAtomicEncodedSetValue(drmModeAtomicEncodedPtr encoded,
+					int slot, uint64_t value);
+extern int drmModeAtomicEncodedCommit(int fd,
+				      drmModeAtomicEncodedPtr encoded,
+				      uint32_t flags,
+				      void *user_data);
+
 extern int drmModeCreatePropertyBlob(int fd, const void *data, size_t size,
 				     uint32_t *id);
 extern int drmModeDestroyPropertyBlob(int fd, uint32_t id);
@@ -174,6 +174,7 @@ drm_public int drmSLInsert(void *l, unsigned long key, void *value)
     }
 
     entry = SLCreateEntry(level, key, value);
+    if (!entry) return -1;
 
 				/* Fix up forward pointers */
     for (i = 0; i <= level; i++) {